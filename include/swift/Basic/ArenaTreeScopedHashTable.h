@@ -0,0 +1,573 @@
+//===--- ArenaTreeScopedHashTable.h - Arena-backed scoped table -*- C++ -*-===//
+//
+// This source file is part of the Swift.org open source project
+//
+// Copyright (c) 2014 - 2017 Apple Inc. and the Swift project authors
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// See https://swift.org/LICENSE.txt for license information
+// See https://swift.org/CONTRIBUTORS.txt for the list of Swift project authors
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file defines ArenaTreeScopedHashTable, a variant of
+//  TreeScopedHashTable with the same scoping model but different storage:
+//
+//  - Each scope allocates its values from its own chain of bump slabs,
+//    which are taken from a pool owned by the table.  Popping a scope
+//    returns its whole chain to the pool at once (running destructors
+//    first only if the keys or values need it).
+//
+//  - Each scope indexes its own values with a flat open-addressing table
+//    that lives in the same slabs, so popping a scope doesn't have to
+//    erase anything from a shared map.  A lookup hashes the key once and
+//    probes each non-empty scope on the way to the root.
+//
+//  Because no state is shared between scopes except the slab pool, a
+//  concurrent table lets sibling scopes be used from different threads:
+//  see ArenaTreeScopedHashTable for the rules.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef SWIFT_ARENATREESCOPEDHASHTABLE_H
+#define SWIFT_ARENATREESCOPEDHASHTABLE_H
+
+#include "swift/Basic/TreeScopedHashTable.h"
+#include "swift/Basic/type_traits.h"
+#include "llvm/ADT/DenseMapInfo.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/Mutex.h"
+#include <atomic>
+#include <climits>
+#include <cstring>
+#include <utility>
+
+namespace swift {
+
+    template<typename K, typename V>
+    class ArenaTreeScopedHashTable;
+
+    template<typename K, typename V>
+    class ArenaTreeScopedHashTableScope;
+
+/// \brief The slabs shared by the scopes of an ArenaTreeScopedHashTable.
+///
+/// Slabs come in power-of-two size classes and are never returned to the
+/// system before the pool is destroyed; a freed slab goes on the free list
+/// for its class and is reused by the next scope that needs one.
+///
+/// A thread-safe pool serializes slab allocation and deallocation with a
+/// lock; scopes only take it once per slab, not once per value.
+    class ScopedHashTableSlabPool {
+    public:
+        struct Slab {
+            /// The slab allocated before this one in the same scope.
+            Slab *Prev;
+            unsigned SizeClass;
+
+            char *begin() { return reinterpret_cast<char *>(this + 1); }
+
+            char *end() {
+                return reinterpret_cast<char *>(this) + getSlabSize(SizeClass);
+            }
+        };
+
+        enum : size_t {
+            MinSlabSize = 256,
+            /// Scopes grow their slabs geometrically up to this class (16KB);
+            /// larger slabs are only handed out for single large requests.
+            MaxGrowthSizeClass = 6,
+            NumSizeClasses = sizeof(size_t) * CHAR_BIT - 8
+        };
+
+        static size_t getSlabSize(unsigned sizeClass) {
+            return size_t(MinSlabSize) << sizeClass;
+        }
+
+    private:
+        llvm::BumpPtrAllocator Arena;
+        Slab *FreeSlabs[NumSizeClasses];
+        llvm::sys::Mutex Mux;
+        const bool ThreadSafe;
+
+        Slab *allocateImpl(unsigned minSizeClass, size_t minUsableBytes);
+
+        void deallocateChainImpl(Slab *last);
+
+        ScopedHashTableSlabPool(const ScopedHashTableSlabPool &) = delete;
+
+        void operator=(const ScopedHashTableSlabPool &) = delete;
+
+    public:
+        explicit ScopedHashTableSlabPool(bool ThreadSafe) : ThreadSafe(ThreadSafe) {
+            std::fill(FreeSlabs, FreeSlabs + NumSizeClasses, nullptr);
+        }
+
+        bool isThreadSafe() const { return ThreadSafe; }
+
+        /// Return a slab of at least the given size class whose usable space
+        /// is at least the given number of bytes.
+        Slab *allocate(unsigned minSizeClass, size_t minUsableBytes) {
+            if (!ThreadSafe)
+                return allocateImpl(minSizeClass, minUsableBytes);
+            llvm::sys::ScopedLock L(Mux);
+            return allocateImpl(minSizeClass, minUsableBytes);
+        }
+
+        /// Return a chain of slabs, linked through Prev, to the pool.
+        void deallocateChain(Slab *last) {
+            if (!ThreadSafe)
+                return deallocateChainImpl(last);
+            llvm::sys::ScopedLock L(Mux);
+            deallocateChainImpl(last);
+        }
+
+        /// Return the total number of bytes the pool has taken from the
+        /// system.
+        size_t getTotalMemory() {
+            if (!ThreadSafe)
+                return Arena.getTotalMemory();
+            llvm::sys::ScopedLock L(Mux);
+            return Arena.getTotalMemory();
+        }
+    };
+
+/// \brief A reference-counted scope that owns its values, its slabs and the
+/// index over its values.
+    template<typename K, typename V>
+    class ArenaTreeScopedHashTableScopeImpl {
+    public:
+        typedef ArenaTreeScopedHashTable<K, V> HTTy;
+        typedef TreeScopedHashTableVal<K, V> ValTy;
+        typedef ScopedHashTableSlabPool::Slab SlabTy;
+
+        /// The hashtable that we are active for.
+        HTTy *HT;
+
+        /// This is the scope that we are shadowing in HT.
+        ArenaTreeScopedHashTableScopeImpl *ParentScope;
+
+        /// If this scope was moved from, the scope that it was moved to.
+        /// Child scopes created before the move still point here.
+        ArenaTreeScopedHashTableScopeImpl *MovedTo;
+
+        /// This is the last value that was inserted for this scope or null if none
+        /// have been inserted yet.
+        ValTy *LastValInScope;
+
+        /// The open-addressing index over this scope's values: a power-of-two
+        /// number of buckets, each null or pointing at a value.
+        ValTy **Buckets;
+        unsigned NumBuckets;
+        unsigned NumEntries;
+
+        /// The slab being bump-allocated from, and the free space in it.
+        SlabTy *CurSlab;
+        char *CurPtr;
+        char *CurEnd;
+
+        bool MovedFrom;
+        bool OwnsParentScope;
+
+        /// Set once a child scope has been forked from this one; after that
+        /// this scope is immutable, so children may read it without locks.
+        std::atomic<bool> HasForkedChildren;
+
+        /// Atomic so that forked children on different threads can retain
+        /// and release their shared parents.
+        std::atomic<unsigned> RefCount;
+
+        ArenaTreeScopedHashTableScopeImpl(ArenaTreeScopedHashTableScopeImpl &) = delete;
+
+        void operator=(ArenaTreeScopedHashTableScopeImpl &) = delete;
+
+        ArenaTreeScopedHashTableScopeImpl()
+                : HT(0), ParentScope(0), MovedTo(0), LastValInScope(0), Buckets(0),
+                  NumBuckets(0), NumEntries(0), CurSlab(0), CurPtr(0), CurEnd(0),
+                  MovedFrom(true), OwnsParentScope(false), HasForkedChildren(false),
+                  RefCount(0) {}
+
+        ArenaTreeScopedHashTableScopeImpl(HTTy *HT,
+                                          ArenaTreeScopedHashTableScopeImpl *ParentScope)
+                : HT(HT), ParentScope(ParentScope), MovedTo(0), LastValInScope(0),
+                  Buckets(0), NumBuckets(0), NumEntries(0), CurSlab(0), CurPtr(0),
+                  CurEnd(0), MovedFrom(false), OwnsParentScope(false),
+                  HasForkedChildren(false), RefCount(0) {
+            HT->NumLiveScopes.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        ArenaTreeScopedHashTableScopeImpl(ArenaTreeScopedHashTableScopeImpl &&Other)
+                : HT(Other.HT), ParentScope(Other.ParentScope), MovedTo(0),
+                  LastValInScope(Other.LastValInScope), Buckets(Other.Buckets),
+                  NumBuckets(Other.NumBuckets), NumEntries(Other.NumEntries),
+                  CurSlab(Other.CurSlab), CurPtr(Other.CurPtr), CurEnd(Other.CurEnd),
+                  MovedFrom(false), OwnsParentScope(Other.OwnsParentScope),
+                  HasForkedChildren(Other.HasForkedChildren.load(std::memory_order_relaxed)),
+                  RefCount(Other.RefCount.load(std::memory_order_relaxed)) {
+            assert(!Other.MovedFrom && "moving from a moved-from scope");
+            Other.MovedFrom = true;
+            Other.MovedTo = this;
+        }
+
+        /// Return the scope that currently owns this scope's values.
+        const ArenaTreeScopedHashTableScopeImpl *getLive() const {
+            const ArenaTreeScopedHashTableScopeImpl *Scope = this;
+            while (Scope->MovedTo)
+                Scope = Scope->MovedTo;
+            return Scope;
+        }
+
+        void retain() {
+            RefCount.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void release() {
+            // Make every other owner's use of this scope happen before its
+            // destruction.
+            if (RefCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                delete this;
+        }
+
+        /// Allocate uninitialized memory from this scope's slabs.
+        void *Allocate(size_t Size, size_t Alignment) {
+            char *Ptr = reinterpret_cast<char *>(
+                    llvm::alignTo(reinterpret_cast<uintptr_t>(CurPtr), Alignment));
+            if (!CurSlab || Ptr + Size > CurEnd) {
+                unsigned SizeClass = CurSlab ?
+                        std::min<unsigned>(CurSlab->SizeClass + 1,
+                                           ScopedHashTableSlabPool::MaxGrowthSizeClass) : 0;
+                SlabTy *Slab = HT->SlabPool.allocate(SizeClass, Size + Alignment);
+                Slab->Prev = CurSlab;
+                CurSlab = Slab;
+                CurEnd = Slab->end();
+                Ptr = reinterpret_cast<char *>(
+                        llvm::alignTo(reinterpret_cast<uintptr_t>(Slab->begin()), Alignment));
+            }
+            CurPtr = Ptr + Size;
+            return Ptr;
+        }
+
+        /// The allocator interface expected by TreeScopedHashTableVal.
+        template<typename T>
+        T *Allocate() {
+            return static_cast<T *>(Allocate(sizeof(T), alignof(T)));
+        }
+
+        /// Values are only freed a slab at a time, when the scope is popped.
+        void Deallocate(const void *) {}
+
+        /// Find the value for the given key in this scope alone.
+        ValTy *find(const K &Key, unsigned Hash) const {
+            if (NumEntries == 0)
+                return 0;
+            unsigned Mask = NumBuckets - 1;
+            for (unsigned I = Hash & Mask;; I = (I + 1) & Mask) {
+                ValTy *Val = Buckets[I];
+                if (!Val || llvm::DenseMapInfo<K>::isEqual(Val->getKey(), Key))
+                    return Val;
+            }
+        }
+
+        /// Add a value for a key not yet in this scope to the index.
+        void addToIndex(ValTy *Val, unsigned Hash) {
+            // Keep the load factor at or below 3/4.  The old buckets stay in
+            // the slab until the scope is popped.
+            if ((NumEntries + 1) * 4 > NumBuckets * 3)
+                growIndex();
+
+            unsigned Mask = NumBuckets - 1;
+            unsigned I = Hash & Mask;
+            while (Buckets[I])
+                I = (I + 1) & Mask;
+            Buckets[I] = Val;
+            NumEntries++;
+        }
+
+        void growIndex() {
+            ValTy **OldBuckets = Buckets;
+            unsigned OldNumBuckets = NumBuckets;
+
+            NumBuckets = OldNumBuckets ? OldNumBuckets * 2 : 8;
+            Buckets = static_cast<ValTy **>(
+                    Allocate(NumBuckets * sizeof(ValTy *), alignof(ValTy *)));
+            memset(Buckets, 0, NumBuckets * sizeof(ValTy *));
+
+            unsigned Mask = NumBuckets - 1;
+            for (unsigned B = 0; B != OldNumBuckets; ++B) {
+                ValTy *Val = OldBuckets[B];
+                if (!Val)
+                    continue;
+                unsigned I = HTTy::getHash(Val->getKey()) & Mask;
+                while (Buckets[I])
+                    I = (I + 1) & Mask;
+                Buckets[I] = Val;
+            }
+        }
+
+        ~ArenaTreeScopedHashTableScopeImpl();
+    };
+
+/// \brief A scope that was detached from the stack to heap.
+    template<typename K, typename V>
+    class ArenaTreeScopedHashTableDetachedScope {
+        friend class ArenaTreeScopedHashTableScope<K, V>;
+
+        typedef ArenaTreeScopedHashTableScopeImpl<K, V> ImplTy;
+
+        ImplTy *DetachedImpl;
+
+        ArenaTreeScopedHashTableDetachedScope(ArenaTreeScopedHashTableDetachedScope &) = delete;
+
+        void operator=(ArenaTreeScopedHashTableDetachedScope &) = delete;
+
+        ArenaTreeScopedHashTableDetachedScope(ImplTy *DetachedImpl)
+                : DetachedImpl(DetachedImpl) {
+            DetachedImpl->retain();
+        }
+
+    public:
+        ArenaTreeScopedHashTableDetachedScope() : DetachedImpl(0) {}
+
+        ArenaTreeScopedHashTableDetachedScope(ArenaTreeScopedHashTableDetachedScope &&Other)
+                : DetachedImpl(Other.DetachedImpl) {
+            Other.DetachedImpl = 0;
+        }
+
+        ~ArenaTreeScopedHashTableDetachedScope() {
+            if (DetachedImpl)
+                DetachedImpl->release();
+        }
+    };
+
+/// \brief A normal hashtable scope.  Objects of this class should be created only
+/// on stack.
+    template<typename K, typename V>
+    class ArenaTreeScopedHashTableScope {
+        friend class ArenaTreeScopedHashTable<K, V>;
+
+        typedef ArenaTreeScopedHashTableScopeImpl<K, V> ImplTy;
+
+        /// Inline storage for a reference-counted scope.
+        ImplTy InlineImpl;
+
+        /// Pointer to the reference-counted scope that was detached to the heap.
+        ImplTy *DetachedImpl;
+        ArenaTreeScopedHashTableScope *const ParentScope;
+
+        ImplTy *getImpl() {
+            assert(static_cast<bool>(DetachedImpl) == InlineImpl.MovedFrom);
+            return InlineImpl.MovedFrom ? DetachedImpl : &InlineImpl;
+        }
+
+        const ImplTy *getImpl() const {
+            assert(static_cast<bool>(DetachedImpl) == InlineImpl.MovedFrom);
+            return InlineImpl.MovedFrom ? DetachedImpl : &InlineImpl;
+        }
+
+        ArenaTreeScopedHashTableScope(ArenaTreeScopedHashTableScope &) = delete;
+
+        void operator=(ArenaTreeScopedHashTableScope &) = delete;
+
+    public:
+        /// Install this as the current scope for the hash table.
+        ArenaTreeScopedHashTableScope(ArenaTreeScopedHashTable<K, V> &HT,
+                                      ArenaTreeScopedHashTableScope *ParentScope)
+                : InlineImpl(&HT, ParentScope ? ParentScope->getImpl() : 0),
+                  DetachedImpl(0), ParentScope(ParentScope) {}
+
+        /// Install this as a child of a detached scope, which becomes
+        /// immutable.  This is how scopes are forked for concurrent use: any
+        /// number of children may be forked from the same parent, on any
+        /// threads, and each keeps the parent alive.
+        ArenaTreeScopedHashTableScope(ArenaTreeScopedHashTable<K, V> &HT,
+                                      const ArenaTreeScopedHashTableDetachedScope<K, V> &Parent)
+                : InlineImpl(&HT, Parent.DetachedImpl), DetachedImpl(0), ParentScope(0) {
+            assert(Parent.DetachedImpl && "forking from an empty detached scope");
+            for (ImplTy *Scope = Parent.DetachedImpl; Scope; Scope = Scope->ParentScope) {
+                if (Scope->HasForkedChildren.exchange(true, std::memory_order_relaxed))
+                    break;
+            }
+            Parent.DetachedImpl->retain();
+            InlineImpl.OwnsParentScope = true;
+        }
+
+        ArenaTreeScopedHashTableScope(ArenaTreeScopedHashTableDetachedScope<K, V> &&DS)
+                : DetachedImpl(DS.DetachedImpl), ParentScope(0) {
+            DS.DetachedImpl = 0;
+        }
+
+        ~ArenaTreeScopedHashTableScope() {
+            if (DetachedImpl)
+                DetachedImpl->release();
+        }
+
+        /// \brief Detach this scope to the heap.
+        ArenaTreeScopedHashTableDetachedScope<K, V> detach() {
+            if (DetachedImpl)
+                return ArenaTreeScopedHashTableDetachedScope<K, V>(DetachedImpl);
+
+            // Detach all parent scopes recursively.
+            if (ParentScope && !ParentScope->DetachedImpl) {
+                ParentScope->detach();
+                InlineImpl.ParentScope = ParentScope->getImpl();
+            }
+
+            DetachedImpl = new ImplTy(std::move(InlineImpl));
+            DetachedImpl->retain();
+            if (DetachedImpl->ParentScope && !DetachedImpl->OwnsParentScope) {
+                DetachedImpl->ParentScope->retain();
+                DetachedImpl->OwnsParentScope = true;
+            }
+            return ArenaTreeScopedHashTableDetachedScope<K, V>(DetachedImpl);
+        }
+    };
+
+/// \brief A scoped hashtable that can have multiple active scopes, with the
+/// same interface as TreeScopedHashTable but with per-scope arena storage
+/// and indexes.
+///
+/// Scopes behave exactly like TreeScopedHashTable's: normal scopes live on
+/// the stack and can be detached to the heap, and all scopes must be
+/// destroyed before the hashtable is destroyed.  Values never move once
+/// inserted, so iterators stay valid until their scope is popped.
+///
+/// A table created in concurrent mode can be used from several threads
+/// under these rules:
+///
+/// \li A scope whose subtrees are to be processed in parallel is detached,
+/// and each worker forks its own child from the detached scope with the
+/// (HT, const DetachedScopeTy &) scope constructor.  The parent and all its
+/// ancestors become immutable: inserting into them asserts.
+///
+/// \li Each scope, and the scopes nested in it, are only used by one
+/// thread at a time, and the parent's insertions must happen before the
+/// fork (e.g. by handing the detached scope to the workers through a
+/// task queue).
+///
+/// Lookups then only read immutable ancestors, so they need no locks;
+/// only slab allocation, once per slab, is serialized.
+    template<typename K, typename V>
+    class ArenaTreeScopedHashTable {
+    public:
+        typedef ArenaTreeScopedHashTableScope<K, V> ScopeTy;
+        typedef ArenaTreeScopedHashTableDetachedScope<K, V> DetachedScopeTy;
+
+    private:
+        typedef TreeScopedHashTableVal<K, V> ValTy;
+        typedef ArenaTreeScopedHashTableScopeImpl<K, V> ImplTy;
+
+        ScopedHashTableSlabPool SlabPool;
+
+        std::atomic<unsigned> NumLiveScopes;
+
+        static unsigned getHash(const K &Key) {
+            return llvm::DenseMapInfo<K>::getHashValue(Key);
+        }
+
+        ArenaTreeScopedHashTable(const ArenaTreeScopedHashTable &) = delete;
+
+        void operator=(const ArenaTreeScopedHashTable &) = delete;
+
+        friend class ArenaTreeScopedHashTableScopeImpl<K, V>;
+
+    public:
+        explicit ArenaTreeScopedHashTable(bool IsConcurrent = false)
+                : SlabPool(IsConcurrent), NumLiveScopes(0) {}
+
+        ~ArenaTreeScopedHashTable() {
+            assert(NumLiveScopes == 0 && "Scope imbalance!");
+        }
+
+        /// Can sibling scopes of this table be used from different threads?
+        bool isConcurrent() const { return SlabPool.isThreadSafe(); }
+
+        /// Return the total number of bytes of slab memory the table has
+        /// taken from the system.
+        size_t getMemorySize() { return SlabPool.getTotalMemory(); }
+
+        bool count(const ScopeTy &S, const K &Key) const {
+            unsigned Hash = getHash(Key);
+            const ImplTy *CurrScope = S.getImpl();
+            while (CurrScope) {
+                CurrScope = CurrScope->getLive();
+                if (CurrScope->find(Key, Hash))
+                    return true;
+                CurrScope = CurrScope->ParentScope;
+            }
+            return false;
+        }
+
+        V lookup(const ScopeTy &S, const K &Key) {
+            unsigned Hash = getHash(Key);
+            const ImplTy *CurrScope = S.getImpl();
+            while (CurrScope) {
+                CurrScope = CurrScope->getLive();
+                if (ValTy *Val = CurrScope->find(Key, Hash))
+                    return Val->getValue();
+                CurrScope = CurrScope->ParentScope;
+            }
+            return V();
+        }
+
+        typedef TreeScopedHashTableIterator<K, V> iterator;
+
+        iterator end() { return iterator(0); }
+
+        iterator begin(ScopeTy &S, const K &Key) {
+            return iterator(S.getImpl()->find(Key, getHash(Key)));
+        }
+
+        /// This inserts the specified key/value at the specified
+        /// (possibly not the current) scope.  While it is ok to insert into a scope
+        /// that isn't the current one, it isn't ok to insert *underneath* an existing
+        /// value of the specified key.
+        void insertIntoScope(ScopeTy &S, const K &Key, const V &Val) {
+            unsigned Hash = getHash(Key);
+            ValTy *PrevEntry = 0;
+            const ImplTy *CurrScope = S.getImpl();
+            while (CurrScope) {
+                CurrScope = CurrScope->getLive();
+                if ((PrevEntry = CurrScope->find(Key, Hash)))
+                    break;
+                CurrScope = CurrScope->ParentScope;
+            }
+
+            ImplTy *Scope = S.getImpl();
+            assert(!Scope->find(Key, Hash));
+            assert(!Scope->HasForkedChildren.load(std::memory_order_relaxed) &&
+                   "inserting into a scope with forked children");
+            ValTy *NewEntry =
+                    ValTy::Create(Scope->LastValInScope, PrevEntry, Key, Val, *Scope);
+            Scope->addToIndex(NewEntry, Hash);
+            Scope->LastValInScope = NewEntry;
+        }
+    };
+
+    template<typename K, typename V>
+    ArenaTreeScopedHashTableScopeImpl<K, V>::~ArenaTreeScopedHashTableScopeImpl() {
+        if (MovedFrom)
+            return;
+
+        // Values are never freed individually, so only visit them if they
+        // need to be destroyed.
+        if (!IsTriviallyDestructible<K>::value ||
+            !IsTriviallyDestructible<V>::value) {
+            while (ValTy *ThisEntry = LastValInScope) {
+                LastValInScope = ThisEntry->getNextInScope();
+                ThisEntry->Destroy(*this);
+            }
+        }
+
+        // Free the values and the index all at once.
+        if (CurSlab)
+            HT->SlabPool.deallocateChain(CurSlab);
+        HT->NumLiveScopes.fetch_sub(1, std::memory_order_relaxed);
+
+        if (OwnsParentScope)
+            ParentScope->release();
+    }
+
+} // end namespace swift
+
+#endif //SWIFT_ARENATREESCOPEDHASHTABLE_H
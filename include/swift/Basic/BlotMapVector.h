@@ -14,8 +14,12 @@
 #define SWIFT_BLOTMAPVECTOR_H
 
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallBitVector.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/iterator.h"
 #include "swift/Basic/LLVM.h"
 #include "swift/Basic/Range.h"
+#include <type_traits>
 #include <vector>
 
 namespace swift {
@@ -27,6 +31,16 @@ namespace swift {
 
     /// \brief An associative container with fast insertion-order (deterministic)
     /// iteration over its elements. Plus the special blot operation.
+    ///
+    /// Blotted entries leave tombstones in the vector.  Once tombstones make up
+    /// more than half of the vector, or the vector would otherwise have to
+    /// grow to make room for a new entry, the next insertion compacts the
+    /// vector first and renumbers the indices in the map.  Insertion may
+    /// therefore invalidate iterators (as it always could); blot and erase
+    /// never do.
+    ///
+    /// The live entries are also tracked in a bitmap, so the live_begin() /
+    /// getLiveItems() iterators skip runs of tombstones a word at a time.
     template<typename KeyT, typename ValueT,
             typename MapT = llvm::DenseMap<KeyT, size_t>,
             typename VectorT = std::vector<Optional<std::pair<KeyT, ValueT>>>>
@@ -37,12 +51,79 @@ namespace swift {
         /// Keys and values.
         VectorT Vector;
 
+        /// One bit per element of Vector, set if the element is live.
+        llvm::SmallBitVector Live;
+
+        /// Make room for a new entry, compacting the vector if that would
+        /// reclaim enough tombstones.  Returns the index of the new entry.
+        size_t prepareForInsert() {
+            size_t NumTombstones = Vector.size() - Map.size();
+            if (NumTombstones != 0 &&
+                (NumTombstones * 2 > Vector.size() ||
+                 (Vector.size() == Vector.capacity() &&
+                  NumTombstones * 8 >= Vector.size())))
+                compact();
+            Live.push_back(true);
+            return Vector.size();
+        }
+
+        template<bool IsConst>
+        class LiveIteratorImpl
+                : public llvm::iterator_facade_base<
+                        LiveIteratorImpl<IsConst>, std::forward_iterator_tag,
+                        typename std::conditional<
+                                IsConst, const std::pair<KeyT, ValueT>,
+                                std::pair<KeyT, ValueT>>::type> {
+            friend class BlotMapVector;
+
+            using ParentTy = typename std::conditional<IsConst,
+                    const BlotMapVector, BlotMapVector>::type;
+            using ReferenceTy = typename std::conditional<
+                    IsConst, const std::pair<KeyT, ValueT> &,
+                    std::pair<KeyT, ValueT> &>::type;
+
+            ParentTy *Parent;
+            /// The index of the current element, or -1 at the end.
+            int Index;
+
+            LiveIteratorImpl(ParentTy *Parent, int Index)
+                    : Parent(Parent), Index(Index) {}
+
+        public:
+            LiveIteratorImpl() : Parent(nullptr), Index(-1) {}
+
+            /// Allow conversion from a mutable to a const iterator.
+            template<bool WasConst,
+                    typename = typename std::enable_if<IsConst && !WasConst>::type>
+            LiveIteratorImpl(const LiveIteratorImpl<WasConst> &Other)
+                    : Parent(Other.Parent), Index(Other.Index) {}
+
+            ReferenceTy operator*() const {
+                assert(Index >= 0 && "dereferencing the end iterator");
+                return *Parent->Vector[Index];
+            }
+
+            LiveIteratorImpl &operator++() {
+                assert(Index >= 0 && "incrementing the end iterator");
+                Index = Parent->Live.find_next(Index);
+                return *this;
+            }
+
+            bool operator==(const LiveIteratorImpl &Other) const {
+                return Index == Other.Index;
+            }
+        };
+
     public:
         using iterator = typename VectorT::iterator;
         using const_iterator = typename VectorT::const_iterator;
         using key_type = KeyT;
         using mapped_type = ValueT;
 
+        /// Iterators over the live entries only.
+        using live_iterator = LiveIteratorImpl<false>;
+        using const_live_iterator = LiveIteratorImpl<true>;
+
         iterator begin() { return Vector.begin(); }
 
         iterator end() { return Vector.end(); }
@@ -55,27 +136,46 @@ namespace swift {
             return swift::make_range(begin(), end());
         }
 
+        live_iterator live_begin() { return {this, Live.find_first()}; }
+
+        live_iterator live_end() { return {this, -1}; }
+
+        const_live_iterator live_begin() const {
+            return {this, Live.find_first()};
+        }
+
+        const_live_iterator live_end() const { return {this, -1}; }
+
+        /// Return the live entries in insertion order, skipping tombstones.
+        iterator_range<live_iterator> getLiveItems() {
+            return swift::make_range(live_begin(), live_end());
+        }
+
+        iterator_range<const_live_iterator> getLiveItems() const {
+            return swift::make_range(live_begin(), live_end());
+        }
+
         ValueT &operator[](const KeyT &Arg) {
-            auto Pair = Map.insert(std::make_pair(Arg, size_t(0)));
-            if (Pair.second) {
-                size_t Num = Vector.size();
-                Pair.first->second = Num;
-                Vector.push_back({std::make_pair(Arg, ValueT())});
-                return (*Vector[Num]).second;
-            }
-            return Vector[Pair.first->second].getValue().second;
+            auto Iter = Map.find(Arg);
+            if (Iter != Map.end())
+                return Vector[Iter->second].getValue().second;
+
+            size_t Num = prepareForInsert();
+            Map[Arg] = Num;
+            Vector.push_back({std::make_pair(Arg, ValueT())});
+            return (*Vector[Num]).second;
         }
 
         std::pair<iterator, bool>
         insert(const std::pair<KeyT, ValueT> &InsertPair) {
-            auto Pair = Map.insert(std::make_pair(InsertPair.first, size_t(0)));
-            if (Pair.second) {
-                size_t Num = Vector.size();
-                Pair.first->second = Num;
-                Vector.push_back(InsertPair);
-                return std::make_pair(Vector.begin() + Num, true);
-            }
-            return std::make_pair(Vector.begin() + Pair.first->second, false);
+            auto Iter = Map.find(InsertPair.first);
+            if (Iter != Map.end())
+                return std::make_pair(Vector.begin() + Iter->second, false);
+
+            size_t Num = prepareForInsert();
+            Map[InsertPair.first] = Num;
+            Vector.push_back(InsertPair);
+            return std::make_pair(Vector.begin() + Num, true);
         }
 
         iterator find(const KeyT &Key) {
@@ -88,7 +188,7 @@ namespace swift {
         }
 
         const_iterator find(const KeyT &Key) const {
-            return const_cast<BlotMapVector &>(*this)->find(Key);
+            return const_cast<BlotMapVector &>(*this).find(Key);
         }
 
         /// This is similar to erase, but instead of removing the element from the
@@ -108,12 +208,36 @@ namespace swift {
             typename MapT::iterator It = Map.find(Key);
             if (It == Map.end()) return;
             Vector[It->second] = None;
+            Live.reset(It->second);
             Map.erase(It);
         }
 
+        /// Remove all tombstones from the vector, preserving the order of the
+        /// live entries and updating their indices in the map.  This
+        /// invalidates all iterators.
+        void compact() {
+            if (Vector.size() == Map.size()) return;
+
+            size_t NewIndex = 0;
+            for (int OldIndex = Live.find_first(); OldIndex != -1;
+                 OldIndex = Live.find_next(OldIndex), ++NewIndex) {
+                if (size_t(OldIndex) == NewIndex) continue;
+                Vector[NewIndex] = std::move(Vector[OldIndex]);
+                Map.find(Vector[NewIndex]->first)->second = NewIndex;
+            }
+            assert(NewIndex == Map.size() && "map and vector out of sync");
+            Vector.erase(Vector.begin() + NewIndex, Vector.end());
+            Live.clear();
+            Live.resize(NewIndex, true);
+        }
+
+        /// Return the number of blotted entries still occupying the vector.
+        size_t getNumTombstones() const { return Vector.size() - Map.size(); }
+
         void clear() {
             Map.clear();
             Vector.clear();
+            Live.clear();
         }
 
         unsigned size() const { return Map.size(); }
@@ -133,6 +257,10 @@ namespace swift {
         bool empty() const { return Map.empty(); }
     };
 
+    /// A BlotMapVector with inline storage for \p N entries.  Because
+    /// insertion compacts a full vector that holds at least N/8 tombstones
+    /// instead of growing it, churning entries through the map does not
+    /// push the vector out of line while at most 7N/8 entries are live.
     template<typename KeyT, typename ValueT, unsigned N,
             typename MapT = llvm::SmallDenseMap<KeyT, size_t, N>,
             typename VectorT =
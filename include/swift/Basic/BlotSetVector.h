@@ -14,7 +14,10 @@
 
 #include "swift/Basic/LLVM.h"
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallBitVector.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/iterator.h"
 #include <vector>
 
 namespace swift {
@@ -43,12 +46,20 @@ namespace swift {
     ///
     /// (a) The `blot operation' is leaving the value in the set vector, but marking
     /// the value as being dead.
+    ///
+    /// Because of (2), tombstones are never reclaimed implicitly.  Clients that
+    /// can renumber their own references may call compact(), which reports the
+    /// new index of every surviving value.  The live values are tracked in a
+    /// bitmap, so getLiveRange() skips runs of tombstones a word at a time.
     template<typename ValueT, typename VectorT = std::vector<Optional<ValueT>>,
             typename MapT = llvm::DenseMap<ValueT, unsigned>>
     class BlotSetVector {
         VectorT Vector;
         MapT Map;
 
+        /// One bit per element of Vector, set if the element is live.
+        llvm::SmallBitVector Live;
+
     public:
         /// \brief Construct an empty BlotSetVector.
         BlotSetVector() {}
@@ -82,6 +93,58 @@ namespace swift {
             return {rbegin(), rend()};
         }
 
+        /// An iterator over the live values only.
+        class const_live_iterator
+                : public llvm::iterator_facade_base<const_live_iterator,
+                        std::forward_iterator_tag,
+                        const ValueT> {
+            friend class BlotSetVector;
+
+            const BlotSetVector *Parent;
+            /// The index of the current value, or -1 at the end.
+            int Index;
+
+            const_live_iterator(const BlotSetVector *Parent, int Index)
+                    : Parent(Parent), Index(Index) {}
+
+        public:
+            const_live_iterator() : Parent(nullptr), Index(-1) {}
+
+            const ValueT &operator*() const {
+                assert(Index >= 0 && "dereferencing the end iterator");
+                return *Parent->Vector[Index];
+            }
+
+            const_live_iterator &operator++() {
+                assert(Index >= 0 && "incrementing the end iterator");
+                Index = Parent->Live.find_next(Index);
+                return *this;
+            }
+
+            bool operator==(const const_live_iterator &Other) const {
+                return Index == Other.Index;
+            }
+
+            /// Return the index of the current value in the set vector.
+            unsigned getIndex() const {
+                assert(Index >= 0 && "end iterator has no index");
+                return Index;
+            }
+        };
+
+        const_live_iterator live_begin() const {
+            return {this, Live.find_first()};
+        }
+
+        const_live_iterator live_end() const { return {this, -1}; }
+
+        llvm::iterator_range<const_live_iterator> getLiveRange() const {
+            return {live_begin(), live_end()};
+        }
+
+        /// Return the number of values that have not been blotted.
+        unsigned getNumLive() const { return Map.size(); }
+
         const Optional<ValueT> &operator[](unsigned n) const {
             assert(n < Vector.size() && "Out of range!");
             return Vector[n];
@@ -98,6 +161,7 @@ namespace swift {
             unsigned Index = Vector.size();
             Map[V] = Index;
             Vector.push_back(V);
+            Live.push_back(true);
             return Index;
         }
 
@@ -113,6 +177,7 @@ namespace swift {
             auto Iter2 = Map.find(V2);
             if (Iter2 != Map.end()) {
                 Vector[V1Index] = None;
+                Live.reset(V1Index);
                 return;
             }
 
@@ -129,6 +194,7 @@ namespace swift {
             unsigned Index = Iter->second;
             Map.erase(V);
             Vector[Index] = None;
+            Live.reset(Index);
             return true;
         }
 
@@ -140,6 +206,27 @@ namespace swift {
                 return None;
             return Iter->second;
         }
+
+        /// Remove all blotted entries, preserving the order of the live values.
+        /// This breaks index stability: \p Remap is called with the old and new
+        /// index of every live value whose index changed, in increasing order.
+        void compact(llvm::function_ref<void(unsigned OldIndex,
+                                             unsigned NewIndex)> Remap) {
+            if (Vector.size() == Map.size()) return;
+
+            unsigned NewIndex = 0;
+            for (int OldIndex = Live.find_first(); OldIndex != -1;
+                 OldIndex = Live.find_next(OldIndex), ++NewIndex) {
+                if (unsigned(OldIndex) == NewIndex) continue;
+                Vector[NewIndex] = std::move(Vector[OldIndex]);
+                Map.find(*Vector[NewIndex])->second = NewIndex;
+                Remap(OldIndex, NewIndex);
+            }
+            assert(NewIndex == Map.size() && "map and vector out of sync");
+            Vector.erase(Vector.begin() + NewIndex, Vector.end());
+            Live.clear();
+            Live.resize(NewIndex, true);
+        }
     };
 
     template<typename ValueT, unsigned N,
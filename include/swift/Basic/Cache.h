@@ -13,6 +13,7 @@
 #ifndef SWIFT_CACHE_H
 #define SWIFT_CACHE_H
 
+#include "swift/Basic/ThreadSafeRefCounted.h"
 #include "llvm/ADT/DenseMapInfo.h"
 #include "llvm/ADT/IntrusiveRefCntPtr.h"
 #include "llvm/ADT/StringRef.h"
@@ -219,6 +220,8 @@ namespace swift {
         struct CacheValueInfo<llvm::IntrusiveRefCntPtr<T>> {
             static void *enterCache(const llvm::IntrusiveRefCntPtr<T> &Val) {
                 T *Ptr = Val.get();
+                // Other threads can retrieve the value from now on.
+                markRefCountedShared(Ptr);
                 Ptr->Retain();
                 return Ptr;
             }
@@ -32,6 +32,17 @@
 //   - testing a specific bit
 //   - searching for set bits from the start
 //
+// Range operations (setting, clearing, flipping, testing, searching and
+// extracting the bits in [begin, end)) work a chunk at a time, masking
+// only the chunks at either end of the range.
+//
+// Very long vectors with few runs of equal bits (e.g. the layout of a
+// large fixed-size array) automatically switch to a run-length-encoded
+// representation, in which appending a run, equality and bitwise
+// combination take time proportional to the number of runs rather than
+// the number of bits.  They switch back to dense storage if the number of
+// runs grows to the point that the encoding no longer pays off.
+//
 //===----------------------------------------------------------------------===//
 
 #ifndef SWIFT_CLUSTEREDBITVECTOR_H
@@ -41,6 +52,7 @@
 #include "swift/Basic/LLVM.h"
 #include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/Optional.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/Support/Compiler.h"
 #include "llvm/Support/ErrorHandling.h"
@@ -107,14 +119,37 @@ namespace swift {
         /// Therefore, an efficient way to test whether all bits are zero:
         /// Data != 0.  (isInlineAndAllClear())  Not *guaranteed* to find
         /// something, but still efficient.
+        ///
+        /// 3) When using out-of-line run-length storage, Data is a size_t *
+        /// tagged with RunLengthTag in its low bit.  It points to the end
+        /// index of each run of equal bits, in increasing order.  Runs
+        /// alternate between clear and set bits starting with a clear run;
+        /// only that first run may be empty (when bit 0 is set).  The last
+        /// end is LengthInBits.  The number of runs is stored at index -1
+        /// and the capacity (in runs) at index -2.
         ChunkType Data;
 
         size_t LengthInBits: sizeof(size_t) * CHAR_BIT - 1;
         size_t HasOutOfLineData: 1;
 
+        enum : ChunkType {
+            /// The tag bit of Data marking run-length storage.
+            RunLengthTag = 1
+        };
+
+        enum : size_t {
+            /// Vectors shorter than this are never run-length-encoded.
+            MinRunLengthBits = 64 * ChunkSizeInBits
+        };
+
         /// Is this vector using out-of-line storage?
         bool hasOutOfLineData() const { return HasOutOfLineData; }
 
+        /// Is this vector using out-of-line run-length storage?
+        bool isRunLengthEncoded() const {
+            return hasOutOfLineData() && (Data & RunLengthTag);
+        }
+
         /// Return true if this vector is not using out-of-line storage and
         /// does not have any bits set.  This is a special-case representation
         /// where the capacity can be smaller than the length.
@@ -170,12 +205,12 @@ namespace swift {
 
         /// Return a pointer to the data storage of this bit vector.
         ChunkType *getChunksPtr() {
-            assert(hasSufficientChunkStorage());
+            assert(hasSufficientChunkStorage() && !isRunLengthEncoded());
             return hasOutOfLineData() ? getOutOfLineChunksPtr() : &Data;
         }
 
         const ChunkType *getChunksPtr() const {
-            assert(hasSufficientChunkStorage());
+            assert(hasSufficientChunkStorage() && !isRunLengthEncoded());
             return hasOutOfLineData() ? getOutOfLineChunksPtr() : &Data;
         }
 
@@ -200,15 +235,35 @@ namespace swift {
         /// Return a pointer to the data storage of this bit vector, given
         /// that it's using out-of-line storage.
         ChunkType *getOutOfLineChunksPtr() {
-            assert(hasOutOfLineData());
+            assert(hasOutOfLineData() && !isRunLengthEncoded());
             return reinterpret_cast<ChunkType *>(Data);
         }
 
         const ChunkType *getOutOfLineChunksPtr() const {
-            assert(hasOutOfLineData());
+            assert(hasOutOfLineData() && !isRunLengthEncoded());
             return reinterpret_cast<const ChunkType *>(Data);
         }
 
+        /// Return a pointer to the run ends of this bit vector, given that
+        /// it's using run-length storage.
+        size_t *getRunEndsPtr() {
+            assert(isRunLengthEncoded());
+            return reinterpret_cast<size_t *>(Data & ~ChunkType(RunLengthTag));
+        }
+
+        const size_t *getRunEndsPtr() const {
+            assert(isRunLengthEncoded());
+            return reinterpret_cast<const size_t *>(Data & ~ChunkType(RunLengthTag));
+        }
+
+        size_t getNumRuns() const { return getRunEndsPtr()[-1]; }
+
+        size_t getRunCapacity() const { return getRunEndsPtr()[-2]; }
+
+        ArrayRef<size_t> getRunEnds() const {
+            return {getRunEndsPtr(), getNumRuns()};
+        }
+
     public:
         /// Create a new bit vector of zero length.  This does not perform
         /// any allocations.
@@ -218,7 +273,8 @@ namespace swift {
         static ClusteredBitVector getConstant(size_t numBits, bool value) {
             ClusteredBitVector result;
             if (value) {
-                result.reserve(numBits);
+                if (numBits < MinRunLengthBits)
+                    result.reserve(numBits);
                 result.appendSetBits(numBits);
             } else {
                 result.appendClearBits(numBits);
@@ -243,8 +299,13 @@ namespace swift {
         }
 
         ClusteredBitVector &operator=(const ClusteredBitVector &other) {
+            if (this == &other) return *this;
+
             // Do something with our current out-of-line storage.
-            if (hasOutOfLineData()) {
+            if (isRunLengthEncoded() ||
+                (hasOutOfLineData() && other.isRunLengthEncoded())) {
+                destroy();
+            } else if (hasOutOfLineData()) {
                 // Copy into our current storage if its capacity is adequate.
                 auto otherLengthInChunks = other.getLengthInChunks();
                 if (otherLengthInChunks <= getOutOfLineCapacityInChunks()) {
@@ -306,6 +367,9 @@ namespace swift {
         /// Reserve space for an extra N bits.  This may unnecessarily force
         /// the vector to use an out-of-line representation.
         void reserveExtra(size_t numBits) {
+            // Run-length storage doesn't have a capacity in bits.
+            if (isRunLengthEncoded()) return;
+
             auto requiredBits = LengthInBits + numBits;
             if (requiredBits > getCapacityInBits()) {
                 auto requiredChunks = getNumChunksForBits(requiredBits);
@@ -327,6 +391,9 @@ namespace swift {
         /// Reserve space for a total of N bits.  This may unnecessarily
         /// force the vector to use an out-of-line representation.
         void reserve(size_t requiredSize) {
+            // Run-length storage doesn't have a capacity in bits.
+            if (isRunLengthEncoded()) return;
+
             if (requiredSize > getCapacityInBits()) {
                 reallocate(getNumChunksForBits(requiredSize));
             }
@@ -344,15 +411,20 @@ namespace swift {
                 return;
             }
 
+            if (other.isInlineAndAllClear()) {
+                appendClearBits(other.size());
+                return;
+            }
+
+            if (isRunLengthEncoded() || other.isRunLengthEncoded()) {
+                appendRunLength(other);
+                return;
+            }
+
             // Okay, one or the other of these is using out-of-line storage.
             // Assume that bits might be set.
             reserveExtra(other.size());
-
-            if (other.isInlineAndAllClear()) {
-                appendConstantBitsReserved(other.size(), 0);
-            } else {
-                appendReserved(other.size(), other.getChunksPtr());
-            }
+            appendReserved(other.size(), other.getChunksPtr());
         }
 
         /// Append the bits from the given vector to this one.
@@ -377,6 +449,11 @@ namespace swift {
                 return;
             }
 
+            if (isRunLengthEncoded()) {
+                addRunLength(numBits, value);
+                return;
+            }
+
             reserveExtra(numBits);
             static_assert(sizeof(value) <= sizeof(ChunkType),
                           "chunk too small for this, break 'value' up into "
@@ -394,6 +471,12 @@ namespace swift {
                 return;
             }
 
+            if (isRunLengthEncoded() ||
+                (shouldTryRunLength(numBits) && tryConvertToRunLength(numBits))) {
+                appendRun(false, numBits);
+                return;
+            }
+
             reserveExtra(numBits);
             appendConstantBitsReserved(numBits, 0);
         }
@@ -408,6 +491,13 @@ namespace swift {
         /// Append a number of set bits to this vector.
         void appendSetBits(size_t numBits) {
             if (numBits == 0) return;
+
+            if (isRunLengthEncoded() ||
+                (shouldTryRunLength(numBits) && tryConvertToRunLength(numBits))) {
+                appendRun(true, numBits);
+                return;
+            }
+
             reserveExtra(numBits);
             appendConstantBitsReserved(numBits, 1);
         }
@@ -422,6 +512,7 @@ namespace swift {
         bool operator[](size_t i) const {
             assert(i < size());
             if (isInlineAndAllClear()) return false;
+            if (isRunLengthEncoded()) return testRunLength(i);
             return getChunks()[i / ChunkSizeInBits]
                    & (ChunkType(1) << (i % ChunkSizeInBits));
         }
@@ -430,6 +521,9 @@ namespace swift {
         ClusteredBitVector &operator&=(const ClusteredBitVector &other) {
             assert(size() == other.size());
 
+            if (isRunLengthEncoded() || other.isRunLengthEncoded())
+                return combineRunLength(other, BitwiseOp::And);
+
             // If this vector is all-clear, this is a no-op.
             if (isInlineAndAllClear())
                 return *this;
@@ -454,6 +548,9 @@ namespace swift {
         ClusteredBitVector &operator|=(const ClusteredBitVector &other) {
             assert(size() == other.size());
 
+            if (isRunLengthEncoded() || other.isRunLengthEncoded())
+                return combineRunLength(other, BitwiseOp::Or);
+
             // If the other vector is all-clear, this is a no-op.
             if (other.isInlineAndAllClear())
                 return *this;
@@ -472,11 +569,61 @@ namespace swift {
             return *this;
         }
 
+        /// Symmetric-difference a bit-vector of the same size into this vector.
+        ClusteredBitVector &operator^=(const ClusteredBitVector &other) {
+            assert(size() == other.size());
+
+            if (isRunLengthEncoded() || other.isRunLengthEncoded())
+                return combineRunLength(other, BitwiseOp::Xor);
+
+            // If the other vector is all-clear, this is a no-op.
+            if (other.isInlineAndAllClear())
+                return *this;
+
+            // If this vector is all-clear, we just copy the other.
+            if (isInlineAndAllClear()) {
+                return (*this = other);
+            }
+
+            // Otherwise, ^= the chunks pairwise.
+            auto chunks = getChunks();
+            auto oi = other.getChunksPtr();
+            for (auto i = chunks.begin(), e = chunks.end(); i != e; ++i, ++oi) {
+                *i ^= *oi;
+            }
+            return *this;
+        }
+
+        /// Clear all the bits in this vector that are set in a bit-vector of
+        /// the same size, i.e. intersect with its complement.
+        ClusteredBitVector &andNot(const ClusteredBitVector &other) {
+            assert(size() == other.size());
+
+            if (isRunLengthEncoded() || other.isRunLengthEncoded())
+                return combineRunLength(other, BitwiseOp::AndNot);
+
+            // If either vector is all-clear, this is a no-op.
+            if (isInlineAndAllClear() || other.isInlineAndAllClear())
+                return *this;
+
+            // Otherwise, &= ~ the chunks pairwise.
+            auto chunks = getChunks();
+            auto oi = other.getChunksPtr();
+            for (auto i = chunks.begin(), e = chunks.end(); i != e; ++i, ++oi) {
+                *i &= ~*oi;
+            }
+            return *this;
+        }
+
         /// Set bit i.
         void setBit(size_t i) {
             assert(i < size());
             if (isInlineAndAllClear()) {
-                reserve(LengthInBits);
+                materialize();
+            }
+            if (isRunLengthEncoded()) {
+                setRange(i, i + 1);
+                return;
             }
             getChunks()[i / ChunkSizeInBits] |= (ChunkType(1) << (i % ChunkSizeInBits));
         }
@@ -485,6 +632,10 @@ namespace swift {
         void clearBit(size_t i) {
             assert(i < size());
             if (isInlineAndAllClear()) return;
+            if (isRunLengthEncoded()) {
+                clearRange(i, i + 1);
+                return;
+            }
             getChunksPtr()[i / ChunkSizeInBits] &= ~(ChunkType(1) << (i % ChunkSizeInBits));
         }
 
@@ -492,7 +643,11 @@ namespace swift {
         void flipBit(size_t i) {
             assert(i < size());
             if (isInlineAndAllClear()) {
-                reserve(LengthInBits);
+                materialize();
+            }
+            if (isRunLengthEncoded()) {
+                flipRange(i, i + 1);
+                return;
             }
             getChunksPtr()[i / ChunkSizeInBits] ^= (ChunkType(1) << (i % ChunkSizeInBits));
         }
@@ -501,7 +656,11 @@ namespace swift {
         void flipAll() {
             if (empty()) return;
             if (isInlineAndAllClear()) {
-                reserve(LengthInBits);
+                materialize();
+            }
+            if (isRunLengthEncoded()) {
+                flipAllRunLength();
+                return;
             }
             for (auto &chunk : getChunks()) {
                 chunk = ~chunk;
@@ -511,16 +670,61 @@ namespace swift {
             }
         }
 
+        /// Set the bits in [begin, end).
+        void setRange(size_t begin, size_t end);
+
+        /// Clear the bits in [begin, end).
+        void clearRange(size_t begin, size_t end);
+
+        /// Toggle the bits in [begin, end).
+        void flipRange(size_t begin, size_t end);
+
+        /// Determine if any of the bits in [begin, end) are set.
+        bool anyInRange(size_t begin, size_t end) const;
+
+        /// Determine if none of the bits in [begin, end) are set.
+        ///
+        /// \return \c !anyInRange(begin, end)
+        bool noneInRange(size_t begin, size_t end) const {
+            return !anyInRange(begin, end);
+        }
+
+        /// Determine if all of the bits in [begin, end) are set.  This is
+        /// trivially true of an empty range.
+        bool allInRange(size_t begin, size_t end) const;
+
+        /// Return the index of the lowest set bit in [begin, end), if any.
+        Optional<size_t> findFirstSet(size_t begin, size_t end) const;
+
+        /// Return the index of the lowest set bit in this vector, if any.
+        Optional<size_t> findFirstSet() const {
+            return findFirstSet(0, size());
+        }
+
+        /// Return the index of the highest set bit in [begin, end), if any.
+        Optional<size_t> findLastSet(size_t begin, size_t end) const;
+
+        /// Return the index of the highest set bit in this vector, if any.
+        Optional<size_t> findLastSet() const {
+            return findLastSet(0, size());
+        }
+
+        /// Return a new vector holding the bits in [begin, end) of this one.
+        ClusteredBitVector extract(size_t begin, size_t end) const;
+
         /// Set the length of this vector to zero, but do not release any capacity.
         void clear() {
             LengthInBits = 0;
-            if (!hasOutOfLineData())
+            if (isRunLengthEncoded())
+                getRunEndsPtr()[-1] = 0;
+            else if (!hasOutOfLineData())
                 Data = 0;
         }
 
         /// Count the number of set bits in this vector.
         size_t count() const {
             if (isInlineAndAllClear()) return 0;
+            if (isRunLengthEncoded()) return countRunLength();
             size_t count = 0;
             for (ChunkType chunk : getChunks()) {
                 count += llvm::countPopulation(chunk);
@@ -531,6 +735,8 @@ namespace swift {
         /// Determine if there are any bits set in this vector.
         bool any() const {
             if (isInlineAndAllClear()) return false;
+            // Only the first run can be empty, so any second run is set.
+            if (isRunLengthEncoded()) return getNumRuns() > 1;
             for (ChunkType chunk : getChunks()) {
                 if (chunk) return true;
             }
@@ -550,11 +756,23 @@ namespace swift {
             const ChunkType *Chunks;
             unsigned CurChunkIndex;
             unsigned NumChunks;
+
+            /// For run-length storage: the run ends, the current (set) run
+            /// and the next bit to return from it.
+            const size_t *RunEnds = nullptr;
+            size_t NumRuns;
+            size_t CurRun;
+            size_t NextBit;
         public:
             explicit SetBitEnumerator(const ClusteredBitVector &vector) {
                 if (vector.isInlineAndAllClear()) {
                     CurChunkIndex = 0;
                     NumChunks = 0;
+                } else if (vector.isRunLengthEncoded()) {
+                    RunEnds = vector.getRunEndsPtr();
+                    NumRuns = vector.getNumRuns();
+                    CurRun = 1;
+                    NextBit = NumRuns > 1 ? RunEnds[0] : 0;
                 } else {
                     Chunks = vector.getChunksPtr();
                     CurChunk = Chunks[0];
@@ -565,6 +783,15 @@ namespace swift {
 
             /// Search for another bit.  Returns false if it can't find one.
             Optional<size_t> findNext() {
+                if (RunEnds) {
+                    while (CurRun < NumRuns) {
+                        if (NextBit < RunEnds[CurRun]) return NextBit++;
+                        CurRun += 2;
+                        if (CurRun < NumRuns) NextBit = RunEnds[CurRun - 1];
+                    }
+                    return None;
+                }
+
                 if (CurChunkIndex == NumChunks) return None;
                 auto cur = CurChunk;
                 while (!cur) {
@@ -624,6 +851,13 @@ namespace swift {
         /// without deleting it.
         void makeIndependentCopy() {
             assert(hasOutOfLineData());
+            if (isRunLengthEncoded()) {
+                auto runEnds = getRunEnds();
+                allocateRuns(runEnds.size());
+                std::copy(runEnds.begin(), runEnds.end(), getRunEndsPtr());
+                getRunEndsPtr()[-1] = runEnds.size();
+                return;
+            }
             auto lengthToCopy = getLengthInChunks();
             allocateAndCopyFrom(getOutOfLineChunksPtr(), lengthToCopy, lengthToCopy);
         }
@@ -658,9 +892,116 @@ namespace swift {
         /// Destroy the out of line data currently stored in this object.
         void destroy() {
             assert(hasOutOfLineData());
+            if (isRunLengthEncoded()) {
+                delete[] (getRunEndsPtr() - 2);
+                return;
+            }
             delete[] (getOutOfLineChunksPtr() - 1);
         }
 
+        /// Give an inline-and-all-clear vector storage in which bits can be
+        /// set: run-length storage if it's long, dense storage otherwise.
+        void materialize() {
+            assert(isInlineAndAllClear());
+            if (LengthInBits >= MinRunLengthBits) {
+                const size_t runEnds[] = {LengthInBits};
+                setRuns(runEnds);
+            } else {
+                reserve(LengthInBits);
+            }
+        }
+
+        /// Allocate run-length storage with room for the given number of
+        /// runs, overwriting Data without deleting it.  The new storage
+        /// has no runs.
+        void allocateRuns(size_t capacityInRuns) {
+            size_t *newRuns = new size_t[capacityInRuns + 2] + 2;
+            newRuns[-2] = capacityInRuns;
+            newRuns[-1] = 0;
+            HasOutOfLineData = true;
+            Data = reinterpret_cast<ChunkType>(newRuns) | RunLengthTag;
+            assert(isRunLengthEncoded() && getRunCapacity() == capacityInRuns);
+        }
+
+        /// Replace the storage of this vector with run-length storage
+        /// holding the given normalized runs.
+        void setRuns(ArrayRef<size_t> runEnds);
+
+        /// Is it worth checking whether appending this many constant bits
+        /// should switch this vector to run-length storage?  Only a large
+        /// append relative to the current length qualifies, which bounds the
+        /// cost of the check to the cost of the appends.
+        bool shouldTryRunLength(size_t numBits) const {
+            return !isRunLengthEncoded() && numBits >= LengthInBits &&
+                   LengthInBits + numBits >= MinRunLengthBits;
+        }
+
+        /// Switch this vector to run-length storage if its current contents
+        /// have few enough runs, given that numBits more bits will be added.
+        bool tryConvertToRunLength(size_t numBits);
+
+        /// Switch this vector back to dense storage if the run-length
+        /// encoding is no longer smaller.
+        void maybeConvertToDense();
+
+        /// Switch this vector from run-length to dense storage.
+        void convertToDense();
+
+        /// Append a run of constant bits to a run-length-encoded vector.
+        void appendRun(bool value, size_t numBits);
+
+        /// The run-length cases of the public operations.
+        void appendRunLength(const ClusteredBitVector &other);
+
+        void addRunLength(size_t numBits, uint64_t value);
+
+        bool testRunLength(size_t i) const;
+
+        void flipAllRunLength();
+
+        size_t countRunLength() const;
+
+        enum class BitwiseOp {
+            And, Or, Xor, AndNot
+        };
+
+        ClusteredBitVector &combineRunLength(const ClusteredBitVector &other,
+                                             BitwiseOp op);
+
+        /// Call fn(value, numBits) for each maximal run of equal bits in the
+        /// vector, in order.
+        void forEachRun(llvm::function_ref<void(bool value, size_t numBits)> fn) const;
+
+        /// Collect the normalized run ends of the vector.
+        void getRuns(SmallVectorImpl<size_t> &runEnds) const;
+
+        /// Call fn(chunk, mask) for each chunk overlapping the bit range
+        /// [begin, end), where 'mask' selects the bits of the chunk that lie
+        /// in the range.  The range must be non-empty.
+        ///
+        /// Only the first and last chunks get a partial mask; the chunks in
+        /// between are passed to fullFn(chunks, numChunks) all at once, so
+        /// that it can run a simple, vectorizable loop over them.
+        template<class ChunkPtr, class MaskedFn, class FullFn>
+        static void forEachChunkInRange(ChunkPtr chunks, size_t begin, size_t end,
+                                        const MaskedFn &fn, const FullFn &fullFn) {
+            assert(begin < end);
+            size_t firstChunk = begin / ChunkSizeInBits;
+            size_t lastChunk = (end - 1) / ChunkSizeInBits;
+            ChunkType firstMask = ~ChunkType(0) << (begin % ChunkSizeInBits);
+            ChunkType lastMask = ~ChunkType(0) >>
+                    (ChunkSizeInBits - 1 - (end - 1) % ChunkSizeInBits);
+
+            if (firstChunk == lastChunk) {
+                fn(chunks[firstChunk], firstMask & lastMask);
+                return;
+            }
+            fn(chunks[firstChunk], firstMask);
+            if (lastChunk - firstChunk > 1)
+                fullFn(chunks + firstChunk + 1, lastChunk - firstChunk - 1);
+            fn(chunks[lastChunk], lastMask);
+        }
+
         /// Append a certain number of constant bits to this vector, given
         /// that it's known to contain enough capacity for them.
         void appendConstantBitsReserved(size_t numBits, bool addOnes);
@@ -15,11 +15,16 @@
 // be trivially movable, meaning that it has a trivial move
 // constructor and a trivial destructor.
 //
+// ChunkedDiverseList provides the same interface on top of a chain of
+// fixed-size chunks, so that adding to a long list never copies the
+// elements already in it.
+//
 //===----------------------------------------------------------------------===//
 
 #ifndef SWIFT_DIVERSELIST_H
 #define SWIFT_DIVERSELIST_H
 
+#include "swift/Basic/DiverseStorageChunk.h"
 #include "swift/Basic/Malloc.h"
 #include <cassert>
 #include <cstring>
@@ -30,6 +35,11 @@ namespace swift {
     template<class T>
     class DiverseListImpl;
 
+    template<class T>
+    class ChunkedDiverseList;
+
+    class ChunkedDiverseListBase;
+
     /// DiverseList - A list of heterogeneously-typed objects.
     ///
     /// \tparam T - A common base class of the objects in the list; must
@@ -108,9 +118,14 @@ namespace swift {
 
             friend class DiverseListBase;
 
+            friend class ChunkedDiverseListBase;
+
             template<class T> friend
             class DiverseListImpl;
 
+            template<class T> friend
+            class ChunkedDiverseList;
+
             stable_iterator(std::size_t offset) : Offset(offset) {}
 
         public:
@@ -342,6 +357,305 @@ namespace swift {
         }
     };
 
+    /// A base class for ChunkedDiverseList.
+    ///
+    /// Each chunk's Mark is the end of its used storage.  Every chunk but the
+    /// last one is non-empty, and the last one is empty only if the list is.
+    class ChunkedDiverseListBase {
+    public:
+        using stable_iterator = DiverseListBase::stable_iterator;
+
+        /// The chunk holding the first element, or null if no storage has
+        /// been allocated.
+        DiverseStorageChunk *First = nullptr;
+
+        /// The chunk holding the last element.
+        DiverseStorageChunk *Last = nullptr;
+
+        ChunkedDiverseListBase() = default;
+
+        ChunkedDiverseListBase(const ChunkedDiverseListBase &) = delete;
+
+        ChunkedDiverseListBase &
+        operator=(const ChunkedDiverseListBase &) = delete;
+
+        ~ChunkedDiverseListBase() {
+            DiverseStorageChunk::deallocateChain(Last);
+        }
+
+        void checkValid() const {
+            assert(!First == !Last);
+            assert(!Last || (Last->data() <= Last->Mark &&
+                             Last->Mark <= Last->dataEnd()));
+        }
+
+        bool empty() const {
+            checkValid();
+            return !First || First->Mark == First->data();
+        }
+
+        char *addNewStorage(std::size_t needed) {
+            checkValid();
+            if (Last && std::size_t(Last->dataEnd() - Last->Mark) >= needed) {
+                char *newStorage = Last->Mark;
+                Last->Mark += needed;
+                return newStorage;
+            }
+            return addNewChunk(needed);
+        }
+
+        char *addNewChunk(std::size_t needed);
+
+        void copyFrom(const ChunkedDiverseListBase &other);
+
+        void moveFrom(ChunkedDiverseListBase &&other) {
+            First = other.First;
+            Last = other.Last;
+            other.First = other.Last = nullptr;
+        }
+
+        /// Return the offset of the given position, which must be within the
+        /// given chunk.
+        static std::size_t getOffset(const DiverseStorageChunk *chunk,
+                                     const char *ptr) {
+            return chunk->OffsetBefore + std::size_t(ptr - chunk->data());
+        }
+
+        /// Find the chunk and position at the given offset, which must be
+        /// less than the size of the list.  This searches backwards from the
+        /// end of the list.
+        std::pair<DiverseStorageChunk *, char *>
+        locate(std::size_t offset) const {
+            assert(offset < getOffset(Last, Last->Mark));
+            DiverseStorageChunk *chunk = Last;
+            while (offset < chunk->OffsetBefore)
+                chunk = chunk->Prev;
+            return {chunk, chunk->data() + (offset - chunk->OffsetBefore)};
+        }
+
+        stable_iterator stable_begin() const {
+            return stable_iterator(0);
+        }
+
+        stable_iterator stable_end() const {
+            return stable_iterator(Last ? getOffset(Last, Last->Mark) : 0);
+        }
+    };
+
+    /// ChunkedDiverseList - A list of heterogeneously-typed objects stored in
+    /// a chain of fixed-size chunks.
+    ///
+    /// This has the same interface as DiverseList, and its stable_iterators
+    /// work the same way, but growing it never moves existing objects.
+    /// Standard-size chunks are recycled through a per-thread pool.  An
+    /// object larger than a standard chunk gets a chunk of its own.
+    ///
+    /// \tparam T - A common base class of the objects in the list; must
+    ///   provide an allocated_size() const method.
+    template<class T>
+    class ChunkedDiverseList : private ChunkedDiverseListBase {
+    public:
+        ChunkedDiverseList() = default;
+
+        ChunkedDiverseList(const ChunkedDiverseList &other) {
+            copyFrom(other);
+        }
+
+        ChunkedDiverseList(ChunkedDiverseList &&other) {
+            moveFrom(std::move(other));
+        }
+
+        /// Query whether the list is empty.
+        using ChunkedDiverseListBase::empty;
+
+        /// Return a reference to the first element in the list.
+        T &front() {
+            assert(!empty());
+            return *reinterpret_cast<T *>(First->data());
+        }
+
+        /// Return a reference to the first element in the list.
+        const T &front() const {
+            assert(!empty());
+            return *reinterpret_cast<const T *>(First->data());
+        }
+
+        using ChunkedDiverseListBase::stable_iterator;
+        using ChunkedDiverseListBase::stable_begin;
+        using ChunkedDiverseListBase::stable_end;
+
+        class const_iterator;
+
+        class iterator {
+            DiverseStorageChunk *Chunk;
+            char *Ptr;
+
+            friend class ChunkedDiverseList;
+
+            friend class const_iterator;
+
+            iterator(DiverseStorageChunk *chunk, char *ptr)
+                    : Chunk(chunk), Ptr(ptr) {}
+
+        public:
+            iterator() = default;
+
+            T &operator*() const { return *reinterpret_cast<T *>(Ptr); }
+
+            T *operator->() const { return reinterpret_cast<T *>(Ptr); }
+
+            iterator &operator++() {
+                advanceBy((*this)->allocated_size());
+                return *this;
+            }
+
+            iterator operator++(int _) {
+                auto copy = *this;
+                operator++();
+                return copy;
+            }
+
+            /// advancePast - Like operator++, but asserting that the current
+            /// object has a known type.
+            template<class U>
+            void advancePast() {
+                assert((*this)->allocated_size() == sizeof(U));
+                advanceBy(sizeof(U));
+            }
+
+            friend bool operator==(iterator a, iterator b) { return a.Ptr == b.Ptr; }
+
+            friend bool operator!=(iterator a, iterator b) { return !operator==(a, b); }
+
+        private:
+            void advanceBy(std::size_t size) {
+                Ptr += size;
+                if (Ptr == Chunk->Mark) {
+                    Chunk = Chunk->Next;
+                    Ptr = Chunk ? Chunk->data() : nullptr;
+                }
+            }
+        };
+
+        iterator begin() {
+            if (empty()) return end();
+            return iterator(First, First->data());
+        }
+
+        iterator end() {
+            checkValid();
+            return iterator(nullptr, nullptr);
+        }
+
+        iterator find(stable_iterator it) {
+            checkValid();
+            if (it == stable_end()) return end();
+            auto position = locate(it.Offset);
+            return iterator(position.first, position.second);
+        }
+
+        stable_iterator stabilize(iterator it) const {
+            checkValid();
+            assert(!it.Chunk || (it.Chunk->data() <= it.Ptr &&
+                                 it.Ptr < it.Chunk->Mark));
+            if (!it.Chunk) return stable_end();
+            return stable_iterator(getOffset(it.Chunk, it.Ptr));
+        }
+
+        class const_iterator {
+            const DiverseStorageChunk *Chunk;
+            const char *Ptr;
+
+            friend class ChunkedDiverseList;
+
+            const_iterator(const DiverseStorageChunk *chunk, const char *ptr)
+                    : Chunk(chunk), Ptr(ptr) {}
+
+        public:
+            const_iterator() = default;
+
+            const_iterator(iterator it) : Chunk(it.Chunk), Ptr(it.Ptr) {}
+
+            const T &operator*() const { return *reinterpret_cast<const T *>(Ptr); }
+
+            const T *operator->() const { return reinterpret_cast<const T *>(Ptr); }
+
+            const_iterator &operator++() {
+                advanceBy((*this)->allocated_size());
+                return *this;
+            }
+
+            const_iterator operator++(int _) {
+                auto copy = *this;
+                operator++();
+                return copy;
+            }
+
+            /// advancePast - Like operator++, but asserting that the current
+            /// object has a known type.
+            template<class U>
+            void advancePast() {
+                assert((*this)->allocated_size() == sizeof(U));
+                advanceBy(sizeof(U));
+            }
+
+            friend bool operator==(const_iterator a, const_iterator b) {
+                return a.Ptr == b.Ptr;
+            }
+
+            friend bool operator!=(const_iterator a, const_iterator b) {
+                return !operator==(a, b);
+            }
+
+        private:
+            void advanceBy(std::size_t size) {
+                Ptr += size;
+                if (Ptr == Chunk->Mark) {
+                    Chunk = Chunk->Next;
+                    Ptr = Chunk ? Chunk->data() : nullptr;
+                }
+            }
+        };
+
+        const_iterator begin() const {
+            if (empty()) return end();
+            return const_iterator(First, First->data());
+        }
+
+        const_iterator end() const {
+            checkValid();
+            return const_iterator(nullptr, nullptr);
+        }
+
+        const_iterator find(stable_iterator it) const {
+            return const_cast<ChunkedDiverseList *>(this)->find(it);
+        }
+
+        stable_iterator stabilize(const_iterator it) const {
+            checkValid();
+            assert(!it.Chunk || (it.Chunk->data() <= it.Ptr &&
+                                 it.Ptr < it.Chunk->Mark));
+            if (!it.Chunk) return stable_end();
+            return stable_iterator(getOffset(it.Chunk, it.Ptr));
+        }
+
+        /// Add a new object onto the end of the list.
+        template<class U, class... A>
+        U &add(A &&...args) {
+            char *storage = addNewStorage(sizeof(U));
+            U &newObject = *::new(storage) U(::std::forward<A>(args)...);
+            return newObject;
+        }
+
+        /// Add a new object onto the end of the list with some extra storage.
+        template<class U, class... A>
+        U &addWithExtra(size_t extra, A &&...args) {
+            char *storage = addNewStorage(sizeof(U) + extra);
+            U &newObject = *::new(storage) U(::std::forward<A>(args)...);
+            return newObject;
+        }
+    };
+
 } // end namespace swift
 
 
@@ -15,11 +15,16 @@
 // be trivially movable, meaning that it has a trivial move
 // constructor and a trivial destructor.
 //
+// ChunkedDiverseStack provides the same interface on top of a chain of
+// fixed-size chunks, so that pushing onto a deep stack never copies the
+// elements already on it.
+//
 //===----------------------------------------------------------------------===//
 
 #ifndef SWIFT_DIVERSESTACK_H
 #define SWIFT_DIVERSESTACK_H
 
+#include "swift/Basic/DiverseStorageChunk.h"
 #include "swift/Basic/Malloc.h"
 #include "llvm/Support/PointerLikeTypeTraits.h"
 #include <cassert>
@@ -31,6 +36,11 @@ namespace swift {
     template<class T>
     class DiverseStackImpl;
 
+    template<class T>
+    class ChunkedDiverseStack;
+
+    class ChunkedDiverseStackBase;
+
     /// DiverseStack - A stack of heterogeneously-typed objects.
     ///
     /// \tparam T - A common base class of the objects on the stack; must
@@ -108,9 +118,14 @@ namespace swift {
 
             friend class DiverseStackBase;
 
+            friend class ChunkedDiverseStackBase;
+
             template<class T> friend
             class DiverseStackImpl;
 
+            template<class T> friend
+            class ChunkedDiverseStack;
+
             stable_iterator(std::size_t depth) : Depth(depth) {}
 
         public:
@@ -426,6 +441,343 @@ namespace swift {
         }
     };
 
+    /// A base class for ChunkedDiverseStack.
+    ///
+    /// The stack grows downwards within each chunk, and each chunk links to
+    /// the chunk below it.  Every chunk but the top one is non-empty, and the
+    /// top one is empty only if the stack is.  A chunk that is popped off is
+    /// kept as a spare, so that pushing and popping across a chunk boundary
+    /// doesn't thrash.
+    class ChunkedDiverseStackBase {
+    public:
+        using stable_iterator = DiverseStackBase::stable_iterator;
+
+        /// The chunk holding the top of the stack, or null if no storage has
+        /// been allocated.
+        DiverseStorageChunk *Top = nullptr;
+
+        /// The top of the stack, within Top.
+        char *Begin = nullptr;
+
+        /// A chunk that was recently popped off, kept for reuse.
+        DiverseStorageChunk *Spare = nullptr;
+
+        ChunkedDiverseStackBase() = default;
+
+        ChunkedDiverseStackBase(const ChunkedDiverseStackBase &) = delete;
+
+        ChunkedDiverseStackBase &
+        operator=(const ChunkedDiverseStackBase &) = delete;
+
+        ~ChunkedDiverseStackBase() {
+            DiverseStorageChunk::deallocateChain(Top);
+            if (Spare) DiverseStorageChunk::deallocate(Spare);
+        }
+
+        void checkValid() const {
+            assert(!Top || (Top->data() <= Begin && Begin <= Top->dataEnd()));
+            assert(!Top || !Top->Prev || Begin != Top->dataEnd());
+        }
+
+        bool empty() const {
+            checkValid();
+            return !Top || Begin == Top->dataEnd();
+        }
+
+        void pushNewStorage(std::size_t needed) {
+            checkValid();
+            if (Top && std::size_t(Begin - Top->data()) >= needed) {
+                Begin -= needed;
+            } else {
+                pushNewChunk(needed);
+            }
+        }
+
+        void pushNewChunk(std::size_t needed);
+
+        void popStorage(std::size_t size) {
+            assert(!empty());
+            Begin += size;
+            assert(Begin <= Top->dataEnd() && "popped past the end of a chunk");
+            if (Begin == Top->dataEnd() && Top->Prev)
+                popChunk();
+        }
+
+        void popChunk();
+
+        void copyFrom(const ChunkedDiverseStackBase &other);
+
+        void moveFrom(ChunkedDiverseStackBase &&other) {
+            Top = other.Top;
+            Begin = other.Begin;
+            Spare = other.Spare;
+            other.Top = other.Spare = nullptr;
+            other.Begin = nullptr;
+        }
+
+        /// Return the depth of the given position, which must be within the
+        /// used part of the given chunk.
+        static std::size_t getDepth(const DiverseStorageChunk *chunk,
+                                    const char *ptr) {
+            return chunk->OffsetBefore + std::size_t(chunk->dataEnd() - ptr);
+        }
+
+        /// Find the chunk and position at the given non-zero depth.
+        std::pair<DiverseStorageChunk *, char *>
+        locate(std::size_t depth) const {
+            assert(depth != 0 && depth <= stable_begin().Depth);
+            DiverseStorageChunk *chunk = Top;
+            while (depth <= chunk->OffsetBefore)
+                chunk = chunk->Prev;
+            return {chunk, chunk->dataEnd() - (depth - chunk->OffsetBefore)};
+        }
+
+        stable_iterator stable_begin() const {
+            return stable_iterator(Top ? getDepth(Top, Begin) : 0);
+        }
+
+        static stable_iterator stable_end() {
+            return stable_iterator(0);
+        }
+
+        void checkIterator(stable_iterator it) const {
+            assert(it.isValid() && "checking an invalid iterator");
+            checkValid();
+            assert(it.Depth <= stable_begin().Depth);
+        }
+    };
+
+    /// ChunkedDiverseStack - A stack of heterogeneously-typed objects stored
+    /// in a chain of fixed-size chunks.
+    ///
+    /// This has the same interface as DiverseStack, and its stable_iterators
+    /// work the same way, but growing it never moves existing objects:
+    /// references to objects on the stack stay valid until they are popped.
+    /// Standard-size chunks are recycled through a per-thread pool.  An
+    /// object larger than a standard chunk gets a chunk of its own.
+    ///
+    /// \tparam T - A common base class of the objects on the stack; must
+    ///   provide an allocated_size() const method.
+    template<class T>
+    class ChunkedDiverseStack : private ChunkedDiverseStackBase {
+    public:
+        ChunkedDiverseStack() = default;
+
+        ChunkedDiverseStack(const ChunkedDiverseStack &other) {
+            copyFrom(other);
+        }
+
+        ChunkedDiverseStack(ChunkedDiverseStack &&other) {
+            moveFrom(std::move(other));
+        }
+
+        /// Query whether the stack is empty.
+        using ChunkedDiverseStackBase::empty;
+
+        /// Return a reference to the top element on the stack.
+        T &top() {
+            assert(!empty());
+            return *reinterpret_cast<T *>(Begin);
+        }
+
+        /// Return a reference to the top element on the stack.
+        const T &top() const {
+            assert(!empty());
+            return *reinterpret_cast<const T *>(Begin);
+        }
+
+        using ChunkedDiverseStackBase::stable_iterator;
+        using ChunkedDiverseStackBase::stable_begin;
+        using ChunkedDiverseStackBase::stable_end;
+
+        class const_iterator;
+
+        class iterator {
+            DiverseStorageChunk *Chunk;
+            char *Ptr;
+
+            friend class ChunkedDiverseStack;
+
+            friend class const_iterator;
+
+            iterator(DiverseStorageChunk *chunk, char *ptr)
+                    : Chunk(chunk), Ptr(ptr) {}
+
+        public:
+            iterator() = default;
+
+            T &operator*() const { return *reinterpret_cast<T *>(Ptr); }
+
+            T *operator->() const { return reinterpret_cast<T *>(Ptr); }
+
+            iterator &operator++() {
+                advanceBy((*this)->allocated_size());
+                return *this;
+            }
+
+            iterator operator++(int _) {
+                auto copy = *this;
+                operator++();
+                return copy;
+            }
+
+            /// advancePast - Like operator++, but asserting that the current
+            /// object has a known type.
+            template<class U>
+            void advancePast() {
+                assert((*this)->allocated_size() == sizeof(U));
+                advanceBy(sizeof(U));
+            }
+
+            friend bool operator==(iterator a, iterator b) { return a.Ptr == b.Ptr; }
+
+            friend bool operator!=(iterator a, iterator b) { return !operator==(a, b); }
+
+        private:
+            void advanceBy(std::size_t size) {
+                Ptr += size;
+                if (Ptr == Chunk->dataEnd()) {
+                    Chunk = Chunk->Prev;
+                    Ptr = Chunk ? Chunk->Mark : nullptr;
+                }
+            }
+        };
+
+        using ChunkedDiverseStackBase::checkIterator;
+
+        void checkIterator(iterator it) const {
+            checkValid();
+            assert(!it.Chunk || (it.Chunk->data() <= it.Ptr &&
+                                 it.Ptr < it.Chunk->dataEnd()));
+        }
+
+        iterator begin() {
+            if (empty()) return end();
+            return iterator(Top, Begin);
+        }
+
+        iterator end() {
+            checkValid();
+            return iterator(nullptr, nullptr);
+        }
+
+        iterator find(stable_iterator it) {
+            checkIterator(it);
+            if (it.Depth == 0) return end();
+            auto position = locate(it.Depth);
+            return iterator(position.first, position.second);
+        }
+
+        stable_iterator stabilize(iterator it) const {
+            checkIterator(it);
+            return stable_iterator(it.Chunk ? getDepth(it.Chunk, it.Ptr) : 0);
+        }
+
+        class const_iterator {
+            const DiverseStorageChunk *Chunk;
+            const char *Ptr;
+
+            friend class ChunkedDiverseStack;
+
+            const_iterator(const DiverseStorageChunk *chunk, const char *ptr)
+                    : Chunk(chunk), Ptr(ptr) {}
+
+        public:
+            const_iterator() = default;
+
+            const_iterator(iterator it) : Chunk(it.Chunk), Ptr(it.Ptr) {}
+
+            const T &operator*() const { return *reinterpret_cast<const T *>(Ptr); }
+
+            const T *operator->() const { return reinterpret_cast<const T *>(Ptr); }
+
+            const_iterator &operator++() {
+                advanceBy((*this)->allocated_size());
+                return *this;
+            }
+
+            const_iterator operator++(int _) {
+                auto copy = *this;
+                operator++();
+                return copy;
+            }
+
+            /// advancePast - Like operator++, but asserting that the current
+            /// object has a known type.
+            template<class U>
+            void advancePast() {
+                assert((*this)->allocated_size() == sizeof(U));
+                advanceBy(sizeof(U));
+            }
+
+            friend bool operator==(const_iterator a, const_iterator b) {
+                return a.Ptr == b.Ptr;
+            }
+
+            friend bool operator!=(const_iterator a, const_iterator b) {
+                return !operator==(a, b);
+            }
+
+        private:
+            void advanceBy(std::size_t size) {
+                Ptr += size;
+                if (Ptr == Chunk->dataEnd()) {
+                    Chunk = Chunk->Prev;
+                    Ptr = Chunk ? Chunk->Mark : nullptr;
+                }
+            }
+        };
+
+        const_iterator begin() const {
+            if (empty()) return end();
+            return const_iterator(Top, Begin);
+        }
+
+        const_iterator end() const {
+            checkValid();
+            return const_iterator(nullptr, nullptr);
+        }
+
+        const_iterator find(stable_iterator it) const {
+            checkIterator(it);
+            if (it.Depth == 0) return end();
+            auto position = locate(it.Depth);
+            return const_iterator(position.first, position.second);
+        }
+
+        void checkIterator(const_iterator it) const {
+            checkValid();
+            assert(!it.Chunk || (it.Chunk->data() <= it.Ptr &&
+                                 it.Ptr < it.Chunk->dataEnd()));
+        }
+
+        stable_iterator stabilize(const_iterator it) const {
+            checkIterator(it);
+            return stable_iterator(it.Chunk ? getDepth(it.Chunk, it.Ptr) : 0);
+        }
+
+        /// Push a new object onto the stack.
+        template<class U, class... A>
+        U &push(A &&...args) {
+            pushNewStorage(sizeof(U));
+            return *::new(Begin) U(::std::forward<A>(args)...);
+        }
+
+        /// Pop an object off the stack.
+        void pop() {
+            assert(!empty());
+            popStorage(top().allocated_size());
+        }
+
+        /// Pop an object of known type off the stack.
+        template<class U>
+        void pop() {
+            assert(!empty());
+            assert(sizeof(U) == top().allocated_size());
+            popStorage(sizeof(U));
+        }
+    };
+
 } // end namespace swift
 
 /// Allow stable_iterators to be put in things like TinyPtrVectors.
@@ -0,0 +1,81 @@
+//===--- DiverseStorageChunk.h - Chunks for diverse containers --*- C++ -*-===//
+//
+// This source file is part of the Swift.org open source project
+//
+// Copyright (c) 2014 - 2017 Apple Inc. and the Swift project authors
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// See https://swift.org/LICENSE.txt for license information
+// See https://swift.org/CONTRIBUTORS.txt for the list of Swift project authors
+//
+//===----------------------------------------------------------------------===//
+//
+// This file defines the slab type shared by ChunkedDiverseStack and
+// ChunkedDiverseList.  Those containers link fixed-size chunks together
+// instead of reallocating one contiguous buffer, so growing them never
+// copies existing elements.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef SWIFT_DIVERSESTORAGECHUNK_H
+#define SWIFT_DIVERSESTORAGECHUNK_H
+
+#include <cstddef>
+
+namespace swift {
+
+    /// A slab of storage for a chunked diverse container.  The payload
+    /// immediately follows the header.
+    struct alignas(16) DiverseStorageChunk {
+        /// The chunk holding the preceding (older) elements.
+        DiverseStorageChunk *Prev;
+
+        /// The chunk holding the following (newer) elements.  Only lists
+        /// maintain this link.
+        DiverseStorageChunk *Next;
+
+        /// The size of the payload in bytes.
+        std::size_t Capacity;
+
+        /// The number of bytes of elements in all older chunks.
+        std::size_t OffsetBefore;
+
+        /// The boundary of the used part of the payload: the top of a stack
+        /// chunk, or the end of a list chunk.
+        char *Mark;
+
+        enum : std::size_t {
+            /// The size of a standard chunk, including its header.  Standard
+            /// chunks come from the pooled allocator, so they are recycled
+            /// through per-thread caches.
+            StandardSize = 4096
+        };
+
+        static constexpr std::size_t getStandardCapacity() {
+            return StandardSize - sizeof(DiverseStorageChunk);
+        }
+
+        char *data() { return reinterpret_cast<char *>(this + 1); }
+
+        const char *data() const {
+            return reinterpret_cast<const char *>(this + 1);
+        }
+
+        char *dataEnd() { return data() + Capacity; }
+
+        const char *dataEnd() const { return data() + Capacity; }
+
+        /// Return a chunk with room for at least \p needed bytes.  All links
+        /// are null and OffsetBefore is zero; Mark is uninitialized.
+        static DiverseStorageChunk *allocate(std::size_t needed);
+
+        /// Free a chunk.
+        static void deallocate(DiverseStorageChunk *chunk);
+
+        /// Free every chunk reachable from \p chunk through Prev links.
+        static void deallocateChain(DiverseStorageChunk *chunk);
+    };
+
+} // end namespace swift
+
+#endif //SWIFT_DIVERSESTORAGECHUNK_H
@@ -27,7 +27,21 @@ namespace swift {
         std::string Text;
     };
 
+    /// Writes \p Edits as a JSON array with one object per edit, in order.
+    /// Each object has the keys "file" and "offset", plus "remove" and
+    /// "text" when they are not empty.
     void writeEditsInJson(ArrayRef<SingleEdit> Edits, llvm::raw_ostream &OS);
+
+    /// Writes \p Edits in a compact binary form: the magic "SWED", then,
+    /// as unsigned varints, the format version (1) and the number of edits,
+    /// then each edit in order.
+    ///
+    /// An edit is a file index, the offset, the number of bytes removed and
+    /// the length of the inserted text, all varints, followed by the text.
+    /// Files are numbered in order of first use; the first edit in a file
+    /// uses the next unused index and is followed by the varint length of
+    /// the path and the path itself.
+    void writeEditsInBinary(ArrayRef<SingleEdit> Edits, llvm::raw_ostream &OS);
 }
 
 
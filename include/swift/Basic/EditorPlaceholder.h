@@ -20,6 +20,7 @@
 
 #include "llvm/ADT/StringRef.h"
 #include "swift/Basic/LLVM.h"
+#include <cstddef>
 
 namespace swift {
 
@@ -46,6 +47,37 @@ namespace swift {
     Optional<EditorPlaceholderData>
     parseEditorPlaceholder(StringRef PlaceholderText);
 
+    /// A placeholder found in a buffer.
+    struct EditorPlaceholderOccurrence {
+        /// The offset of the opening '<#' in the buffer.
+        size_t Offset;
+        /// The length of the placeholder, including the delimiters.
+        size_t Length;
+        /// The parsed placeholder; its strings point into the buffer.
+        EditorPlaceholderData Data;
+    };
+
+    /// Finds and parses every placeholder in \p Buffer in a single pass,
+    /// appending them to \p Results in order.
+    ///
+    /// Placeholders are delimited the way the lexer delimits them: they
+    /// cannot contain a newline, and a '<#' inside one starts a new
+    /// placeholder.
+    void findEditorPlaceholders(StringRef Buffer,
+                                SmallVectorImpl<EditorPlaceholderOccurrence>
+                                    &Results);
+
+    /// Finds the placeholders on the lines of \p Buffer that overlap the
+    /// range [\p Begin, \p End), e.g. the range of an edit.
+    ///
+    /// Since placeholders never span lines, this finds exactly the
+    /// placeholders that a scan of the whole buffer would find on those
+    /// lines, so only the edited lines need to be rescanned.  Offsets are
+    /// relative to the start of \p Buffer.
+    void findEditorPlaceholders(StringRef Buffer, size_t Begin, size_t End,
+                                SmallVectorImpl<EditorPlaceholderOccurrence>
+                                    &Results);
+
 } // end namespace swift
 
 #endif //SWIFT_EDITORPLACEHOLDER_H
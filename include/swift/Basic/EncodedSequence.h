@@ -14,7 +14,9 @@
 //  sequence of byte-encoded values.
 //
 //  The data structure is optimized to minimize its required storage
-//  under the assumption that the sequence is usually very short.
+//  under the assumption that the sequence is usually very short.  Longer
+//  sequences spill to out-of-line storage, which can come from an
+//  EncodedSequenceArena instead of the heap.
 //
 //===----------------------------------------------------------------------===//
 
@@ -25,13 +27,79 @@
 #include "swift/Basic/Compiler.h"
 #include "swift/Basic/LLVM.h"
 #include "swift/Basic/PrefixMap.h"
+#include "swift/Basic/RadixPrefixMap.h"
 #include "llvm/ADT/ArrayRef.h"
+#include "llvm/Support/Allocator.h"
 #include "llvm/Support/Host.h"
-#include "llvm/Support/TrailingObjects.h"
+#include <algorithm>
 #include <climits>
+#include <cstring>
 
 namespace swift {
 
+    class EncodedSequenceBase;
+
+    /// A pool of out-of-line storage for encoded sequences.
+    ///
+    /// Blocks come in power-of-two size classes carved out of a bump
+    /// allocator, and a freed block is kept on its class's free list for the
+    /// next sequence that needs one, so sequences that grow and die in bulk
+    /// don't each cost a malloc.  Sequences using the arena must be
+    /// destroyed before it is.  The arena is not thread-safe.
+    class EncodedSequenceArena {
+    public:
+        /// The header of a block.  The sequence's storage follows it.
+        struct alignas(16) Block {
+            union {
+                /// The owning arena, while the block is in use.
+                EncodedSequenceArena *Arena;
+
+                /// The next free block of the same size class.
+                Block *NextFree;
+            };
+            unsigned SizeClass;
+
+            void *getStorage() { return this + 1; }
+
+            static Block *getFromStorage(void *storage) {
+                return reinterpret_cast<Block *>(storage) - 1;
+            }
+        };
+
+        enum : size_t {
+            MinBlockSize = 32,
+            NumSizeClasses = sizeof(size_t) * CHAR_BIT - 5
+        };
+
+        static size_t getBlockSize(unsigned sizeClass) {
+            return size_t(MinBlockSize) << sizeClass;
+        }
+
+    private:
+        llvm::BumpPtrAllocator Allocator;
+        Block *FreeBlocks[NumSizeClasses];
+
+        EncodedSequenceArena(const EncodedSequenceArena &) = delete;
+
+        void operator=(const EncodedSequenceArena &) = delete;
+
+    public:
+        EncodedSequenceArena() {
+            std::fill(FreeBlocks, FreeBlocks + NumSizeClasses, nullptr);
+        }
+
+        /// Return a block with room for at least the given number of bytes
+        /// of storage.
+        Block *allocate(size_t minStorageBytes);
+
+        /// Return a block to its free list.
+        void deallocate(Block *block);
+
+        /// Return the total number of bytes the arena has taken from the
+        /// system.
+        size_t getTotalMemory() const { return Allocator.getTotalMemory(); }
+    };
+
     /// A base class which handles most of the memory management.
     class EncodedSequenceBase {
     public:
@@ -46,12 +114,22 @@ namespace swift {
             IsInline = 0x1,
             InitialDataValue = IsInline,
 
+            /// For out-of-line storage: the storage belongs to an
+            /// EncodedSequenceArena block rather than the heap.
+            IsArenaAllocated = 0x2,
+
+            /// For out-of-line storage: the storage header uses 32-bit sizes.
+            IsWide = 0x4,
+
+            OutOfLineFlags = IsArenaAllocated | IsWide,
+
             IndexBitsPerChunk = CHAR_BIT * sizeof(Chunk) - 1,
             IndexContinuesMask = 1 << IndexBitsPerChunk,
             IndexChunkMask = IndexContinuesMask - 1,
         };
 
-        /// Either a Chunk* or an array of Chunks.
+        /// Either a pointer to out-of-line storage, tagged with
+        /// OutOfLineFlags, or an array of Chunks.
         uintptr_t Data;
 
         /// Return whether we're using out-of-line storage.
@@ -69,67 +147,88 @@ namespace swift {
             Data = (Data & ~uintptr_t(0xFF)) | (size << 1) | IsInline;
         }
 
-        /// A structure representing out-of-line chunk storage.
-        struct OutOfLineStorage final :
-                private llvm::TrailingObjects<OutOfLineStorage, Chunk> {
-            friend TrailingObjects;
+        /// The header of out-of-line chunk storage; the chunks follow it.
+        /// Storage starts out narrow and switches to the wide header once a
+        /// sequence outgrows 16-bit sizes.
+        template<class SizeType>
+        struct OutOfLineHeader {
+            SizeType Size;
+            SizeType Capacity;
 
-            uint16_t Size;
-            uint16_t Capacity;
+            Chunk *chunks() { return reinterpret_cast<Chunk *>(this + 1); }
+        };
 
-            OutOfLineStorage(size_t capacity) : Size(0), Capacity(capacity) {}
+        using NarrowHeader = OutOfLineHeader<uint16_t>;
+        using WideHeader = OutOfLineHeader<uint32_t>;
 
-        public:
-            OutOfLineStorage *clone(size_t newCapacity) const {
-                assert(newCapacity >= Size);
-                size_t newAllocSize = totalSizeToAlloc<Chunk>(newCapacity);
-                auto newData =
-                        new(operator new(newAllocSize)) OutOfLineStorage(newCapacity);
-                newData->setSize(Size);
-                std::uninitialized_copy(chunks().begin(), chunks().end(),
-                                        newData->chunkStorage().begin());
-                return newData;
-            }
+        void *getOutOfLineStorage() const {
+            assert(hasOutOfLineStorage());
+            return reinterpret_cast<void *>(Data & ~uintptr_t(OutOfLineFlags));
+        }
 
-            static OutOfLineStorage *alloc(size_t newSizeInBytes) {
-                auto capacity =
-                        (newSizeInBytes - sizeof(OutOfLineStorage)) / sizeof(Chunk);
-                return new(operator new(newSizeInBytes)) OutOfLineStorage(capacity);
-            }
+        bool isWide() const {
+            assert(hasOutOfLineStorage());
+            return Data & IsWide;
+        }
 
-            size_t getCapacity() const { return Capacity; }
+        EncodedSequenceArena *getArena() const {
+            if (!hasOutOfLineStorage() || !(Data & IsArenaAllocated))
+                return nullptr;
+            return EncodedSequenceArena::Block::getFromStorage(
+                    getOutOfLineStorage())->Arena;
+        }
 
-            void setSize(size_t newSize) {
-                assert(newSize <= Capacity);
-                Size = newSize;
-            }
+        size_t getOutOfLineSize() const {
+            if (isWide())
+                return static_cast<WideHeader *>(getOutOfLineStorage())->Size;
+            return static_cast<NarrowHeader *>(getOutOfLineStorage())->Size;
+        }
 
-            MutableArrayRef<Chunk> chunkStorage() {
-                return {getTrailingObjects<Chunk>(), Capacity};
-            }
+        size_t getOutOfLineCapacity() const {
+            if (isWide())
+                return static_cast<WideHeader *>(getOutOfLineStorage())->Capacity;
+            return static_cast<NarrowHeader *>(getOutOfLineStorage())->Capacity;
+        }
 
-            ArrayRef<Chunk> chunkStorage() const {
-                return {getTrailingObjects<Chunk>(), Capacity};
-            }
+        void setOutOfLineSize(size_t newSize) {
+            assert(newSize <= getOutOfLineCapacity());
+            if (isWide())
+                static_cast<WideHeader *>(getOutOfLineStorage())->Size = newSize;
+            else
+                static_cast<NarrowHeader *>(getOutOfLineStorage())->Size = newSize;
+        }
 
-            ArrayRef<Chunk> chunks() const {
-                return {getTrailingObjects<Chunk>(), Size};
-            }
-        };
+        /// Return the chunks of the out-of-line storage in the given tagged
+        /// Data value.
+        static Chunk *getOutOfLineChunks(uintptr_t data) {
+            void *storage =
+                    reinterpret_cast<void *>(data & ~uintptr_t(OutOfLineFlags));
+            if (data & IsWide)
+                return static_cast<WideHeader *>(storage)->chunks();
+            return static_cast<NarrowHeader *>(storage)->chunks();
+        }
 
-        OutOfLineStorage *getOutOfLineStorage() {
+        Chunk *getOutOfLineChunks() const {
             assert(hasOutOfLineStorage());
-            return reinterpret_cast<OutOfLineStorage *>(Data);
+            return getOutOfLineChunks(Data);
         }
 
-        const OutOfLineStorage *getOutOfLineStorage() const {
-            return const_cast<EncodedSequenceBase *>(this)->getOutOfLineStorage();
-        }
+        /// Allocate out-of-line storage with room for at least the given
+        /// number of chunks and return it as a tagged Data value.
+        static uintptr_t allocateOutOfLineStorage(size_t minCapacity,
+                                                  EncodedSequenceArena *arena);
+
+        /// Free the out-of-line storage.  This leaves Data dangling.
+        void destroyOutOfLineStorage();
+
+        /// Replace the out-of-line storage with a copy of it.
+        void cloneOutOfLineStorage();
 
         /// Return the array of possibly-initialized storage chunks.
         /// The bound is the capacity of the storage.
         MutableArrayRef<Chunk> chunkStorage() {
-            if (hasOutOfLineStorage()) return getOutOfLineStorage()->chunkStorage();
+            if (hasOutOfLineStorage())
+                return {getOutOfLineChunks(), getOutOfLineCapacity()};
 
             // The legality of accesses from this cast depends on Chunk having
             // all-powerful aliasing rights.
@@ -142,20 +241,16 @@ namespace swift {
             return const_cast<EncodedSequenceBase *>(this)->chunkStorage();
         }
 
-        void cloneOutOfLineStorage() {
-            auto oldStorage = getOutOfLineStorage();
-            Data = reinterpret_cast<uintptr_t>(
-                    oldStorage->clone(oldStorage->getCapacity()));
-        }
-
-        void destroyOutOfLineStorage() {
-            auto oldStorage = getOutOfLineStorage();
-            delete oldStorage;
-        }
-
     public:
         EncodedSequenceBase() : Data(InitialDataValue) {}
 
+        /// Create an empty sequence whose storage, now and as it grows, comes
+        /// from the given arena.  Such a sequence starts out with out-of-line
+        /// storage, since an inline sequence has no room to remember its
+        /// arena.
+        explicit EncodedSequenceBase(EncodedSequenceArena &arena)
+                : Data(allocateOutOfLineStorage(0, &arena)) {}
+
         EncodedSequenceBase(const EncodedSequenceBase &other) : Data(other.Data) {
             if (hasOutOfLineStorage()) cloneOutOfLineStorage();
         }
@@ -165,14 +260,15 @@ namespace swift {
         }
 
         EncodedSequenceBase &operator=(const EncodedSequenceBase &other) {
+            if (this == &other) return *this;
+
             if (hasOutOfLineStorage()) {
                 // Try to copy into the existing storage.
                 auto otherChunks = other.chunks();
-                auto selfStorage = getOutOfLineStorage();
-                if (otherChunks.size() <= selfStorage->getCapacity()) {
-                    memcpy(selfStorage->chunkStorage().data(), otherChunks.data(),
+                if (otherChunks.size() <= getOutOfLineCapacity()) {
+                    memcpy(getOutOfLineChunks(), otherChunks.data(),
                            sizeof(Chunk) * otherChunks.size());
-                    selfStorage->setSize(otherChunks.size());
+                    setOutOfLineSize(otherChunks.size());
                     return *this;
                 }
 
@@ -186,6 +282,7 @@ namespace swift {
         }
 
         EncodedSequenceBase &operator=(EncodedSequenceBase &&other) {
+            if (this == &other) return *this;
             if (hasOutOfLineStorage()) destroyOutOfLineStorage();
 
             Data = other.Data;
@@ -202,7 +299,7 @@ namespace swift {
         /// The bound is the actual length of the storage.
         ArrayRef<Chunk> chunks() const {
             if (hasOutOfLineStorage()) {
-                return getOutOfLineStorage()->chunks();
+                return {getOutOfLineChunks(), getOutOfLineSize()};
             } else {
                 return chunkStorage().slice(0, getInlineSize());
             }
@@ -217,32 +314,20 @@ namespace swift {
             // If the existing storage has enough space, we're fine.
             if (newSize <= oldStorage.size()) {
                 if (hasOutOfLineStorage()) {
-                    getOutOfLineStorage()->setSize(newSize);
+                    setOutOfLineSize(newSize);
                 } else {
                     setInlineSize(newSize);
                 }
                 return oldStorage.slice(oldSize);
             }
 
-            // Otherwise, allocate out-of-line storage.
-            size_t newAllocSize = 32;
-            while (newSize * sizeof(Chunk) + sizeof(OutOfLineStorage) > newAllocSize)
-                newAllocSize *= 2;
-            auto newStorage = OutOfLineStorage::alloc(newAllocSize);
-
-            // Copy from the old storage.
-            newStorage->setSize(newSize);
-            memcpy(newStorage->chunkStorage().data(), oldStorage.data(),
-                   oldSize * sizeof(Chunk));
-
-            // Destroy the old storage.
-            if (hasOutOfLineStorage()) destroyOutOfLineStorage();
-
-            // Install the new storage and return.
-            Data = reinterpret_cast<uintptr_t>(newStorage);
-            return newStorage->chunkStorage().slice(oldSize);
+            return claimStorageSlow(oldSize, newSize);
         }
 
+        /// Move the sequence to larger out-of-line storage, staying in the
+        /// same arena, and claim the chunks in [oldSize, newSize).
+        MutableArrayRef<Chunk> claimStorageSlow(size_t oldSize, size_t newSize);
+
     public:
         /// A convenience routine for decoding an unsigned value out of a
         /// sequence of chunks.
@@ -299,6 +384,12 @@ namespace swift {
     template<class Element>
     class EncodedSequence : public EncodedSequenceBase {
     public:
+        EncodedSequence() = default;
+
+        /// Create an empty sequence whose storage comes from the given arena.
+        explicit EncodedSequence(EncodedSequenceArena &arena)
+                : EncodedSequenceBase(arena) {}
+
         /// An iterator over an encoded sequence.
         class iterator {
             const Chunk *Ptr;
@@ -350,23 +441,51 @@ namespace swift {
             elt.encode(ptr);
         }
 
+        /// Add several new elements to the sequence, growing the storage at
+        /// most once.
+        void append(ArrayRef<Element> elts) {
+            size_t encodedSize = 0;
+            for (const Element &elt : elts)
+                encodedSize += elt.getEncodedSize();
+
+            Chunk *ptr = claimStorage(encodedSize).data();
+            for (const Element &elt : elts)
+                elt.encode(ptr);
+        }
+
+        /// Add all of the elements of another sequence to this one.
+        void append(const EncodedSequence &other) {
+            size_t size = other.chunks().size();
+            MutableArrayRef<Chunk> storage = claimStorage(size);
+
+            // Claiming the storage may have moved the chunks if we're
+            // appending the sequence to itself, so look them up again.
+            memcpy(storage.data(), other.chunks().data(), size * sizeof(Chunk));
+        }
+
+    private:
+        // Hack: MSVC isn't able to resolve the InlineKeyCapacity part of the
+        // template of PrefixMap, so we have to split it up and pass it manually.
+#if SWIFT_COMPILER_IS_MSVC
+        static const size_t MapInlineKeySize = (sizeof(void*) - 1) / sizeof(Chunk);
+        static const size_t MapActualInlineKeySize = max<size_t>(MapInlineKeySize, 1);
+
+        template<class ValueType>
+        using DefaultMapBase = PrefixMap<Chunk, ValueType, MapActualInlineKeySize>;
+#else
+        template<class ValueType>
+        using DefaultMapBase = PrefixMap<Chunk, ValueType>;
+#endif
+
+    public:
         /// A mapping from encoded sequences to some sort of value.
         ///
-        /// This class is just a trivial type-adjusting wrapper around PrefixMap;
+        /// This class is just a trivial type-adjusting wrapper around PrefixMap
+        /// (or another map with the same interface, such as RadixPrefixMap);
         /// see the documentation there for information about how to use this
         /// data structure.
-        template<class ValueType>
+        template<class ValueType, class MapBase = DefaultMapBase<ValueType>>
         class Map {
-            // Hack: MSVC isn't able to resolve the InlineKeyCapacity part of the
-            // template of PrefixMap, so we have to split it up and pass it manually.
-#if SWIFT_COMPILER_IS_MSVC
-            static const size_t Size = (sizeof(void*) - 1) / sizeof(Chunk);
-    static const size_t ActualSize = max<size_t>(Size, 1);
-
-    using MapBase = PrefixMap<Chunk, ValueType, ActualSize>;
-#else
-            using MapBase = PrefixMap<Chunk, ValueType>;
-#endif
             MapBase TheMap;
 
         public:
@@ -396,6 +515,12 @@ namespace swift {
                 return KeyType(begin.getRawChunkPtr(), end.getRawChunkPtr());
             }
         };
+
+        /// A mapping from encoded sequences to some sort of value, stored in
+        /// an adaptive radix tree.  Longest-prefix lookups touch one node per
+        /// branch point instead of one node per few chunks.
+        template<class ValueType>
+        using RadixMap = Map<ValueType, RadixPrefixMap<Chunk, ValueType>>;
     };
 
 } // end namespace swift
@@ -13,8 +13,11 @@
 #ifndef SWIFT_FILESYSTEM_H
 #define SWIFT_FILESYSTEM_H
 
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/Twine.h"
+#include <string>
 #include <system_error>
+#include <vector>
 
 namespace swift {
     /// Moves a file from \p source to \p destination, unless there is already
@@ -24,6 +27,32 @@ namespace swift {
     /// the file at \p source will still be present at \p source.
     std::error_code moveFileIfDifferent(const llvm::Twine &source,
                                         const llvm::Twine &destination);
+
+    /// A pair of files for moveFilesIfDifferent.
+    struct FileMove {
+        std::string Source;
+        std::string Destination;
+    };
+
+    /// Options for moveFilesIfDifferent.
+    struct MoveFilesOptions {
+        /// A file that records the content hash of each destination along
+        /// with its size and modification time.  A destination whose size
+        /// and modification time still match its record is not read again.
+        /// If empty, no hashes are kept and destinations whose size matches
+        /// their source are compared byte by byte.
+        std::string HashSidecarPath;
+    };
+
+    /// Performs moveFileIfDifferent for each of \p moves, in parallel on
+    /// llvm::parallelForEachN's shared thread pool.
+    ///
+    /// Destinations must be distinct.  Returns one error code per move, in
+    /// the same order.  A failure to read or write the sidecar is not
+    /// reported; it only costs extra reads.
+    std::vector<std::error_code>
+    moveFilesIfDifferent(llvm::ArrayRef<FileMove> moves,
+                         const MoveFilesOptions &options = MoveFilesOptions());
 } // end namespace swift
 
 #endif //SWIFT_FILESYSTEM_H
@@ -0,0 +1,180 @@
+//===--- FlatSuccessorMap.h - Successor map over sorted ranges -*- C++ -*-===//
+//
+// This source file is part of the Swift.org open source project
+//
+// Copyright (c) 2014 - 2017 Apple Inc. and the Swift project authors
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// See https://swift.org/LICENSE.txt for license information
+// See https://swift.org/CONTRIBUTORS.txt for the list of Swift project authors
+//
+//===----------------------------------------------------------------------===//
+//
+// An alternative to SuccessorMap with the same operations, which stores the
+// coalesced ranges of mapped keys in sorted arrays instead of a splay tree.
+//
+// Lookups are a branch-free binary search over the array of range
+// beginnings.  They don't modify the map, so any number of threads may
+// query it concurrently as long as nobody inserts.  Inserting a key that
+// extends an existing range, or that lies after every mapped key, is cheap;
+// inserting a key that starts a new range in the middle of the map shifts
+// the ranges after it.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef SWIFT_FLATSUCCESSORMAP_H
+#define SWIFT_FLATSUCCESSORMAP_H
+
+
+#include "swift/Basic/LLVM.h"
+#include "swift/Basic/SuccessorMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace swift {
+
+    /// A successor map backed by sorted arrays of half-open ranges.  Not a
+    /// STL-style map.
+    template<class K, class V, class Traits = SuccessorMapTraits<K> >
+    class FlatSuccessorMap {
+        struct Range {
+            /// The end of the half-open range starting at the corresponding
+            /// element of Begins.
+            K End;
+
+            /// The value of the range, i.e. the value that was mapped to its
+            /// first key.
+            V Value;
+        };
+
+        /// The first key of each range, in increasing order.  Kept apart
+        /// from the rest of the range so that searches touch as few cache
+        /// lines as possible.
+        SmallVector<K, 8> Begins;
+        SmallVector<Range, 8> Ranges;
+
+        /// Return the index of the first range that begins after the given
+        /// key, or the number of ranges if there is none.
+        size_t findUpperBoundIndex(const K &key) const {
+            size_t length = Begins.size();
+            if (length == 0) return 0;
+
+            // Narrow down to the last range that doesn't begin after the key.
+            // The comparison selects the next base instead of choosing a
+            // branch, so the loop runs the same way for every key.
+            const K *base = Begins.data();
+            while (length > 1) {
+                size_t half = length / 2;
+                base = Traits::precedes(key, base[half]) ? base : base + half;
+                length -= half;
+            }
+            return size_t(base - Begins.data()) + !Traits::precedes(key, *base);
+        }
+
+    public:
+        FlatSuccessorMap() {}
+
+        bool empty() const { return Begins.empty(); }
+
+        /// Return the number of ranges of consecutive mapped keys.
+        size_t getNumRanges() const { return Begins.size(); }
+
+        void clear() {
+            Begins.clear();
+            Ranges.clear();
+        }
+
+        template<class KeyTy, class ValueTy>
+        void insert(KeyTy &&key, ValueTy &&value) {
+            size_t upperIndex = findUpperBoundIndex(key);
+            bool haveUpperBound = upperIndex != Begins.size();
+            bool haveLowerBound = upperIndex != 0;
+
+            assert(!haveUpperBound || Traits::precedes(key, Begins[upperIndex]));
+            assert((!haveLowerBound ||
+                    !Traits::precedes(key, Ranges[upperIndex - 1].End)) &&
+                   "key already mapped!");
+
+            // If the key is the end of the lower bound, append to it,
+            // dropping the inserted value on the floor.
+            if (haveLowerBound && Traits::equals(Ranges[upperIndex - 1].End, key)) {
+                Range &lowerBound = Ranges[upperIndex - 1];
+                lowerBound.End = Traits::getSuccessor(lowerBound.End);
+
+                // If the end of the lower bound is now the same as the
+                // beginning of the upper bound, combine the ranges.
+                if (haveUpperBound &&
+                    Traits::equals(lowerBound.End, Begins[upperIndex])) {
+                    lowerBound.End = std::move(Ranges[upperIndex].End);
+                    Begins.erase(Begins.begin() + upperIndex);
+                    Ranges.erase(Ranges.begin() + upperIndex);
+                }
+                return;
+            }
+
+            // Otherwise, if the key immediately precedes the beginning of the
+            // upper bound, prepend to it.
+            auto keySuccessor = Traits::getSuccessor(key);
+            if (haveUpperBound && Traits::equals(keySuccessor, Begins[upperIndex])) {
+                Begins[upperIndex] = std::forward<KeyTy>(key);
+                Ranges[upperIndex].Value = std::forward<ValueTy>(value);
+                return;
+            }
+
+            // Otherwise, start a new range.
+            Begins.insert(Begins.begin() + upperIndex, std::forward<KeyTy>(key));
+            Ranges.insert(Ranges.begin() + upperIndex,
+                          Range{std::move(keySuccessor), std::forward<ValueTy>(value)});
+        }
+
+        /// Find the address of the stored value corresponding to the
+        /// smallest key larger than the given one, or return a null pointer
+        /// if the key is larger than anything in the map.
+        ///
+        /// The key must not be mapped.
+        const V *findLeastUpperBound(const K &key) const {
+            size_t upperIndex = findUpperBoundIndex(key);
+            assert((upperIndex == 0 ||
+                    !Traits::precedes(key, Ranges[upperIndex - 1].End)) &&
+                   "key already mapped!");
+            if (upperIndex == Begins.size()) return nullptr;
+            return &Ranges[upperIndex].Value;
+        }
+
+        V *findLeastUpperBound(const K &key) {
+            return const_cast<V *>(
+                    static_cast<const FlatSuccessorMap *>(this)->findLeastUpperBound(key));
+        }
+
+        /// Validate the well-formedness of this data structure.
+        void validate() const {
+#ifndef NDEBUG
+            assert(Begins.size() == Ranges.size());
+            for (size_t i = 0, e = Begins.size(); i != e; ++i) {
+                // No range can be empty.
+                assert(Traits::precedes(Begins[i], Ranges[i].End));
+
+                // Each range must end strictly before the next one begins,
+                // because adjacent ranges should have been combined.
+                if (i + 1 != e)
+                    assert(Traits::precedes(Ranges[i].End, Begins[i + 1]));
+            }
+#endif
+        }
+
+        void dump() const {
+            if (empty()) {
+                llvm::errs() << "(empty)\n";
+                return;
+            }
+            for (size_t i = 0, e = Begins.size(); i != e; ++i) {
+                llvm::errs() << Begins[i] << ".." << Ranges[i].End
+                             << ": " << Ranges[i].Value << "\n";
+            }
+        }
+    };
+
+} // end namespace swift
+
+
+#endif //SWIFT_FLATSUCCESSORMAP_H
@@ -0,0 +1,312 @@
+//===--- FrozenPrefixMap.h - A read-only, relocatable PrefixMap -*- C++ -*-===//
+//
+// This source file is part of the Swift.org open source project
+//
+// Copyright (c) 2014 - 2017 Apple Inc. and the Swift project authors
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// See https://swift.org/LICENSE.txt for license information
+// See https://swift.org/CONTRIBUTORS.txt for the list of Swift project authors
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file defines FrozenPrefixMap, the read-only form of a PrefixMap
+//  produced by PrefixMap::freeze().
+//
+//  A frozen map lives in a single contiguous buffer:
+//
+//    Header | Node[NumNodes] | ValueType[NumEntries] | KeyElementType[...]
+//
+//  Nodes are laid out in depth-first order, so the nodes visited by a
+//  lookup tend to be adjacent, and they refer to each other, their keys and
+//  their values with relative pointers.  The buffer therefore contains no
+//  absolute addresses: it can be written to disk and mapped back in at any
+//  address without fixups.  Destroying a frozen map frees one buffer.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef SWIFT_FROZENPREFIXMAP_H
+#define SWIFT_FROZENPREFIXMAP_H
+
+#include "swift/Basic/LLVM.h"
+#include "swift/Basic/PrefixMap.h"
+#include "swift/Basic/RelativePointer.h"
+#include "swift/Basic/type_traits.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/ErrorOr.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include <memory>
+#include <system_error>
+
+namespace swift {
+
+    /// The layout information shared by all frozen prefix maps.
+    struct FrozenPrefixMapHeader {
+        enum : uint32_t {
+            /// 'PFXM'
+            MagicNumber = 0x5046584D,
+            CurrentVersion = 1
+        };
+
+        uint32_t Magic;
+        uint32_t Version;
+        uint32_t KeyElementSize;
+        uint32_t ValueSize;
+        uint32_t NumNodes;
+        uint32_t NumEntries;
+        uint32_t NumKeyElements;
+        uint32_t Reserved;
+    };
+
+    /// Write the buffer of a frozen prefix map to the given file.
+    std::error_code writeFrozenPrefixMapBuffer(StringRef path,
+                                               StringRef buffer);
+
+    /// Read the buffer of a frozen prefix map from the given file, mapping it
+    /// into memory if that's profitable.  Only the header is validated.
+    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>>
+    readFrozenPrefixMapBuffer(StringRef path);
+
+    /// A read-only map whose keys are sequences of comparable values, stored
+    /// in a single pointer-free buffer.  Lookups behave exactly like the
+    /// PrefixMap it was frozen from.
+    template<class KeyElementType, class ValueType>
+    class FrozenPrefixMap {
+    public:
+        using KeyType = ArrayRef<KeyElementType>;
+
+        static_assert(IsTriviallyCopyable<ValueType>::value,
+                      "frozen values must be trivially copyable");
+
+    private:
+        template<class, class, size_t> friend
+        class PrefixMap;
+
+        struct Node {
+            RelativeDirectPointer<const Node> Left;
+            RelativeDirectPointer<const Node> Right;
+            RelativeDirectPointer<const Node> Further;
+            RelativeDirectPointer<const KeyElementType> Key;
+            RelativeDirectPointer<const ValueType> Value;
+            uint32_t KeyLength;
+
+            Node(const Node *left, const Node *right, const Node *further,
+                 const KeyElementType *key, uint32_t keyLength,
+                 const ValueType *value)
+                    : Left(left), Right(right), Further(further), Key(key),
+                      Value(value), KeyLength(keyLength) {}
+
+            KeyType getLocalKey() const { return {Key.get(), KeyLength}; }
+        };
+
+        /// The offsets of the parts of a buffer.
+        struct Layout {
+            size_t Nodes;
+            size_t Values;
+            size_t Keys;
+            size_t Total;
+
+            explicit Layout(const FrozenPrefixMapHeader &header) {
+                Nodes = llvm::alignTo(sizeof(FrozenPrefixMapHeader),
+                                      alignof(Node));
+                Values = llvm::alignTo(Nodes + header.NumNodes * sizeof(Node),
+                                       alignof(ValueType));
+                Keys = Values + header.NumEntries * sizeof(ValueType);
+                Total = Keys + header.NumKeyElements * sizeof(KeyElementType);
+            }
+        };
+
+        std::unique_ptr<llvm::MemoryBuffer> Buffer;
+
+        explicit FrozenPrefixMap(std::unique_ptr<llvm::MemoryBuffer> buffer)
+                : Buffer(std::move(buffer)) {}
+
+        const FrozenPrefixMapHeader &getHeader() const {
+            return *reinterpret_cast<const FrozenPrefixMapHeader *>(
+                    Buffer->getBufferStart());
+        }
+
+        const Node *getRoot() const {
+            if (!Buffer || getHeader().NumNodes == 0) return nullptr;
+            Layout layout(getHeader());
+            return reinterpret_cast<const Node *>(
+                    Buffer->getBufferStart() + layout.Nodes);
+        }
+
+    public:
+        FrozenPrefixMap() {}
+
+        FrozenPrefixMap(FrozenPrefixMap &&other) = default;
+
+        FrozenPrefixMap &operator=(FrozenPrefixMap &&other) = default;
+
+        /// Are there any entries in this map?
+        bool empty() const { return size() == 0; }
+
+        /// Return the number of entries in this map.
+        size_t size() const {
+            return Buffer ? getHeader().NumEntries : 0;
+        }
+
+        /// A handle to the mapping for a given key.
+        class Handle {
+            const ValueType *Ptr;
+        public:
+            Handle() : Ptr(nullptr) {}
+
+            explicit Handle(const ValueType *ptr) : Ptr(ptr) {}
+
+            explicit operator bool() const { return Ptr != nullptr; }
+
+            const ValueType &operator*() const {
+                assert(Ptr);
+                return *Ptr;
+            }
+        };
+
+        using KeyIterator = typename KeyType::iterator;
+
+        /// Find the longest prefix of the given key which has an entry in
+        /// this map, and return an iterator corresponding to the end of the
+        /// prefix.
+        std::pair<Handle, KeyIterator>
+        findPrefix(KeyType key) const {
+            const ValueType *best = nullptr;
+            KeyType remainingKey;
+
+            const Node *cur = getRoot();
+            while (cur) {
+                KeyType curKey = cur->getLocalKey();
+
+                size_t len = std::min(curKey.size(), key.size());
+                size_t i = 0;
+                for (; i != len; ++i) {
+                    if (key[i] != curKey[i]) break;
+                }
+
+                // No common prefix: go to the appropriate side.
+                if (i == 0 && len != 0) {
+                    cur = (key[0] < curKey[0] ? cur->Left.get()
+                                              : cur->Right.get());
+                    continue;
+                }
+
+                // A partial match of the local key can't have a value.
+                if (i != curKey.size()) break;
+
+                key = key.slice(i);
+                if (const ValueType *value = cur->Value.get()) {
+                    best = value;
+                    remainingKey = key;
+                }
+                if (key.empty()) break;
+                cur = cur->Further.get();
+            }
+
+            return {Handle(best), remainingKey.begin()};
+        }
+
+        /// Return the contents of this map as a position-independent buffer.
+        StringRef getBuffer() const {
+            return Buffer ? Buffer->getBuffer() : StringRef();
+        }
+
+        /// Write this map to the given file, from which it can later be
+        /// mapped back in with readFromFile.
+        std::error_code writeToFile(StringRef path) const {
+            return writeFrozenPrefixMapBuffer(path, getBuffer());
+        }
+
+        /// Load a map previously written with writeToFile.  The file is
+        /// mapped into memory rather than copied when possible.
+        ///
+        /// The header is validated against this map's key and value types,
+        /// but the contents are trusted.
+        static llvm::ErrorOr<FrozenPrefixMap> readFromFile(StringRef path) {
+            auto buffer = readFrozenPrefixMapBuffer(path);
+            if (!buffer) return buffer.getError();
+
+            auto &header = *reinterpret_cast<const FrozenPrefixMapHeader *>(
+                    (*buffer)->getBufferStart());
+            if (header.KeyElementSize != sizeof(KeyElementType) ||
+                header.ValueSize != sizeof(ValueType) ||
+                Layout(header).Total > (*buffer)->getBufferSize())
+                return std::make_error_code(std::errc::invalid_argument);
+
+            return FrozenPrefixMap(std::move(*buffer));
+        }
+    };
+
+    template<class KeyElementType, class ValueType, size_t InlineKeyCapacity>
+    FrozenPrefixMap<KeyElementType, ValueType>
+    PrefixMap<KeyElementType, ValueType, InlineKeyCapacity>::freeze() const {
+        using Frozen = FrozenPrefixMap<KeyElementType, ValueType>;
+        using FrozenNode = typename Frozen::Node;
+
+        // Number the nodes in depth-first order, visiting Further links
+        // first since every successful lookup step follows one.
+        SmallVector<Node *, 64> nodes;
+        llvm::DenseMap<Node *, uint32_t> nodeIndices;
+        FrozenPrefixMapHeader header = {};
+        header.Magic = FrozenPrefixMapHeader::MagicNumber;
+        header.Version = FrozenPrefixMapHeader::CurrentVersion;
+        header.KeyElementSize = sizeof(KeyElementType);
+        header.ValueSize = sizeof(ValueType);
+
+        SmallVector<Node *, 16> stack;
+        if (Root) stack.push_back(Root);
+        while (!stack.empty()) {
+            Node *node = stack.pop_back_val();
+            nodeIndices[node] = nodes.size();
+            nodes.push_back(node);
+            if (node->HasValue) header.NumEntries++;
+            header.NumKeyElements += node->KeyLength;
+            if (node->Right) stack.push_back(node->Right);
+            if (node->Left) stack.push_back(node->Left);
+            if (node->Further) stack.push_back(node->Further);
+        }
+        header.NumNodes = nodes.size();
+
+        typename Frozen::Layout layout(header);
+        assert(layout.Total <= size_t(INT32_MAX) &&
+               "frozen map too large for relative pointers");
+        auto buffer = llvm::WritableMemoryBuffer::getNewMemBuffer(layout.Total);
+        char *base = buffer->getBufferStart();
+        memcpy(base, &header, sizeof(header));
+
+        auto frozenNodes = reinterpret_cast<FrozenNode *>(base + layout.Nodes);
+        auto values = reinterpret_cast<ValueType *>(base + layout.Values);
+        auto keys = reinterpret_cast<KeyElementType *>(base + layout.Keys);
+        auto getFrozen = [&](Node *node) -> const FrozenNode * {
+            return node ? &frozenNodes[nodeIndices[node]] : nullptr;
+        };
+
+        for (Node *node : nodes) {
+            const KeyElementType *key = nullptr;
+            if (node->KeyLength) {
+                key = keys;
+                memcpy(keys, node->Key,
+                       node->KeyLength * sizeof(KeyElementType));
+                keys += node->KeyLength;
+            }
+
+            const ValueType *value = nullptr;
+            if (node->HasValue) {
+                memcpy(values, &node->Value.Storage, sizeof(ValueType));
+                value = values++;
+            }
+
+            ::new(&frozenNodes[nodeIndices[node]])
+                    FrozenNode(getFrozen(node->Left), getFrozen(node->Right),
+                               getFrozen(node->Further), key, node->KeyLength,
+                               value);
+        }
+
+        return Frozen(std::move(buffer));
+    }
+
+} // end namespace swift
+
+#endif //SWIFT_FROZENPREFIXMAP_H
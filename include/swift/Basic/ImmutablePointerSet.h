@@ -41,7 +41,14 @@
 ///
 /// Thus our design is to represent our sets as bump ptr allocated arrays whose
 /// elements are sorted and uniqued. The actual uniquing of the arrays
-/// themselves is performed via folding set node.
+/// themselves is performed via a hash set keyed on a hash of the elements that
+/// is computed once, when a set is created. The hash is a sum of per-element
+/// hashes, so a merge computes the hash of its result in the same pass that
+/// produces the elements.
+///
+/// Since the same pairs of sets tend to be merged over and over (e.g. at every
+/// join point of a dataflow analysis that has not converged yet), the factory
+/// also memoizes merges of two sets.
 ///
 //===----------------------------------------------------------------------===//
 
@@ -52,7 +59,10 @@
 #include "swift/Basic/STLExtras.h"
 #include "swift/Basic/NullablePtr.h"
 #include "llvm/Support/Allocator.h"
-#include "llvm/ADT/FoldingSet.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallVector.h"
 #include <algorithm>
 #include <type_traits>
 
@@ -64,7 +74,7 @@ namespace swift {
     /// An immutable set of pointers. It is backed by a tail allocated sorted array
     /// ref.
     template<typename T>
-    class ImmutablePointerSet : public llvm::FoldingSetNode {
+    class ImmutablePointerSet {
         using PtrTy = typename std::add_pointer<T>::type;
 
         friend class ImmutablePointerSetFactory<T>;
@@ -72,9 +82,12 @@ namespace swift {
         NullablePtr<ImmutablePointerSetFactory<T>> ParentFactory;
         ArrayRef<PtrTy> Data;
 
+        /// The sum of getElementHash over Data.
+        size_t Hash;
+
         ImmutablePointerSet(ImmutablePointerSetFactory<T> *ParentFactory,
-                            ArrayRef<PtrTy> NewData)
-                : ParentFactory(ParentFactory), Data(NewData) {}
+                            ArrayRef<PtrTy> NewData, size_t Hash)
+                : ParentFactory(ParentFactory), Data(NewData), Hash(Hash) {}
 
     public:
         ~ImmutablePointerSet() = default;
@@ -87,9 +100,25 @@ namespace swift {
 
         ImmutablePointerSet &operator=(ImmutablePointerSet &&) = default;
 
+        /// Return the hash of a single element. The hash of a set is the sum of
+        /// the hashes of its elements.
+        static size_t getElementHash(PtrTy Ptr) {
+            uint64_t Value = reinterpret_cast<uintptr_t>(Ptr);
+            Value *= 0x9E3779B97F4A7C15ULL;
+            return size_t(Value ^ (Value >> 29));
+        }
+
+        static size_t computeHash(ArrayRef<PtrTy> Array) {
+            size_t Hash = 0;
+            for (PtrTy Ptr : Array)
+                Hash += getElementHash(Ptr);
+            return Hash;
+        }
+
         bool operator==(const ImmutablePointerSet<T> &P) const {
-            // If this and P have different sizes, we can not be equivalent.
-            if (size() != P.size())
+            // If this and P have different sizes or hashes, we can not be
+            // equivalent.
+            if (size() != P.size() || Hash != P.Hash)
                 return false;
 
             // Ok, we now know that both have the same size. If one is empty, the other
@@ -129,12 +158,9 @@ namespace swift {
 
         bool empty() const { return Data.empty(); }
 
-        void Profile(llvm::FoldingSetNodeID &ID) const {
-            assert(!Data.empty() && "Should not profile empty ImmutablePointerSet");
-            for (PtrTy P : Data) {
-                ID.AddPointer(P);
-            }
-        }
+        /// Return the hash of the elements of this set, computed when it was
+        /// created.
+        size_t getHash() const { return Hash; }
 
         ImmutablePointerSet<T> *merge(ImmutablePointerSet<T> *Other) {
             if (empty())
@@ -194,10 +220,128 @@ namespace swift {
         static constexpr unsigned AllocAlignment =
                 (alignof(PtrSet) > alignof(PtrTy)) ? alignof(PtrSet) : alignof(PtrTy);
 
+        /// A sorted and uniqued array along with its hash, used to look up a set
+        /// without creating it.
+        struct LookupKey {
+            ArrayRef<PtrTy> Data;
+            size_t Hash;
+        };
+
+        struct PtrSetInfo {
+            static PtrSet *getEmptyKey() {
+                return llvm::DenseMapInfo<PtrSet *>::getEmptyKey();
+            }
+
+            static PtrSet *getTombstoneKey() {
+                return llvm::DenseMapInfo<PtrSet *>::getTombstoneKey();
+            }
+
+            static unsigned getHashValue(size_t Hash) {
+                return unsigned(Hash) ^ unsigned(uint64_t(Hash) >> 32);
+            }
+
+            static unsigned getHashValue(const PtrSet *S) {
+                return getHashValue(S->getHash());
+            }
+
+            static unsigned getHashValue(const LookupKey &Key) {
+                return getHashValue(Key.Hash);
+            }
+
+            static bool isEqual(const PtrSet *LHS, const PtrSet *RHS) {
+                return LHS == RHS;
+            }
+
+            static bool isEqual(const LookupKey &LHS, const PtrSet *RHS) {
+                if (RHS == getEmptyKey() || RHS == getTombstoneKey())
+                    return false;
+                return LHS.Hash == RHS->getHash() &&
+                       LHS.Data.size() == RHS->size() &&
+                       std::equal(LHS.Data.begin(), LHS.Data.end(), RHS->begin());
+            }
+        };
+
         llvm::BumpPtrAllocator &Allocator;
-        llvm::FoldingSetVector<PtrSet> Set;
+        llvm::DenseSet<PtrSet *, PtrSetInfo> Set;
+
+        /// The result of merging each pair of sets seen so far, keyed with the
+        /// lower address first.
+        llvm::DenseMap<std::pair<PtrSet *, PtrSet *>, PtrSet *> MergeCache;
+
         static PtrSet EmptyPtrSet;
 
+        /// Return the uniqued set for \p Array, which is sorted and uniqued and
+        /// whose hash is \p Hash, creating it if necessary.
+        PtrSet *getOrCreate(ArrayRef<PtrTy> Array, size_t Hash) {
+            auto Iter = Set.find_as(LookupKey{Array, Hash});
+            if (Iter != Set.end())
+                return *Iter;
+
+            size_t NumElts = Array.size();
+            size_t MemSize = sizeof(PtrSet) + sizeof(PtrTy) * NumElts;
+
+            // Allocate the memory.
+            auto *Mem =
+                    reinterpret_cast<PtrSet *>(Allocator.Allocate(MemSize, AllocAlignment));
+
+            // Copy in the pointers into the tail allocated memory. We do not need to do
+            // any sorting/uniquing ourselves since we assume that our users perform
+            // this task for us.
+            MutableArrayRef<PtrTy> DataMem(reinterpret_cast<PtrTy *>(&Mem[1]), NumElts);
+            std::copy(Array.begin(), Array.end(), DataMem.begin());
+
+            // Allocate the new node and insert it into the Set.
+            auto *NewNode = new(Mem) PtrSet(this, DataMem, Hash);
+            Set.insert(NewNode);
+            return NewNode;
+        }
+
+        /// Compute the union of the sorted and uniqued arrays \p LHS and \p RHS
+        /// into \p Result, returning its hash.
+        ///
+        /// If one array lies entirely before the other, this is just two copies.
+        /// Otherwise each step of the merge emits the smaller head and advances
+        /// whichever sides were not greater, which compiles to conditional moves
+        /// rather than the unpredictable branches of std::set_union.
+        static size_t mergeSorted(ArrayRef<PtrTy> LHS, ArrayRef<PtrTy> RHS,
+                                  SmallVectorImpl<PtrTy> &Result) {
+            Result.resize(LHS.size() + RHS.size());
+            PtrTy *Out = Result.data();
+
+            if (std::less<PtrTy>()(RHS.back(), LHS.front()))
+                std::swap(LHS, RHS);
+            if (std::less<PtrTy>()(LHS.back(), RHS.front())) {
+                std::copy(RHS.begin(), RHS.end(),
+                          std::copy(LHS.begin(), LHS.end(), Out));
+                return PtrSet::computeHash(Result);
+            }
+
+            const PtrTy *I1 = LHS.begin(), *E1 = LHS.end();
+            const PtrTy *I2 = RHS.begin(), *E2 = RHS.end();
+            size_t Hash = 0;
+            while (I1 != E1 && I2 != E2) {
+                PtrTy P1 = *I1, P2 = *I2;
+                bool Take1 = !std::less<PtrTy>()(P2, P1);
+                bool Take2 = !std::less<PtrTy>()(P1, P2);
+                PtrTy Min = Take1 ? P1 : P2;
+                *Out++ = Min;
+                Hash += PtrSet::getElementHash(Min);
+                I1 += Take1;
+                I2 += Take2;
+            }
+            for (; I1 != E1; ++I1, ++Out) {
+                *Out = *I1;
+                Hash += PtrSet::getElementHash(*I1);
+            }
+            for (; I2 != E2; ++I2, ++Out) {
+                *Out = *I2;
+                Hash += PtrSet::getElementHash(*I2);
+            }
+
+            Result.resize(Out - Result.data());
+            return Hash;
+        }
+
     public:
         ImmutablePointerSetFactory(llvm::BumpPtrAllocator &A) : Allocator(A), Set() {}
 
@@ -214,7 +358,14 @@ namespace swift {
         // statically.
         static PtrSet *getEmptySet() { return &EmptyPtrSet; }
 
-        void clear() { Set.clear(); }
+        void clear() {
+            Set.clear();
+            MergeCache.clear();
+        }
+
+        /// Drop the memoized merge results, e.g. between analyses, without
+        /// forgetting the sets themselves.
+        void clearMergeCache() { MergeCache.clear(); }
 
         /// Given a sorted and uniqued list \p Array, return the ImmutablePointerSet
         /// containing Array. Asserts if \p Array is not sorted and uniqued.
@@ -227,33 +378,7 @@ namespace swift {
             // write into the input Array, which we don't want.
             assert(is_sorted_and_uniqued(Array));
 
-            llvm::FoldingSetNodeID ID;
-            for (PtrTy Ptr : Array) {
-                ID.AddPointer(Ptr);
-            }
-
-            void *InsertPt;
-            if (auto *PSet = Set.FindNodeOrInsertPos(ID, InsertPt)) {
-                return PSet;
-            }
-
-            size_t NumElts = Array.size();
-            size_t MemSize = sizeof(PtrSet) + sizeof(PtrTy) * NumElts;
-
-            // Allocate the memory.
-            auto *Mem =
-                    reinterpret_cast<PtrSet *>(Allocator.Allocate(MemSize, AllocAlignment));
-
-            // Copy in the pointers into the tail allocated memory. We do not need to do
-            // any sorting/uniquing ourselves since we assume that our users perform
-            // this task for us.
-            MutableArrayRef<PtrTy> DataMem(reinterpret_cast<PtrTy *>(&Mem[1]), NumElts);
-            std::copy(Array.begin(), Array.end(), DataMem.begin());
-
-            // Allocate the new node and insert it into the Set.
-            auto *NewNode = new(Mem) PtrSet(this, DataMem);
-            Set.InsertNode(NewNode, InsertPt);
-            return NewNode;
+            return getOrCreate(Array, PtrSet::computeHash(Array));
         }
 
         PtrSet *merge(PtrSet *S1, ArrayRef<PtrTy> S2) {
@@ -272,40 +397,14 @@ namespace swift {
                 std::equal(S1->begin(), S1->end(), S2.begin()))
                 return S1;
 
-            llvm::FoldingSetNodeID ID;
-
-            // We know that both of our pointer sets are sorted, so we can essentially
-            // perform a sorted set merging algorithm to create the ID. We also count
-            // the number of unique elements for allocation purposes.
-            unsigned NumElts = 0;
-            set_union_for_each(*S1, S2, [&ID, &NumElts](const PtrTy Ptr) -> void {
-                ID.AddPointer(Ptr);
-                NumElts++;
-            });
-
-            // If we find our ID then continue.
-            void *InsertPt;
-            if (auto *PSet = Set.FindNodeOrInsertPos(ID, InsertPt)) {
-                return PSet;
-            }
-
-            unsigned MemSize = sizeof(PtrSet) + sizeof(PtrTy) * NumElts;
+            SmallVector<PtrTy, 32> Union;
+            size_t Hash = mergeSorted(S1->Data, S2, Union);
 
-            // Allocate the memory.
-            auto *Mem =
-                    reinterpret_cast<PtrSet *>(Allocator.Allocate(MemSize, AllocAlignment));
-
-            // Copy in the union of the two pointer sets into the tail allocated
-            // memory. Since we know that our sorted arrays are uniqued, we can use
-            // set_union to get the uniqued sorted array that we want.
-            MutableArrayRef<PtrTy> DataMem(reinterpret_cast<PtrTy *>(&Mem[1]), NumElts);
-            std::set_union(S1->begin(), S1->end(), S2.begin(), S2.end(),
-                           DataMem.begin());
+            // If nothing was added to S1, the union is S1.
+            if (Union.size() == S1->size())
+                return S1;
 
-            // Allocate the new node, insert it into the Set, and return it.
-            auto *NewNode = new(Mem) PtrSet(this, DataMem);
-            Set.InsertNode(NewNode, InsertPt);
-            return NewNode;
+            return getOrCreate(Union, Hash);
         }
 
         PtrSet *merge(PtrSet *S1, PtrSet *S2) {
@@ -321,46 +420,35 @@ namespace swift {
             if (S1 == S2)
                 return S1;
 
-            llvm::FoldingSetNodeID ID;
-
-            // We know that both of our pointer sets are sorted, so we can essentially
-            // perform a sorted set merging algorithm to create the ID. We also count
-            // the number of unique elements for allocation purposes.
-            unsigned NumElts = 0;
-            set_union_for_each(*S1, *S2, [&ID, &NumElts](const PtrTy Ptr) -> void {
-                ID.AddPointer(Ptr);
-                NumElts++;
-            });
-
-            // If we find our ID then continue.
-            void *InsertPt;
-            if (auto *PSet = Set.FindNodeOrInsertPos(ID, InsertPt)) {
-                return PSet;
-            }
-
-            unsigned MemSize = sizeof(PtrSet) + sizeof(PtrTy) * NumElts;
-
-            // Allocate the memory.
-            auto *Mem =
-                    reinterpret_cast<PtrSet *>(Allocator.Allocate(MemSize, AllocAlignment));
-
-            // Copy in the union of the two pointer sets into the tail allocated
-            // memory. Since we know that our sorted arrays are uniqued, we can use
-            // set_union to get the uniqued sorted array that we want.
-            MutableArrayRef<PtrTy> DataMem(reinterpret_cast<PtrTy *>(&Mem[1]), NumElts);
-            std::set_union(S1->begin(), S1->end(), S2->begin(), S2->end(),
-                           DataMem.begin());
-
-            // Allocate the new node, insert it into the Set, and return it.
-            auto *NewNode = new(Mem) PtrSet(this, DataMem);
-            Set.InsertNode(NewNode, InsertPt);
-            return NewNode;
+            // Union is commutative, so canonicalize the pair for the cache.
+            if (std::less<PtrSet *>()(S2, S1))
+                std::swap(S1, S2);
+            auto Key = std::make_pair(S1, S2);
+            auto CacheIter = MergeCache.find(Key);
+            if (CacheIter != MergeCache.end())
+                return CacheIter->second;
+
+            SmallVector<PtrTy, 32> Union;
+            size_t Hash = mergeSorted(S1->Data, S2->Data, Union);
+
+            // If one set contains the other, the union is the larger one, and
+            // it's already uniqued.
+            PtrSet *Result;
+            if (Union.size() == S1->size())
+                Result = S1;
+            else if (Union.size() == S2->size())
+                Result = S2;
+            else
+                Result = getOrCreate(Union, Hash);
+
+            MergeCache[Key] = Result;
+            return Result;
         }
     };
 
     template<typename T>
     ImmutablePointerSet<T> ImmutablePointerSetFactory<T>::EmptyPtrSet =
-            ImmutablePointerSet<T>(nullptr, {});
+            ImmutablePointerSet<T>(nullptr, {}, 0);
 
 } // end swift namespace
 
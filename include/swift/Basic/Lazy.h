@@ -14,6 +14,7 @@
 #ifndef SWIFT_LAZY_H
 #define SWIFT_LAZY_H
 
+#include <atomic>
 #include <memory>
 
 #ifdef __APPLE__
@@ -26,6 +27,7 @@
 
 #include "swift/Basic/Malloc.h"
 #include "swift/Basic/type_traits.h"
+#include "llvm/Support/Compiler.h"
 
 namespace swift {
 
@@ -49,16 +51,26 @@ namespace swift {
 
 /// A template for lazily-constructed, zero-initialized, leaked-on-exit
 /// global objects.
+///
+/// Once the value is known to be initialized, get() is a single acquire
+/// load; the once-token machinery is only used until then.
     template<class T>
     class Lazy {
         typename std::aligned_storage<sizeof(T), alignof(T)>::type Value;
 
         OnceToken_t OnceToken;
 
+        /// Set, with release semantics, after the value has been initialized.
+        std::atomic<bool> IsInitialized{false};
+
         static void defaultInitCallback(void *ValueAddr) {
             ::new(ValueAddr) T();
         }
 
+        /// Initialize the value if no other thread has; kept out of line so
+        /// that get() stays small enough to inline.
+        LLVM_ATTRIBUTE_NOINLINE T &getSlow(void (*initCallback)(void *));
+
     public:
         using Type = T;
 
@@ -85,7 +97,15 @@ namespace swift {
         static_assert(std::is_literal_type<Lazy<T>>::value,
                       "Lazy<T> must be a literal type");
 
+        if (IsInitialized.load(std::memory_order_acquire))
+            return unsafeGetAlreadyInitialized();
+        return getSlow(initCallback);
+    }
+
+    template<typename T>
+    T &Lazy<T>::getSlow(void (*initCallback)(void *)) {
         SWIFT_ONCE_F(OnceToken, initCallback, &Value);
+        IsInitialized.store(true, std::memory_order_release);
         return unsafeGetAlreadyInitialized();
     }
 
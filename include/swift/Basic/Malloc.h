@@ -11,7 +11,8 @@
 //===----------------------------------------------------------------------===//
 //
 //  This file provides an implementation of C11 aligned_alloc(3) for platforms
-//  that don't have it yet, using posix_memalign(3).
+//  that don't have it yet, using posix_memalign(3), and a pooled allocator
+//  for small aligned blocks built on top of it.
 //
 //===----------------------------------------------------------------------===//
 
@@ -19,6 +20,7 @@
 #define SWIFT_MALLOC_H
 
 #include <cassert>
+#include <cstddef>
 
 #if defined(_WIN32)
 #include <malloc.h>
@@ -57,6 +59,56 @@ namespace swift {
 #endif
     }
 
+    /// Usage statistics for the pooled allocator.
+    ///
+    /// Each thread counts its allocations locally and publishes them whenever
+    /// it refills from or returns blocks to the shared depot, and when it
+    /// exits, so the counts may lag behind the most recent calls.
+    struct PooledAllocStatistics {
+        /// Bytes of slabs the pool has taken from the system.
+        size_t ReservedBytes;
+
+        /// Bytes of pooled blocks currently handed out.
+        size_t InUseBytes;
+
+        /// Calls to PooledAlignedAlloc and PooledAlignedFree, including
+        /// large ones, so their difference is the number of blocks still
+        /// allocated.
+        size_t NumAllocations;
+        size_t NumDeallocations;
+
+        /// Of NumAllocations, the requests too large or too aligned for the
+        /// pool, which went to AlignedAlloc directly.
+        size_t NumLargeAllocations;
+
+        /// Batches of blocks moved from the depot to a thread, and back.
+        size_t NumRefills;
+        size_t NumReturns;
+    };
+
+    enum : size_t {
+        /// Requests whose size and alignment are both at most this are
+        /// served from the pool.
+        MaxPooledAllocSize = 4096
+    };
+
+    /// Allocate \p size bytes aligned to \p align from the pool.
+    ///
+    /// Requests are rounded up to power-of-two size classes, and each thread
+    /// keeps a cache of free blocks of every class, so most calls don't take
+    /// a lock.  Larger requests fall back to AlignedAlloc.  Memory freed to
+    /// the pool is reused but never returned to the system.
+    void *PooledAlignedAlloc(size_t size, size_t align);
+
+    /// Free memory from PooledAlignedAlloc.  \p size and \p align must be
+    /// the values it was allocated with.  The memory may be freed on any
+    /// thread.
+    void PooledAlignedFree(void *p, size_t size, size_t align);
+
+    /// Return the statistics of the pooled allocator, including the calling
+    /// thread's unpublished counts.
+    PooledAllocStatistics getPooledAllocStatistics();
+
 } // end namespace swift
 
 
@@ -0,0 +1,74 @@
+//===--- ParallelTopCollection.h - Sharded top-N scoring --------*- C++ -*-===//
+//
+// This source file is part of the Swift.org open source project
+//
+// Copyright (c) 2014 - 2017 Apple Inc. and the Swift project authors
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// See https://swift.org/LICENSE.txt for license information
+// See https://swift.org/CONTRIBUTORS.txt for the list of Swift project authors
+//
+//===----------------------------------------------------------------------===//
+//
+// This file defines collectTopInParallel, which scores a large range of
+// candidates on LLVM's shared parallel executor, each shard filling its own
+// TopCollection, and merges the results.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef SWIFT_PARALLELTOPCOLLECTION_H
+#define SWIFT_PARALLELTOPCOLLECTION_H
+
+
+#include "swift/Basic/TopCollection.h"
+#include "llvm/Support/Parallel.h"
+#include <algorithm>
+#include <iterator>
+#include <vector>
+
+namespace swift {
+
+/// Score the candidates in [begin, end) and return the best-scoring
+/// maxSize of them.
+///
+/// The range is split into numShards contiguous shards, which are scored
+/// as tasks on llvm::parallelForEachN's shared thread pool; the number of
+/// threads it uses is set by llvm::parallel::strategy.  For each candidate
+/// of a shard, scoreFn(collection, candidate) is called, where collection
+/// is a TopCollection private to that shard; scoreFn inserts the candidate
+/// if it wants to, and may use collection.getMinUninterestingScore() to
+/// skip scoring hopeless ones.  The shards' collections are then merged in
+/// shard order, so the result depends only on the candidates and
+/// numShards, never on the number of threads or how they were scheduled.
+    template<class ScoreType, class T, unsigned InlineCapacity = 16,
+            class Iterator, class ScoreFn>
+    TopCollection<ScoreType, T, InlineCapacity>
+    collectTopInParallel(unsigned maxSize, Iterator begin, Iterator end,
+                         ScoreFn scoreFn, unsigned numShards = 64) {
+        using Collection = TopCollection<ScoreType, T, InlineCapacity>;
+        static_assert(std::is_base_of<
+                              std::random_access_iterator_tag,
+                              typename std::iterator_traits<Iterator>::iterator_category
+                      >::value,
+                      "shards are computed with random access");
+
+        size_t numCandidates = std::distance(begin, end);
+        numShards = std::max<size_t>(1, std::min<size_t>(numShards, numCandidates));
+
+        std::vector<Collection> shards(numShards, Collection(maxSize));
+        llvm::parallelForEachN(0, numShards, [&](size_t shard) {
+            Iterator shardBegin = begin + numCandidates * shard / numShards;
+            Iterator shardEnd = begin + numCandidates * (shard + 1) / numShards;
+            for (Iterator i = shardBegin; i != shardEnd; ++i)
+                scoreFn(shards[shard], *i);
+        });
+
+        Collection result = std::move(shards[0]);
+        for (unsigned shard = 1; shard < numShards; ++shard)
+            result.merge(std::move(shards[shard]));
+        return result;
+    }
+
+} // end namespace swift
+
+#endif //SWIFT_PARALLELTOPCOLLECTION_H
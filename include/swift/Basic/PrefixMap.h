@@ -52,6 +52,9 @@ namespace swift {
     template<class KeyElementType>
     class PrefixMapKeyPrinter;
 
+    template<class KeyElementType, class ValueType>
+    class FrozenPrefixMap;
+
 /// A map whose keys are sequences of comparable values, optimized for
 /// finding a mapped value for the longest matching initial subsequence.
     template<class KeyElementType, class ValueType,
@@ -340,9 +343,92 @@ namespace swift {
                 if (copy->Right) stack.push_back(&copy->Right);
                 if (copy->Further) stack.push_back(&copy->Further);
             };
-            copyAndEnqueueChildren(&root);
+            copyAndPushChildren(&root);
             while (!stack.empty()) {
-                copyAndEnqueueChildren(stack.pop_back_val());
+                copyAndPushChildren(stack.pop_back_val());
+            }
+            return root;
+        }
+
+        using SortedEntries = ArrayRef<std::pair<KeyType, ValueType>>;
+
+        /// Build a tree for the given entries, which must be sorted by key.
+        /// Sibling subtrees are balanced.
+        static Node *buildTree(SortedEntries entries) {
+            // Every entry in a work item shares the first 'Depth' key elements.
+            struct WorkItem {
+                Node **Ref;
+                SortedEntries Entries;
+                size_t Depth;
+            };
+
+            Node *root = nullptr;
+            SmallVector<WorkItem, 16> worklist;
+            if (!entries.empty()) worklist.push_back({&root, entries, 0});
+
+            while (!worklist.empty()) {
+                WorkItem item = worklist.pop_back_val();
+                auto range = item.Entries;
+                size_t depth = item.Depth;
+                assert(!range.empty());
+
+                // A key that is exactly the shared prefix gets a node with an
+                // empty local key, just like an insertion would create.  Only
+                // the empty key at the root can get here.
+                if (range.front().first.size() == depth) {
+                    Node *node = new Node();
+                    node->Value.initializeFrom(range.front().second);
+                    node->HasValue = true;
+                    *item.Ref = node;
+                    if (range.size() > 1)
+                        worklist.push_back({&node->Further, range.slice(1), depth});
+                    continue;
+                }
+
+                // Keys diverging at 'depth' form contiguous groups.  Root the
+                // subtree at the middle group so that siblings are balanced.
+                auto middle = range[range.size() / 2].first[depth];
+                size_t begin = std::partition_point(
+                        range.begin(), range.end(),
+                        [&](const std::pair<KeyType, ValueType> &entry) {
+                            return entry.first[depth] < middle;
+                        }) - range.begin();
+                size_t end = std::partition_point(
+                        range.begin() + begin, range.end(),
+                        [&](const std::pair<KeyType, ValueType> &entry) {
+                            return !(middle < entry.first[depth]);
+                        }) - range.begin();
+                auto group = range.slice(begin, end - begin);
+
+                // The local key is the group's common prefix, up to the
+                // inline capacity.
+                KeyType first = group.front().first;
+                KeyType last = group.back().first;
+                size_t len = std::min(std::min(first.size(), last.size()),
+                                      depth + InlineKeyCapacity);
+                size_t common = depth + 1;
+                while (common != len && first[common] == last[common]) ++common;
+
+                Node *node = new Node();
+                node->KeyLength = common - depth;
+                memcpy(node->Key, first.data() + depth,
+                       node->KeyLength * sizeof(KeyElementType));
+                *item.Ref = node;
+
+                // Since the entries are sorted, a key ending exactly here is
+                // the first in its group.
+                if (first.size() == common) {
+                    node->Value.initializeFrom(group.front().second);
+                    node->HasValue = true;
+                    group = group.slice(1);
+                }
+
+                if (begin != 0)
+                    worklist.push_back({&node->Left, range.slice(0, begin), depth});
+                if (end != range.size())
+                    worklist.push_back({&node->Right, range.slice(end), depth});
+                if (!group.empty())
+                    worklist.push_back({&node->Further, group, common});
             }
             return root;
         }
@@ -375,6 +461,36 @@ namespace swift {
             deleteTree(Root);
         }
 
+        /// Build a map from entries sorted by key, without duplicate keys.
+        ///
+        /// This is much faster than inserting the entries one at a time: each
+        /// node is created once, in its final place, and sibling subtrees are
+        /// balanced.
+        static PrefixMap
+        buildFromSorted(ArrayRef<std::pair<KeyType, ValueType>> entries) {
+            assert(std::is_sorted(entries.begin(), entries.end(),
+                                  [](const std::pair<KeyType, ValueType> &lhs,
+                                     const std::pair<KeyType, ValueType> &rhs) {
+                                      return std::lexicographical_compare(
+                                              lhs.first.begin(), lhs.first.end(),
+                                              rhs.first.begin(), rhs.first.end());
+                                  }) &&
+                   "entries must be sorted by key");
+            assert(std::adjacent_find(entries.begin(), entries.end(),
+                                      [](const std::pair<KeyType, ValueType> &lhs,
+                                         const std::pair<KeyType, ValueType> &rhs) {
+                                          return lhs.first == rhs.first;
+                                      }) == entries.end() &&
+                   "entries must not contain duplicate keys");
+            PrefixMap result;
+            result.Root = buildTree(entries);
+            return result;
+        }
+
+        /// Copy this map into a single contiguous, pointer-free buffer.  See
+        /// FrozenPrefixMap.h, which must be included to use this.
+        FrozenPrefixMap<KeyElementType, ValueType> freeze() const;
+
         /// Are there any entries in this map?
         bool empty() const {
             // The only way to create nodes is to insert an entry, and we don't
@@ -22,9 +22,42 @@
 
 #include "llvm/ADT/StringRef.h"
 #include "swift/Basic/LLVM.h"
+#include <cstdint>
+#include <cstring>
 
 namespace swift {
 
+    /// Returns the first occurrence of \p A or \p B in [Ptr, End), or End if
+    /// there is none.
+    inline const char *findFirstOf2(const char *Ptr, const char *End,
+                                    char A, char B) {
+        // A byte equal to C becomes zero when XORed with C, and whether any
+        // byte of a word is zero can be tested with a few arithmetic
+        // operations.  The test has no false negatives; a hit is confirmed
+        // a byte at a time.
+        const uint64_t Ones = 0x0101010101010101ULL;
+        const uint64_t Highs = 0x8080808080808080ULL;
+        const uint64_t SplatA = Ones * uint8_t(A);
+        const uint64_t SplatB = Ones * uint8_t(B);
+        while (End - Ptr >= 8) {
+            uint64_t Word;
+            memcpy(&Word, Ptr, sizeof(Word));
+            uint64_t MatchA = Word ^ SplatA;
+            uint64_t MatchB = Word ^ SplatB;
+            if ((((MatchA - Ones) & ~MatchA) |
+                 ((MatchB - Ones) & ~MatchB)) & Highs) {
+                for (unsigned I = 0; I != 8; ++I)
+                    if (Ptr[I] == A || Ptr[I] == B)
+                        return Ptr + I;
+            }
+            Ptr += 8;
+        }
+        for (; Ptr != End; ++Ptr)
+            if (*Ptr == A || *Ptr == B)
+                return Ptr;
+        return End;
+    }
+
     unsigned measureNewline(const char *BufferPtr, const char *BufferEnd);
 
     static inline unsigned measureNewline(StringRef S) {
@@ -35,6 +68,17 @@ namespace swift {
         return S.startswith("\n") || S.startswith("\r\n");
     }
 
+    /// Appends the lines of \p Text to \p Lines, without their terminators.
+    /// LF, CR and CRLF each end a line; a terminator at the very end of the
+    /// text does not start another line.
+    ///
+    /// \returns the smallest number of leading spaces on any line but the
+    /// first, ignoring a final unterminated line of only spaces, or ~0U if
+    /// there is no such line.
+    unsigned
+    splitIntoLinesMeasuringIndentation(StringRef Text,
+                                       SmallVectorImpl<StringRef> &Lines);
+
 /// Breaks a given string to lines and trims leading whitespace from them.
     void trimLeadingWhitespaceFromLines(StringRef Text, unsigned WhitespaceToTrim,
                                         SmallVectorImpl<StringRef> &Lines);
@@ -0,0 +1,855 @@
+//===--- RadixPrefixMap.h - An adaptive radix tree --------------*- C++ -*-===//
+//
+// This source file is part of the Swift.org open source project
+//
+// Copyright (c) 2014 - 2017 Apple Inc. and the Swift project authors
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// See https://swift.org/LICENSE.txt for license information
+// See https://swift.org/CONTRIBUTORS.txt for the list of Swift project authors
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file defines an alternative to PrefixMap for keys made of byte-sized
+//  elements.  It implements an adaptive radix tree:
+//
+//    - Every node dispatches on a single key element.  Inner nodes come in
+//      four sizes (4, 16, 48 and 256 children) and are replaced by the next
+//      larger size as they fill up, so sparse nodes stay small while dense
+//      nodes become a direct array lookup.
+//
+//    - Runs of key elements with no branching are collapsed into a single
+//      node ("path compression"), so a lookup touches one node per branch
+//      point rather than one node per few key elements.
+//
+//    - Nodes, compressed paths and values are carved out of a per-map
+//      bump allocator.  Nodes replaced by a larger size are recycled for
+//      later nodes of the same size; everything is released at once when
+//      the map is cleared or destroyed.
+//
+//  The interface mirrors PrefixMap, including handles that stay valid for
+//  as long as the mapping exists.  Entries are iterated in the order of the
+//  unsigned byte values of their keys.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef SWIFT_RADIXPREFIXMAP_H
+#define SWIFT_RADIXPREFIXMAP_H
+
+
+#include "swift/Basic/LLVM.h"
+#include "swift/Basic/PrefixMap.h"
+#include "swift/Basic/type_traits.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstring>
+#include <iterator>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace swift {
+
+/// A map whose keys are sequences of byte-sized values, optimized for
+/// finding a mapped value for the longest matching initial subsequence.
+    template<class KeyElementType, class ValueType>
+    class RadixPrefixMap {
+    public:
+        using KeyType = ArrayRef<KeyElementType>;
+
+        static_assert(sizeof(KeyElementType) == 1,
+                      "radix tree requires byte-sized key elements");
+        static_assert(IsTriviallyCopyable<KeyElementType>::value,
+                      "key element type must be trivially copyable");
+
+    private:
+        enum class NodeKind : uint8_t {
+            Node4, Node16, Node48, Node256
+        };
+
+        enum : unsigned {
+            NumNodeKinds = 4
+        };
+
+        /// The common header of all node sizes.
+        ///
+        /// A node's complete key is the complete key of its parent, followed
+        /// by the element selecting this node among the parent's children,
+        /// followed by the node's compressed Prefix.
+        struct Node {
+            /// The compressed path; points into the map's allocator.
+            const KeyElementType *Prefix = nullptr;
+            uint32_t PrefixLength = 0;
+            NodeKind Kind;
+            uint16_t NumChildren = 0;
+
+            /// The value mapped at this node's complete key, if any.  Values
+            /// are allocated separately so that growing a node doesn't move
+            /// them and invalidate handles.
+            ValueType *Value = nullptr;
+
+            explicit Node(NodeKind kind) : Kind(kind) {}
+
+            KeyType getPrefix() const { return {Prefix, PrefixLength}; }
+        };
+
+        /// Up to 4 children, found by a linear scan of sorted keys.
+        struct Node4 : Node {
+            static const NodeKind StaticKind = NodeKind::Node4;
+            static const unsigned Capacity = 4;
+            uint8_t Keys[Capacity];
+            Node *Children[Capacity];
+
+            Node4() : Node(StaticKind) {}
+        };
+
+        /// Up to 16 children, found by a single vector compare of sorted keys.
+        struct Node16 : Node {
+            static const NodeKind StaticKind = NodeKind::Node16;
+            static const unsigned Capacity = 16;
+            uint8_t Keys[Capacity];
+            Node *Children[Capacity];
+
+            Node16() : Node(StaticKind) {}
+        };
+
+        /// Up to 48 children, found through a 256-entry byte index.  An index
+        /// entry of zero means no child; otherwise it is the slot plus one.
+        struct Node48 : Node {
+            static const NodeKind StaticKind = NodeKind::Node48;
+            static const unsigned Capacity = 48;
+            uint8_t ChildIndex[256];
+            Node *Children[Capacity];
+
+            Node48() : Node(StaticKind) {
+                memset(ChildIndex, 0, sizeof(ChildIndex));
+            }
+        };
+
+        /// Up to 256 children, indexed directly.
+        struct Node256 : Node {
+            static const NodeKind StaticKind = NodeKind::Node256;
+            static const unsigned Capacity = 256;
+            Node *Children[Capacity];
+
+            Node256() : Node(StaticKind) {
+                memset(Children, 0, sizeof(Children));
+            }
+        };
+
+        /// Nodes which were replaced by a larger node, threaded through their
+        /// own storage.
+        struct FreeNode {
+            FreeNode *Next;
+        };
+
+        static uint8_t toByte(KeyElementType elt) {
+            uint8_t byte;
+            memcpy(&byte, &elt, 1);
+            return byte;
+        }
+
+        static KeyElementType fromByte(uint8_t byte) {
+            KeyElementType elt;
+            memcpy(&elt, &byte, 1);
+            return elt;
+        }
+
+        llvm::BumpPtrAllocator Allocator;
+        FreeNode *FreeLists[NumNodeKinds] = {};
+        Node *Root = nullptr;
+        size_t NumEntries = 0;
+
+        template<class T>
+        T *allocateNode() {
+            void *mem;
+            auto &freeList = FreeLists[unsigned(T::StaticKind)];
+            if (freeList) {
+                mem = freeList;
+                freeList = freeList->Next;
+            } else {
+                mem = Allocator.Allocate(sizeof(T), alignof(T));
+            }
+            return ::new(mem) T();
+        }
+
+        void recycleNode(Node *node) {
+            auto &freeList = FreeLists[unsigned(node->Kind)];
+            auto free = reinterpret_cast<FreeNode *>(node);
+            free->Next = freeList;
+            freeList = free;
+        }
+
+        const KeyElementType *copyKey(KeyType key) {
+            if (key.empty()) return nullptr;
+            auto mem = Allocator.template Allocate<KeyElementType>(key.size());
+            memcpy(mem, key.data(), key.size());
+            return mem;
+        }
+
+        /// Create a childless node whose compressed path is the given key.
+        Node *createLeaf(KeyType key) {
+            auto leaf = allocateNode<Node4>();
+            leaf->Prefix = copyKey(key);
+            leaf->PrefixLength = key.size();
+            return leaf;
+        }
+
+        /// Return the slot holding the child for the given key element, or
+        /// null if there is no such child.
+        static Node **findChild(Node *node, uint8_t byte) {
+            switch (node->Kind) {
+                case NodeKind::Node4: {
+                    auto n = static_cast<Node4 *>(node);
+                    for (unsigned i = 0, e = n->NumChildren; i != e; ++i) {
+                        if (n->Keys[i] == byte) return &n->Children[i];
+                    }
+                    return nullptr;
+                }
+                case NodeKind::Node16: {
+                    auto n = static_cast<Node16 *>(node);
+#if defined(__SSE2__)
+                    __m128i keys = _mm_loadu_si128(
+                            reinterpret_cast<const __m128i *>(n->Keys));
+                    __m128i matches =
+                            _mm_cmpeq_epi8(_mm_set1_epi8(char(byte)), keys);
+                    unsigned mask = unsigned(_mm_movemask_epi8(matches)) &
+                                    ((1u << n->NumChildren) - 1);
+                    if (!mask) return nullptr;
+                    return &n->Children[llvm::countTrailingZeros(mask)];
+#else
+                    for (unsigned i = 0, e = n->NumChildren; i != e; ++i) {
+                        if (n->Keys[i] == byte) return &n->Children[i];
+                    }
+                    return nullptr;
+#endif
+                }
+                case NodeKind::Node48: {
+                    auto n = static_cast<Node48 *>(node);
+                    unsigned index = n->ChildIndex[byte];
+                    return index ? &n->Children[index - 1] : nullptr;
+                }
+                case NodeKind::Node256: {
+                    auto n = static_cast<Node256 *>(node);
+                    return n->Children[byte] ? &n->Children[byte] : nullptr;
+                }
+            }
+            llvm_unreachable("bad node kind");
+        }
+
+        /// Return the first child whose position is at least 'pos', in key
+        /// order, and update 'pos' to the position after it.  Positions are
+        /// slot indices for the sorted node sizes and key bytes otherwise.
+        static Node *nextChild(const Node *node, unsigned &pos, uint8_t &byte) {
+            switch (node->Kind) {
+                case NodeKind::Node4:
+                case NodeKind::Node16: {
+                    const uint8_t *keys;
+                    Node *const *children;
+                    if (node->Kind == NodeKind::Node4) {
+                        keys = static_cast<const Node4 *>(node)->Keys;
+                        children = static_cast<const Node4 *>(node)->Children;
+                    } else {
+                        keys = static_cast<const Node16 *>(node)->Keys;
+                        children = static_cast<const Node16 *>(node)->Children;
+                    }
+                    if (pos >= node->NumChildren) return nullptr;
+                    byte = keys[pos];
+                    return children[pos++];
+                }
+                case NodeKind::Node48: {
+                    auto n = static_cast<const Node48 *>(node);
+                    for (; pos < 256; ++pos) {
+                        if (unsigned index = n->ChildIndex[pos]) {
+                            byte = pos++;
+                            return n->Children[index - 1];
+                        }
+                    }
+                    return nullptr;
+                }
+                case NodeKind::Node256: {
+                    auto n = static_cast<const Node256 *>(node);
+                    for (; pos < 256; ++pos) {
+                        if (Node *child = n->Children[pos]) {
+                            byte = pos++;
+                            return child;
+                        }
+                    }
+                    return nullptr;
+                }
+            }
+            llvm_unreachable("bad node kind");
+        }
+
+        /// Insert a child into a sorted node, which must have room for it.
+        template<class T>
+        static void insertSorted(T *node, uint8_t byte, Node *child) {
+            unsigned i = 0, e = node->NumChildren;
+            while (i != e && node->Keys[i] < byte) ++i;
+            memmove(node->Keys + i + 1, node->Keys + i, e - i);
+            memmove(node->Children + i + 1, node->Children + i,
+                    (e - i) * sizeof(Node *));
+            node->Keys[i] = byte;
+            node->Children[i] = child;
+            node->NumChildren++;
+        }
+
+        /// Allocate a node of the given size and move the header of the
+        /// old node into it.
+        template<class T>
+        T *growInto(Node *old) {
+            T *grown = allocateNode<T>();
+            grown->Prefix = old->Prefix;
+            grown->PrefixLength = old->PrefixLength;
+            grown->NumChildren = old->NumChildren;
+            grown->Value = old->Value;
+            return grown;
+        }
+
+        /// Replace the node in '*ref' by the next larger size.
+        void grow(Node **ref) {
+            Node *old = *ref;
+            Node *grown;
+            switch (old->Kind) {
+                case NodeKind::Node4: {
+                    auto n = static_cast<Node4 *>(old);
+                    auto g = growInto<Node16>(old);
+                    memcpy(g->Keys, n->Keys, sizeof(n->Keys));
+                    memcpy(g->Children, n->Children, sizeof(n->Children));
+                    grown = g;
+                    break;
+                }
+                case NodeKind::Node16: {
+                    auto n = static_cast<Node16 *>(old);
+                    auto g = growInto<Node48>(old);
+                    for (unsigned i = 0; i != Node16::Capacity; ++i) {
+                        g->ChildIndex[n->Keys[i]] = i + 1;
+                        g->Children[i] = n->Children[i];
+                    }
+                    grown = g;
+                    break;
+                }
+                case NodeKind::Node48: {
+                    auto n = static_cast<Node48 *>(old);
+                    auto g = growInto<Node256>(old);
+                    for (unsigned b = 0; b != 256; ++b) {
+                        if (unsigned index = n->ChildIndex[b])
+                            g->Children[b] = n->Children[index - 1];
+                    }
+                    grown = g;
+                    break;
+                }
+                case NodeKind::Node256:
+                    llvm_unreachable("cannot grow a full node");
+            }
+            recycleNode(old);
+            *ref = grown;
+        }
+
+        /// Add a child for a key element which doesn't have one yet,
+        /// growing the node in '*ref' if necessary.
+        void addChild(Node **ref, uint8_t byte, Node *child) {
+            assert(!findChild(*ref, byte) && "child already exists");
+            Node *node = *ref;
+            switch (node->Kind) {
+                case NodeKind::Node4:
+                    if (node->NumChildren == Node4::Capacity) break;
+                    return insertSorted(static_cast<Node4 *>(node), byte, child);
+                case NodeKind::Node16:
+                    if (node->NumChildren == Node16::Capacity) break;
+                    return insertSorted(static_cast<Node16 *>(node), byte, child);
+                case NodeKind::Node48: {
+                    if (node->NumChildren == Node48::Capacity) break;
+                    auto n = static_cast<Node48 *>(node);
+                    n->Children[n->NumChildren] = child;
+                    n->ChildIndex[byte] = ++n->NumChildren;
+                    return;
+                }
+                case NodeKind::Node256: {
+                    auto n = static_cast<Node256 *>(node);
+                    n->Children[byte] = child;
+                    n->NumChildren++;
+                    return;
+                }
+            }
+            grow(ref);
+            addChild(ref, byte, child);
+        }
+
+        /// Find the node with the given complete key, creating it (and
+        /// splitting compressed paths) if necessary.
+        Node *getOrCreateNode(KeyType key) {
+            Node **ref = &Root;
+            if (!Root) return Root = createLeaf(key);
+
+            while (true) {
+                Node *cur = *ref;
+
+                // Compare the lookup key with the compressed path.
+                size_t len = std::min<size_t>(cur->PrefixLength, key.size());
+                size_t i = 0;
+                while (i != len && cur->Prefix[i] == key[i]) ++i;
+
+                // If the key diverges from or ends inside the compressed path,
+                // split it:
+                //   ref -> cur 'abcdef'
+                // =>
+                //   ref -> split 'ab' -[c]-> cur 'def'
+                if (i != cur->PrefixLength) {
+                    auto split = allocateNode<Node4>();
+                    split->Prefix = cur->Prefix;
+                    split->PrefixLength = i;
+                    split->Keys[0] = toByte(cur->Prefix[i]);
+                    split->Children[0] = cur;
+                    split->NumChildren = 1;
+                    cur->Prefix += i + 1;
+                    cur->PrefixLength -= i + 1;
+                    *ref = split;
+
+                    key = key.slice(i);
+                    if (key.empty()) return split;
+
+                    Node *leaf = createLeaf(key.slice(1));
+                    addChild(ref, toByte(key[0]), leaf);
+                    return leaf;
+                }
+
+                key = key.slice(i);
+                if (key.empty()) return cur;
+
+                uint8_t byte = toByte(key[0]);
+                Node **child = findChild(cur, byte);
+                if (!child) {
+                    Node *leaf = createLeaf(key.slice(1));
+                    addChild(ref, byte, leaf);
+                    return leaf;
+                }
+                ref = child;
+                key = key.slice(1);
+            }
+        }
+
+        /// Find the node with a value for the longest prefix of the given key,
+        /// setting 'remainingKey' to the unmatched rest of the key.
+        Node *findLongestPrefix(KeyType key, KeyType &remainingKey) const {
+            Node *best = nullptr;
+            Node *cur = Root;
+            while (cur) {
+                if (cur->PrefixLength > key.size()) break;
+                if (cur->PrefixLength &&
+                    memcmp(cur->Prefix, key.data(), cur->PrefixLength) != 0)
+                    break;
+                key = key.slice(cur->PrefixLength);
+
+                if (cur->Value) {
+                    best = cur;
+                    remainingKey = key;
+                }
+                if (key.empty()) break;
+
+                Node **child = findChild(cur, toByte(key[0]));
+                if (!child) break;
+                cur = *child;
+                key = key.slice(1);
+            }
+            return best;
+        }
+
+        /// Call the given function on every child slot of a node, in key
+        /// order.
+        template<class Fn>
+        static void forEachChild(Node *node, const Fn &fn) {
+            unsigned pos = 0;
+            uint8_t byte;
+            while (Node *child = nextChild(node, pos, byte)) {
+                fn(byte, child);
+            }
+        }
+
+        /// Destroy all the values in the tree.
+        void destroyValues() {
+            if (IsTriviallyDestructible<ValueType>::value || !Root) return;
+
+            SmallVector<Node *, 16> stack;
+            stack.push_back(Root);
+            while (!stack.empty()) {
+                Node *node = stack.pop_back_val();
+                if (node->Value) node->Value->~ValueType();
+                forEachChild(node, [&](uint8_t, Node *child) {
+                    stack.push_back(child);
+                });
+            }
+        }
+
+        template<class T>
+        T *cloneNodeAs(const Node *node) {
+            auto copy = allocateNode<T>();
+            *copy = *static_cast<const T *>(node);
+            return copy;
+        }
+
+        /// Copy all the nodes in another map's tree into this map's allocator.
+        Node *cloneTree(Node *root) {
+            if (!root) return nullptr;
+
+            Node *result = root;
+            SmallVector<Node **, 16> stack;
+            stack.push_back(&result);
+            while (!stack.empty()) {
+                Node **ref = stack.pop_back_val();
+                Node *node = *ref;
+                Node *copy;
+                switch (node->Kind) {
+                    case NodeKind::Node4:
+                        copy = cloneNodeAs<Node4>(node);
+                        break;
+                    case NodeKind::Node16:
+                        copy = cloneNodeAs<Node16>(node);
+                        break;
+                    case NodeKind::Node48:
+                        copy = cloneNodeAs<Node48>(node);
+                        break;
+                    case NodeKind::Node256:
+                        copy = cloneNodeAs<Node256>(node);
+                        break;
+                }
+                copy->Prefix = copyKey(node->getPrefix());
+                if (node->Value) copy->Value = createValue(*node->Value);
+                *ref = copy;
+
+                unsigned pos = 0;
+                uint8_t byte;
+                while (nextChild(copy, pos, byte)) {
+                    stack.push_back(findChild(copy, byte));
+                }
+            }
+            return result;
+        }
+
+        template<typename... A>
+        ValueType *createValue(A &&...args) {
+            void *mem = Allocator.Allocate(sizeof(ValueType), alignof(ValueType));
+            return ::new(mem) ValueType(std::forward<A>(args)...);
+        }
+
+        void printNode(raw_ostream &out, Node *node, unsigned indent,
+                       const uint8_t *edge) const {
+            out.indent(indent);
+            if (edge) {
+                KeyElementType elt = fromByte(*edge);
+                PrefixMapKeyPrinter<KeyElementType>::print(out, KeyType(elt));
+                out << ' ';
+            }
+            PrefixMapKeyPrinter<KeyElementType>::print(out, node->getPrefix());
+            if (node->Value) out << " (" << *node->Value << ')';
+            out << '\n';
+            forEachChild(node, [&](uint8_t byte, Node *child) {
+                printNode(out, child, indent + 2, &byte);
+            });
+        }
+
+    public:
+        RadixPrefixMap() {}
+
+        RadixPrefixMap(const RadixPrefixMap &other)
+                : Root(cloneTree(other.Root)), NumEntries(other.NumEntries) {}
+
+        RadixPrefixMap(RadixPrefixMap &&other)
+                : Allocator(std::move(other.Allocator)), Root(other.Root),
+                  NumEntries(other.NumEntries) {
+            std::copy(std::begin(other.FreeLists), std::end(other.FreeLists),
+                      std::begin(FreeLists));
+            std::fill(std::begin(other.FreeLists), std::end(other.FreeLists),
+                      nullptr);
+            other.Root = nullptr;
+            other.NumEntries = 0;
+        }
+
+        RadixPrefixMap &operator=(const RadixPrefixMap &other) {
+            if (this == &other) return *this;
+            clear();
+            Root = cloneTree(other.Root);
+            NumEntries = other.NumEntries;
+            return *this;
+        }
+
+        RadixPrefixMap &operator=(RadixPrefixMap &&other) {
+            if (this == &other) return *this;
+            destroyValues();
+            Allocator = std::move(other.Allocator);
+            std::copy(std::begin(other.FreeLists), std::end(other.FreeLists),
+                      std::begin(FreeLists));
+            std::fill(std::begin(other.FreeLists), std::end(other.FreeLists),
+                      nullptr);
+            Root = other.Root;
+            NumEntries = other.NumEntries;
+            other.Root = nullptr;
+            other.NumEntries = 0;
+            return *this;
+        }
+
+        ~RadixPrefixMap() {
+            destroyValues();
+        }
+
+        /// Are there any entries in this map?
+        bool empty() const { return NumEntries == 0; }
+
+        /// Return the number of entries in this map.
+        size_t size() const { return NumEntries; }
+
+        /// Remove all entries in the map.
+        void clear() {
+            destroyValues();
+            Allocator.Reset();
+            std::fill(std::begin(FreeLists), std::end(FreeLists), nullptr);
+            Root = nullptr;
+            NumEntries = 0;
+        }
+
+        /// An input iterator over the entries in the map, in the order of
+        /// the unsigned byte values of their keys.
+        ///
+        /// As with PrefixMap, this iterator stores the access path to the
+        /// entry and operator* returns a proxy referencing that path.
+        class const_iterator {
+        protected:
+            struct PathEntry {
+                Node *N;
+                /// The next child position to visit, or BeforeValue if the
+                /// node's own value hasn't been visited yet.
+                unsigned Pos;
+                /// The key element leading to this node; unused for the root.
+                uint8_t Edge;
+
+                bool operator==(const PathEntry &other) const {
+                    return N == other.N && Pos == other.Pos;
+                }
+            };
+            enum : unsigned {
+                BeforeValue = ~0u
+            };
+            SmallVector<PathEntry, 8> Stack;
+
+        public:
+            const_iterator() {}
+
+            explicit const_iterator(Node *root) {
+                if (!root) return;
+                Stack.push_back({root, BeforeValue, 0});
+                advance();
+            }
+
+            /// A proxy object referencing a valid entry in the map.
+            class ConstEntryProxy {
+                ArrayRef<PathEntry> Path;
+            public:
+                explicit ConstEntryProxy(ArrayRef<PathEntry> path) : Path(path) {
+                    assert(!Path.empty() && Path.back().N->Value);
+                }
+
+                /// Return the value of the entry.  The returned reference is valid
+                /// as long as the entry remains in the map.
+                const ValueType &getValue() const {
+                    return *Path.back().N->Value;
+                }
+
+                /// Read the value's key into the given buffer.
+                KeyType getKey(SmallVectorImpl<KeyElementType> &buffer) const {
+                    buffer.clear();
+                    for (auto &entry : Path) {
+                        if (&entry != &Path.front())
+                            buffer.push_back(fromByte(entry.Edge));
+                        auto prefix = entry.N->getPrefix();
+                        buffer.append(prefix.begin(), prefix.end());
+                    }
+                    return buffer;
+                }
+            };
+
+            /// Return a proxy value for the entry.  The returned proxy is
+            /// invalidated by any change to the underlying iterator.
+            ConstEntryProxy operator*() const {
+                return ConstEntryProxy(Stack);
+            }
+
+            /// Advance the iterator.
+            const_iterator &operator++() {
+                assert(!Stack.empty());
+                advance();
+                return *this;
+            }
+
+            const_iterator operator++(int) {
+                const_iterator copy = *this;
+                operator++();
+                return copy;
+            }
+
+            bool operator==(const const_iterator &other) const {
+                return Stack == other.Stack;
+            }
+
+            bool operator!=(const const_iterator &other) const {
+                return !operator==(other);
+            }
+
+            using difference_type = ptrdiff_t;
+            using iterator_category = std::input_iterator_tag;
+            using value_type = ConstEntryProxy;
+            using pointer = ConstEntryProxy;
+            using reference = ConstEntryProxy;
+
+        private:
+            /// Move to the next node with a value in pre-order.
+            void advance() {
+                while (!Stack.empty()) {
+                    PathEntry &top = Stack.back();
+                    if (top.Pos == BeforeValue) {
+                        top.Pos = 0;
+                        if (top.N->Value) return;
+                    }
+                    uint8_t byte;
+                    if (Node *child = nextChild(top.N, top.Pos, byte)) {
+                        Stack.push_back({child, BeforeValue, byte});
+                        continue;
+                    }
+                    Stack.pop_back();
+                }
+            }
+        };
+
+        /// An input iterator over the entries in this map.
+        struct iterator : const_iterator {
+            iterator() : const_iterator() {}
+
+            explicit iterator(Node *root) : const_iterator(root) {}
+
+            struct EntryProxy : const_iterator::ConstEntryProxy {
+                using const_iterator::ConstEntryProxy::ConstEntryProxy;
+
+                ValueType &getValue() const {
+                    return const_cast<ValueType &>(
+                            const_iterator::ConstEntryProxy::getValue());
+                }
+            };
+
+            EntryProxy operator*() const {
+                return EntryProxy(this->Stack);
+            }
+
+            iterator &operator++() {
+                return static_cast<iterator &>(const_iterator::operator++());
+            }
+
+            iterator operator++(int) {
+                iterator copy = *this;
+                operator++();
+                return copy;
+            }
+
+            using value_type = EntryProxy;
+            using pointer = EntryProxy;
+            using reference = EntryProxy;
+        };
+
+        iterator begin() { return iterator(Root); }
+
+        iterator end() { return iterator(); }
+
+        const_iterator begin() const { return const_iterator(Root); }
+
+        const_iterator end() const { return const_iterator(); }
+
+        /// A handle to the mapping for a given key.  Only invalidated by
+        /// changes that remove the mapping.
+        class Handle {
+            ValueType *Ptr;
+        public:
+            Handle() : Ptr(nullptr) {}
+
+            explicit Handle(ValueType *ptr) : Ptr(ptr) {}
+
+            explicit operator bool() const { return Ptr != nullptr; }
+
+            ValueType &operator*() const {
+                assert(Ptr);
+                return *Ptr;
+            }
+        };
+
+        using KeyIterator = typename KeyType::iterator;
+
+        /// Find the longest prefix of the given key which has an entry in
+        /// this map, and return an iterator corresponding to the end of the
+        /// prefix.
+        std::pair<Handle, KeyIterator>
+        findPrefix(KeyType key) const {
+            KeyType remainingKey;
+            Node *node = findLongestPrefix(key, remainingKey);
+            return {Handle(node ? node->Value : nullptr), remainingKey.begin()};
+        }
+
+        /// Get or create an entry in the map.
+        ///
+        /// \return a handle to the entry and a bool indicating (if true)
+        ///   that the map was modified to insert the mapping.
+        template<typename Fn>
+        std::pair<Handle, bool>
+        insertLazy(KeyType key, const Fn &create) {
+            Node *node = getOrCreateNode(key);
+            if (node->Value) return {Handle(node->Value), false};
+            node->Value = createValue(create());
+            NumEntries++;
+            return {Handle(node->Value), true};
+        }
+
+        std::pair<Handle, bool>
+        insert(KeyType key, ValueType &&value) {
+            return insertLazy(key,
+                              [&]() -> ValueType && { return std::move(value); });
+        }
+
+        std::pair<Handle, bool>
+        insert(KeyType key, const ValueType &value) {
+            return insertLazy(key,
+                              [&]() -> const ValueType & { return value; });
+        }
+
+        /// Insert a new entry into the map, asserting that it doesn't
+        /// already exist.
+        template<typename Fn>
+        Handle insertNewLazy(KeyType key, const Fn &create) {
+            auto result = insertLazy(key, create);
+            assert(result.second && "entry already exists");
+            return result.first;
+        }
+
+        Handle insertNew(KeyType key, ValueType &&value) {
+            return insertNewLazy(key,
+                                 [&]() -> ValueType && { return std::move(value); });
+        }
+
+        Handle insertNew(KeyType key, const ValueType &value) {
+            return insertNewLazy(key,
+                                 [&]() -> const ValueType & { return value; });
+        }
+
+        void dump() const { print(llvm::errs()); }
+
+        void print(raw_ostream &out) const {
+            if (!Root) {
+                out << "(empty)\n";
+                return;
+            }
+            printNode(out, Root, 0, nullptr);
+        }
+    };
+
+} // end namespace swift
+
+#endif //SWIFT_RADIXPREFIXMAP_H
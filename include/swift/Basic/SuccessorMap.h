@@ -43,6 +43,9 @@ namespace swift {
     };
 
     /// A successor map.  Not a STL-style map.
+    ///
+    /// This is a splay tree, so even lookups restructure it.  See
+    /// FlatSuccessorMap for an alternative with const lookups.
     template<class K, class V, class Traits = SuccessorMapTraits<K> >
     class SuccessorMap {
         struct Node {
@@ -82,14 +85,17 @@ namespace swift {
             clear();
             Root = other.Root;
             other.Root = nullptr;
+            return *this;
         }
 
         SuccessorMap(const SuccessorMap &other) : Root(copyTree(other.Root)) {}
 
         SuccessorMap &operator=(const SuccessorMap &other) {
             // TODO: this is clearly optimizable to re-use nodes.
+            if (this == &other) return *this;
             deleteTree(Root);
             Root = copyTree(other.Root);
+            return *this;
         }
 
         ~SuccessorMap() {
@@ -135,7 +141,7 @@ namespace swift {
             // upper bound, prepend to it.
             auto keySuccessor = Traits::getSuccessor(key);
             if (upperBound && Traits::equals(keySuccessor, upperBound->Begin)) {
-                upperBound->Begin = std::move(keySuccessor);
+                upperBound->Begin = std::forward<KeyTy>(key);
                 upperBound->Value = std::forward<ValueTy>(value);
                 return;
             }
@@ -0,0 +1,66 @@
+//===--- ThreadLocalState.h - Per-thread state safe at exit -----*- C++ -*-===//
+//
+// This source file is part of the Swift.org open source project
+//
+// Copyright (c) 2014 - 2017 Apple Inc. and the Swift project authors
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// See https://swift.org/LICENSE.txt for license information
+// See https://swift.org/CONTRIBUTORS.txt for the list of Swift project authors
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file defines helpers for per-thread state that hands its contents
+//  back to a global registry when its thread exits.
+//
+//  Threads can exit after static destructors have run, so the registry is
+//  never destroyed.  And thread_local objects are destroyed in reverse
+//  order of construction, so code running in another thread_local's
+//  destructor may find the state already gone; it must then fall back to
+//  the registry.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef SWIFT_THREADLOCALSTATE_H
+#define SWIFT_THREADLOCALSTATE_H
+
+namespace swift {
+
+    /// Return the process-wide instance of \p T, which is created on first
+    /// use and never destroyed, so that it outlives every thread.
+    template<class T>
+    T &getLeakedSingleton() {
+        static T *Instance = new T();
+        return *Instance;
+    }
+
+    /// The calling thread's instance of \p T, created on first use and
+    /// destroyed when the thread exits.
+    template<class T>
+    class ThreadLocalState {
+        struct Holder {
+            T State;
+
+            ~Holder() { IsDestroyed = true; }
+        };
+
+        /// Kept outside the Holder because it must stay valid after the
+        /// state is destroyed.
+        static thread_local bool IsDestroyed;
+
+    public:
+        /// Return the calling thread's state, or null once it has begun to
+        /// be destroyed.
+        static T *get() {
+            if (IsDestroyed) return nullptr;
+            static thread_local Holder holder;
+            return &holder.State;
+        }
+    };
+
+    template<class T>
+    thread_local bool ThreadLocalState<T>::IsDestroyed = false;
+
+} // end namespace swift
+
+#endif //SWIFT_THREADLOCALSTATE_H
@@ -38,16 +38,125 @@ namespace swift {
 
     public:
         void Retain() const {
-            ref_cnt += 1;
+            ref_cnt.fetch_add(1, std::memory_order_relaxed);
         }
 
         void Release() const {
-            int refCount = static_cast<int>(--ref_cnt);
+            int refCount = static_cast<int>(
+                    ref_cnt.fetch_sub(1, std::memory_order_acq_rel)) - 1;
             assert(refCount >= 0 && "Reference count was already zero.");
             if (refCount == 0) delete this;
         }
     };
 
+/// A thread-safe intrusive reference count for use with IntrusiveRefCntPtr,
+/// without a vtable.
+///
+/// \p Derived is the most-derived class, which is deleted non-virtually when
+/// the count drops to zero.  Retains are relaxed; a release is
+/// acquire-release, so that everything done through other references happens
+/// before the object is destroyed.
+    template<class Derived>
+    class ThreadSafeRefCounted {
+        mutable std::atomic<unsigned> RefCount;
+
+        ThreadSafeRefCounted(const ThreadSafeRefCounted &) = delete;
+
+        ThreadSafeRefCounted &operator=(const ThreadSafeRefCounted &) = delete;
+
+    protected:
+        ThreadSafeRefCounted() : RefCount(0) {}
+
+        ~ThreadSafeRefCounted() = default;
+
+    public:
+        void Retain() const {
+            RefCount.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void Release() const {
+            unsigned oldCount = RefCount.fetch_sub(1, std::memory_order_acq_rel);
+            assert(oldCount != 0 && "Reference count was already zero.");
+            if (oldCount == 1) delete static_cast<const Derived *>(this);
+        }
+    };
+
+/// A variant of \c ThreadSafeRefCounted that is biased towards the thread
+/// that creates the object.
+///
+/// Until markShared() is called, the object must only be referenced from the
+/// thread that created it, and its count is updated with plain loads and
+/// stores instead of atomic read-modify-write operations.  The owning thread
+/// must call markShared() before making the object reachable from any other
+/// thread; from then on, the count behaves like ThreadSafeRefCounted's.
+/// Storing an object in a \c sys::Cache marks it shared.
+    template<class Derived>
+    class BiasedThreadSafeRefCounted {
+        mutable std::atomic<unsigned> RefCount;
+
+        /// Only ever written by the owning thread before the object is shared,
+        /// so reading it never races.
+        mutable bool IsShared;
+
+        BiasedThreadSafeRefCounted(const BiasedThreadSafeRefCounted &) = delete;
+
+        BiasedThreadSafeRefCounted &
+        operator=(const BiasedThreadSafeRefCounted &) = delete;
+
+    protected:
+        BiasedThreadSafeRefCounted() : RefCount(0), IsShared(false) {}
+
+        ~BiasedThreadSafeRefCounted() = default;
+
+    public:
+        /// Allow other threads to reference this object.  Must be called on
+        /// the owning thread, or after the object has been shared already.
+        void markShared() const {
+            if (!IsShared) IsShared = true;
+        }
+
+        bool isShared() const { return IsShared; }
+
+        void Retain() const {
+            if (!IsShared) {
+                RefCount.store(RefCount.load(std::memory_order_relaxed) + 1,
+                               std::memory_order_relaxed);
+                return;
+            }
+            RefCount.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void Release() const {
+            unsigned oldCount;
+            if (!IsShared) {
+                oldCount = RefCount.load(std::memory_order_relaxed);
+                RefCount.store(oldCount - 1, std::memory_order_relaxed);
+            } else {
+                oldCount = RefCount.fetch_sub(1, std::memory_order_acq_rel);
+            }
+            assert(oldCount != 0 && "Reference count was already zero.");
+            if (oldCount == 1) delete static_cast<const Derived *>(this);
+        }
+    };
+
+    namespace detail {
+        template<class T>
+        auto markRefCountedShared(const T *object, int)
+        -> decltype(object->markShared(), void()) {
+            object->markShared();
+        }
+
+        template<class T>
+        void markRefCountedShared(const T *object, long) {}
+    } // end namespace detail
+
+/// Prepare a reference-counted object to be reachable from other threads, if
+/// its reference count distinguishes that.
+    template<class T>
+    void markRefCountedShared(const T *object) {
+        detail::markRefCountedShared(object, 0);
+    }
+
 } // end namespace swift
 
 #endif //SWIFT_THREADSAFEREFCOUNTED_H
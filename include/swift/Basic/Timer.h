@@ -13,13 +13,121 @@
 #ifndef SWIFT_TIMER_H
 #define SWIFT_TIMER_H
 
+#include "swift/Basic/Defer.h"
 #include "swift/Basic/LLVM.h"
 #include "llvm/ADT/Optional.h"
+#include "llvm/Support/Compiler.h"
 #include "llvm/Support/Timer.h"
+#include <atomic>
+#include <cstdint>
+#include <vector>
 
 namespace swift {
+    /// A histogram of durations in nanoseconds with logarithmic buckets, in
+    /// the style of HdrHistogram.
+    ///
+    /// Values below 2 * SubBucketCount are counted exactly; above that, each
+    /// power of two is split into SubBucketCount buckets, so quantiles are
+    /// accurate to within 1/SubBucketCount of the true value.  Only the
+    /// buckets up to the largest recorded value are allocated.
+    class DurationHistogram {
+    public:
+        enum : unsigned {
+            SubBucketBits = 5,
+            SubBucketCount = 1U << SubBucketBits
+        };
+
+    private:
+        std::vector<uint64_t> Counts;
+        uint64_t Count = 0;
+        uint64_t Total = 0;
+        uint64_t Min = UINT64_MAX;
+        uint64_t Max = 0;
+
+        static unsigned getBucketIndex(uint64_t value);
+
+        /// Return the value halfway through the range a bucket covers.
+        static uint64_t getBucketMidpoint(unsigned index);
+
+    public:
+        /// Record one duration.
+        void record(uint64_t nanos);
+
+        /// Add all durations recorded in \p other.
+        void merge(const DurationHistogram &other);
+
+        uint64_t getCount() const { return Count; }
+
+        uint64_t getTotal() const { return Total; }
+
+        uint64_t getMin() const { return Count ? Min : 0; }
+
+        uint64_t getMax() const { return Max; }
+
+        /// Return the duration below which the fraction \p quantile of the
+        /// recorded durations fall, e.g. 0.5 for the median.
+        uint64_t getQuantile(double quantile) const;
+    };
+
+    namespace detail {
+        extern std::atomic<bool> TimerRegistryEnabled;
+    } // end namespace detail
+
+    /// Is the timer registry recording?
+    inline bool isTimerRegistryEnabled() {
+        return detail::TimerRegistryEnabled.load(std::memory_order_relaxed);
+    }
+
+    /// Start or stop recording AggregateTimers.
+    void setTimerRegistryEnabled(bool enabled);
+
+    /// An RAII timer whose durations are collected in the timer registry.
+    ///
+    /// The registry keeps a call tree for each thread: a timer started
+    /// while another is running on the same thread is recorded as its
+    /// child.  Each node of the tree aggregates the count and a histogram
+    /// of the durations of every timer with that name at that position.
+    class AggregateTimer {
+        void *Node = nullptr;
+        uint64_t Start;
+
+        void start(StringRef name);
+
+        void stop();
+
+    public:
+        explicit AggregateTimer(StringRef name) {
+            if (LLVM_UNLIKELY(isTimerRegistryEnabled()))
+                start(name);
+        }
+
+        AggregateTimer(const AggregateTimer &) = delete;
+
+        AggregateTimer &operator=(const AggregateTimer &) = delete;
+
+        ~AggregateTimer() {
+            if (LLVM_UNLIKELY(Node != nullptr))
+                stop();
+        }
+    };
+
+    /// Write the merged call trees of all threads as a table, with each
+    /// timer indented under its parent.
+    ///
+    /// Reports may be written while other threads are timing; timers that
+    /// are still running are not included.
+    void writeTimerReportText(llvm::raw_ostream &os);
+
+    /// Write the merged call trees of all threads as JSON.
+    void writeTimerReportJSON(llvm::raw_ostream &os, bool prettyPrint = true);
+
+    /// Enable the registry and write a text report to stderr when the
+    /// process exits, plus a JSON report to \p jsonPath if it is not empty.
+    void enableTimerReportAtExit(StringRef jsonPath = StringRef());
+
     /// A convenience class for declaring a timer that's part of the Swift
-    /// compilation timers group.
+    /// compilation timers group.  It also records into the timer registry
+    /// when that is enabled.
     class SharedTimer {
         enum class State {
             Initial,
@@ -29,9 +137,10 @@ namespace swift {
         static State CompilationTimersEnabled;
 
         Optional<llvm::NamedRegionTimer> Timer;
+        AggregateTimer Aggregate;
 
     public:
-        explicit SharedTimer(StringRef name) {
+        explicit SharedTimer(StringRef name) : Aggregate(name) {
             if (CompilationTimersEnabled == State::Enabled)
                 // FIXME: Timer.emplace Compatibility constructor removed
                 Timer.emplace(name, name, StringRef("Swift compilation"), StringRef("Swift compilation"));
@@ -48,5 +157,10 @@ namespace swift {
     };
 } // end namespace swift
 
+/// Time the rest of the enclosing scope in the timer registry.
+#define SWIFT_AGGREGATE_TIMER(NAME)                                     \
+  ::swift::AggregateTimer                                               \
+      DEFER_MACRO_CONCAT(SwiftAggregateTimer, __LINE__)(NAME)
+
 
 #endif //SWIFT_TIMER_H
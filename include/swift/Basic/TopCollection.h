@@ -14,8 +14,11 @@
 // given a size limit, keeps the best-scoring (i.e. lowest) N values
 // added to it.
 //
-// The current implementation of this is only suited for small values
-// of maxSize.
+// Small collections keep their entries in a sorted array, which makes
+// each insertion linear in maxSize.  Collections with a maxSize of at
+// least MinHeapMaxSize instead keep their entries in a max-heap, which
+// makes insertion logarithmic, and only sort them when they are iterated
+// over.  Both representations accept and reject exactly the same values.
 //
 //===----------------------------------------------------------------------===//
 
@@ -24,7 +27,9 @@
 
 
 #include "swift/Basic/LLVM.h"
+#include "llvm/ADT/Optional.h"
 #include "llvm/ADT/SmallVector.h"
+#include <utility>
 
 namespace swift {
 
@@ -36,15 +41,59 @@ namespace swift {
             T Value;
         };
 
+        /// Collections with at least this maxSize use the heap representation.
+        enum : unsigned { MinHeapMaxSize = 64 };
+
+        /// The representation to use.  Both behave identically; choosing one
+        /// explicitly is mainly useful for testing.
+        enum class Representation { Automatic, Sorted, Heap };
+
     private:
-        SmallVector<Entry, InlineCapacity> Data;
+        /// In the sorted representation, the entries in order of increasing
+        /// score, with ties in insertion order.  Entries from EndOfAccepted on
+        /// have been rejected; only their scores matter.
+        ///
+        /// In the heap representation, only the accepted entries.  They form
+        /// a max-heap ordered by score and then by insertion, except that
+        /// begin() sorts them in place, after which IsSorted is set until the
+        /// next insertion.
+        mutable SmallVector<Entry, InlineCapacity> Data;
 
         unsigned MaxSize;
         unsigned EndOfAccepted = 0;
+
+        bool UseHeap;
+
+        /// In the heap representation, whether Data is currently sorted
+        /// rather than a heap.
+        mutable bool IsSorted = true;
+
+        /// In the heap representation, the insertion number of each entry of
+        /// Data, which orders entries with equal scores.
+        mutable SmallVector<unsigned, 0> Seqs;
+        unsigned NextSeq = 0;
+
+        /// In the heap representation, the scores of the rejected entries
+        /// the sorted representation would keep after EndOfAccepted, in
+        /// increasing order, starting at RejectedBegin.
+        SmallVector<ScoreType, 0> Rejected;
+        unsigned RejectedBegin = 0;
+
+        /// A score at or beyond which every value is rejected, because a
+        /// collection merged into this one was rejecting them.
+        Optional<ScoreType> RejectionBound;
+
     public:
-        explicit TopCollection(unsigned maxSize) : MaxSize(maxSize) {
+        explicit TopCollection(unsigned maxSize,
+                               Representation representation =
+                                   Representation::Automatic)
+                : MaxSize(maxSize),
+                  UseHeap(representation == Representation::Automatic
+                          ? maxSize >= MinHeapMaxSize
+                          : representation == Representation::Heap) {
             assert(maxSize > 0 && "creating collection with a maximum size of 0?");
             Data.reserve(maxSize);
+            if (UseHeap) Seqs.reserve(maxSize);
         }
 
         // The invariants work fine with these.
@@ -56,15 +105,39 @@ namespace swift {
         TopCollection(TopCollection &&other)
                 : Data(std::move(other.Data)),
                   MaxSize(other.MaxSize),
-                  EndOfAccepted(other.EndOfAccepted) {
+                  EndOfAccepted(other.EndOfAccepted),
+                  UseHeap(other.UseHeap),
+                  IsSorted(other.IsSorted),
+                  Seqs(std::move(other.Seqs)),
+                  NextSeq(other.NextSeq),
+                  Rejected(std::move(other.Rejected)),
+                  RejectedBegin(other.RejectedBegin),
+                  RejectionBound(other.RejectionBound) {
             other.EndOfAccepted = 0;
+            other.Data.clear();
+            other.Seqs.clear();
+            other.Rejected.clear();
+            other.RejectedBegin = 0;
+            other.RejectionBound = None;
         }
 
         TopCollection &operator=(TopCollection &&other) {
             Data = std::move(other.Data);
             MaxSize = other.MaxSize;
             EndOfAccepted = other.EndOfAccepted;
+            UseHeap = other.UseHeap;
+            IsSorted = other.IsSorted;
+            Seqs = std::move(other.Seqs);
+            NextSeq = other.NextSeq;
+            Rejected = std::move(other.Rejected);
+            RejectedBegin = other.RejectedBegin;
+            RejectionBound = other.RejectionBound;
             other.EndOfAccepted = 0;
+            other.Data.clear();
+            other.Seqs.clear();
+            other.Rejected.clear();
+            other.RejectedBegin = 0;
+            other.RejectionBound = None;
             return *this;
         }
 
@@ -80,16 +153,38 @@ namespace swift {
 
         using iterator = const Entry *;
 
-        iterator begin() const { return Data.begin(); }
+        /// Return the first entry, in order of increasing score.  In the heap
+        /// representation, this sorts the entries if they were inserted into
+        /// since the last call, so it is not safe to call concurrently.
+        iterator begin() const {
+            if (UseHeap && !IsSorted) sortHeap();
+            return Data.begin();
+        }
 
         iterator end() const { return Data.begin() + EndOfAccepted; }
 
         /// Return a score beyond which scores are uninteresting.  Inserting
         /// a value with this score will never change the collection.
         ScoreType getMinUninterestingScore(ScoreType defaultBound) const {
+            ScoreType bound = getMinUninterestingScoreIgnoringMerges(defaultBound);
+            if (RejectionBound && *RejectionBound < bound)
+                return *RejectionBound;
+            return bound;
+        }
+
+    private:
+        ScoreType getMinUninterestingScoreIgnoringMerges(ScoreType defaultBound) const {
             assert(EndOfAccepted <= MaxSize);
             assert(EndOfAccepted <= Data.size());
 
+            if (UseHeap) {
+                if (EndOfAccepted == MaxSize)
+                    return getMaxHeapScore() + 1;
+                if (RejectedBegin != Rejected.size())
+                    return Rejected[RejectedBegin];
+                return defaultBound;
+            }
+
             // If we've accepted as many values as we can, then all scores up (and
             // including) that value are interesting.
             if (EndOfAccepted == MaxSize)
@@ -104,6 +199,7 @@ namespace swift {
             return defaultBound;
         }
 
+    public:
         /// Try to add a scored value to the collection.
         ///
         /// \return true if the insertion was successful
@@ -111,6 +207,12 @@ namespace swift {
             assert(EndOfAccepted <= MaxSize);
             assert(EndOfAccepted <= Data.size());
 
+            if (RejectionBound && !(score < *RejectionBound))
+                return false;
+
+            if (UseHeap)
+                return insertIntoHeap(score, std::move(value));
+
             // Find the index of the last entry whose score is larger than 'score'.
             auto i = EndOfAccepted;
             while (i != 0 && score < Data[i - 1].Score)
@@ -182,13 +284,217 @@ namespace swift {
         template<class Range>
         void filterMaxScoreRange(Range difference) {
             if (EndOfAccepted < 2) return;
+            if (UseHeap && !IsSorted) sortHeap();
             for (unsigned i = 1; i != EndOfAccepted; ++i) {
                 if (Data[i].Score > Data[0].Score + difference) {
+                    if (UseHeap) rejectSortedSuffix(i);
+                    EndOfAccepted = i;
+                    return;
+                }
+            }
+
+        }
+
+        /// Add the values accepted by another collection to this one, as if
+        /// they were inserted in order of increasing score.  Any score the
+        /// other collection was rejecting, because of a tie at its limit or
+        /// because of filterMaxScoreRange, is rejected by this one from now
+        /// on as well.
+        void merge(const TopCollection &other) {
+            assert(&other != this && "merging a collection into itself");
+            for (const Entry &entry : other)
+                insert(entry.Score, T(entry.Value));
+            mergeRejectionBound(other);
+        }
+
+        void merge(TopCollection &&other) {
+            assert(&other != this && "merging a collection into itself");
+            other.begin();
+            for (unsigned i = 0; i != other.EndOfAccepted; ++i)
+                insert(other.Data[i].Score, std::move(other.Data[i].Value));
+            mergeRejectionBound(other);
+            other = TopCollection(other.MaxSize,
+                                  other.UseHeap ? Representation::Heap
+                                                : Representation::Sorted);
+        }
+
+    private:
+        /// Return the lowest score this collection is rejecting because of
+        /// an earlier tie or filter, if any.
+        Optional<ScoreType> getMinRejectedScore() const {
+            if (UseHeap) {
+                if (RejectedBegin != Rejected.size())
+                    return Rejected[RejectedBegin];
+            } else if (EndOfAccepted != Data.size()) {
+                return Data[EndOfAccepted].Score;
+            }
+            return None;
+        }
+
+        /// Reject every score at or beyond the lowest one the given
+        /// collection rejects.
+        void mergeRejectionBound(const TopCollection &other) {
+            Optional<ScoreType> bound = other.RejectionBound;
+            if (auto rejected = other.getMinRejectedScore())
+                if (!bound || *rejected < *bound)
+                    bound = rejected;
+            if (!bound) return;
+            if (RejectionBound && !(*bound < *RejectionBound)) return;
+            RejectionBound = bound;
+
+            // Reject any accepted values at or beyond the new bound.
+            if (UseHeap && !IsSorted) sortHeap();
+            for (unsigned i = 0; i != EndOfAccepted; ++i) {
+                if (!(Data[i].Score < *bound)) {
+                    if (UseHeap) rejectSortedSuffix(i);
                     EndOfAccepted = i;
                     return;
                 }
             }
+        }
+
+        /// Is the entry at index i ordered before the entry at index j in the
+        /// heap representation?
+        bool precedesInHeap(size_t i, size_t j) const {
+            if (Data[i].Score < Data[j].Score) return true;
+            if (Data[j].Score < Data[i].Score) return false;
+            return Seqs[i] < Seqs[j];
+        }
+
+        void swapHeapEntries(size_t i, size_t j) const {
+            std::swap(Data[i], Data[j]);
+            std::swap(Seqs[i], Seqs[j]);
+        }
+
+        void siftUp(size_t i) const {
+            while (i != 0) {
+                size_t parent = (i - 1) / 2;
+                if (!precedesInHeap(parent, i)) break;
+                swapHeapEntries(parent, i);
+                i = parent;
+            }
+        }
+
+        void siftDown(size_t i, size_t size) const {
+            while (true) {
+                size_t largest = i;
+                size_t left = 2 * i + 1, right = left + 1;
+                if (left < size && precedesInHeap(largest, left)) largest = left;
+                if (right < size && precedesInHeap(largest, right)) largest = right;
+                if (largest == i) return;
+                swapHeapEntries(i, largest);
+                i = largest;
+            }
+        }
+
+        /// Sort the heap in place into order of increasing score.
+        void sortHeap() const {
+            assert(UseHeap && !IsSorted);
+            for (size_t end = Data.size(); end > 1; --end) {
+                swapHeapEntries(0, end - 1);
+                siftDown(0, end - 1);
+            }
+            IsSorted = true;
+        }
+
+        /// Turn sorted entries back into a heap before modifying them.
+        void ensureHeap() {
+            assert(UseHeap);
+            if (!IsSorted) return;
+            for (size_t i = Data.size() / 2; i != 0; --i)
+                siftDown(i - 1, Data.size());
+            IsSorted = false;
+        }
+
+        ScoreType getMaxHeapScore() const {
+            assert(UseHeap && !Data.empty());
+            return IsSorted ? Data.back().Score : Data.front().Score;
+        }
+
+        /// Remove the highest-scoring entry from the heap.
+        void popHeap() {
+            assert(!IsSorted);
+            swapHeapEntries(0, Data.size() - 1);
+            Data.pop_back();
+            Seqs.pop_back();
+            siftDown(0, Data.size());
+        }
+
+        /// Reject the sorted entries from the given index on, in front of
+        /// any entries that have already been rejected.
+        void rejectSortedSuffix(unsigned begin) {
+            assert(UseHeap && IsSorted);
+            SmallVector<ScoreType, 0> rejected;
+            rejected.reserve(Data.size() - begin + Rejected.size() - RejectedBegin);
+            for (unsigned i = begin, e = Data.size(); i != e; ++i)
+                rejected.push_back(Data[i].Score);
+            rejected.append(Rejected.begin() + RejectedBegin, Rejected.end());
+            Rejected = std::move(rejected);
+            RejectedBegin = 0;
+            Data.erase(Data.begin() + begin, Data.end());
+            Seqs.erase(Seqs.begin() + begin, Seqs.end());
+        }
 
+        /// The heap version of insert, which mirrors each decision the
+        /// sorted version makes.
+        bool insertIntoHeap(ScoreType score, T &&value) {
+            assert(EndOfAccepted == Data.size());
+            ensureHeap();
+
+            size_t numRejected = Rejected.size() - RejectedBegin;
+
+            // Whether the new entry would go after every accepted entry.
+            bool atEnd = Data.empty() || !(score < Data.front().Score);
+            if (atEnd) {
+                // If there's a tie with the highest accepted tier and no space
+                // to expand it, reject the whole tier.
+                if (!Data.empty() && score == Data.front().Score) {
+                    if (EndOfAccepted == MaxSize) {
+                        assert(numRejected == 0);
+                        Rejected.clear();
+                        RejectedBegin = 0;
+                        while (!Data.empty() && Data.front().Score == score) {
+                            popHeap();
+                            Rejected.push_back(score);
+                        }
+                        EndOfAccepted = Data.size();
+                        return false;
+                    }
+                } else {
+                    // Don't insert if there's no room.
+                    if (EndOfAccepted == MaxSize)
+                        return false;
+
+                    // Don't insert if we're at least as high as things we've
+                    // previously rejected.
+                    if (numRejected && !(score < Rejected[RejectedBegin]))
+                        return false;
+                }
+            }
+
+            // Make room the way the sorted version does: overwrite the
+            // lowest rejected entry when appending, or else drop the highest
+            // entry, rejected or accepted, when full.
+            if (atEnd && numRejected) {
+                RejectedBegin++;
+            } else if (EndOfAccepted + numRejected == MaxSize) {
+                if (numRejected)
+                    Rejected.pop_back();
+                else
+                    popHeap();
+            }
+            if (RejectedBegin == Rejected.size()) {
+                Rejected.clear();
+                RejectedBegin = 0;
+            }
+
+            Data.push_back({score, std::move(value)});
+            Seqs.push_back(NextSeq++);
+            siftUp(Data.size() - 1);
+
+            EndOfAccepted = Data.size();
+            assert(EndOfAccepted <= MaxSize);
+            return true;
         }
     };
 
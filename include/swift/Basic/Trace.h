@@ -0,0 +1,145 @@
+//===--- Trace.h - Scoped event tracing -------------------------*- C++ -*-===//
+//
+// This source file is part of the Swift.org open source project
+//
+// Copyright (c) 2014 - 2017 Apple Inc. and the Swift project authors
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// See https://swift.org/LICENSE.txt for license information
+// See https://swift.org/CONTRIBUTORS.txt for the list of Swift project authors
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file defines a lightweight tracing facility for hot paths.
+//
+//  Unlike SharedTimer and SWIFT_FUNC_STAT, which aggregate, tracing records
+//  individual events: the beginning and end of a scope, and samples of a
+//  named counter.  Each thread appends its events to its own fixed-size ring
+//  buffer without locking, so a long trace keeps only the most recent
+//  events.  The buffers can be exported in the Chrome trace-event format,
+//  which chrome://tracing and Perfetto display as a timeline.
+//
+//  When tracing is disabled, each trace point costs a single relaxed load
+//  and a predictable branch.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef SWIFT_TRACE_H
+#define SWIFT_TRACE_H
+
+#include "swift/Basic/Defer.h"
+#include "swift/Basic/LLVM.h"
+#include "llvm/Support/Compiler.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace llvm {
+    class raw_ostream;
+}
+
+namespace swift {
+
+    /// The kinds of events in a trace.
+    enum class TraceEventKind : uint8_t {
+        /// The start of a TraceScope.
+        Begin,
+
+        /// The end of a TraceScope.
+        End,
+
+        /// A sample of a counter.
+        Counter
+    };
+
+    /// A single recorded event.
+    struct TraceEvent {
+        /// Nanoseconds since an arbitrary, fixed point in time.
+        uint64_t Timestamp;
+
+        /// The name of the scope or counter.  Events only store the pointer,
+        /// so names must have static storage duration.
+        const char *Name;
+
+        /// The counter value; unused for other kinds.
+        int64_t Value;
+
+        TraceEventKind Kind;
+    };
+
+    namespace detail {
+        extern std::atomic<bool> TracingEnabled;
+
+        /// Append an event to the current thread's buffer.
+        void recordTraceEvent(TraceEventKind kind, const char *name,
+                              int64_t value);
+    } // end namespace detail
+
+    /// Is tracing currently enabled?
+    inline bool isTracingEnabled() {
+        return detail::TracingEnabled.load(std::memory_order_relaxed);
+    }
+
+    /// Start or stop recording events.  Scopes that are already open when
+    /// tracing is disabled still record their end.
+    void setTracingEnabled(bool enabled);
+
+    /// Set the number of events each thread's ring buffer holds, rounded up
+    /// to a power of two.  Only buffers created afterwards are affected.
+    void setTraceBufferCapacity(size_t numEvents);
+
+    /// Return the current time in nanoseconds, on the clock used to
+    /// timestamp events.
+    uint64_t getTraceTimestamp();
+
+    /// Record a sample of the counter \p name.
+    inline void traceCounter(const char *name, int64_t value) {
+        if (LLVM_UNLIKELY(isTracingEnabled()))
+            detail::recordTraceEvent(TraceEventKind::Counter, name, value);
+    }
+
+    /// An RAII object that records an event when it is constructed and
+    /// another when it is destroyed, if tracing was enabled at construction.
+    ///
+    /// Scopes nest: the scopes open on a thread at any point form a stack.
+    class TraceScope {
+        const char *Name;
+        bool Active;
+
+    public:
+        explicit TraceScope(const char *name)
+                : Name(name), Active(isTracingEnabled()) {
+            if (LLVM_UNLIKELY(Active))
+                detail::recordTraceEvent(TraceEventKind::Begin, Name, 0);
+        }
+
+        TraceScope(const TraceScope &) = delete;
+
+        TraceScope &operator=(const TraceScope &) = delete;
+
+        ~TraceScope() {
+            if (LLVM_UNLIKELY(Active))
+                detail::recordTraceEvent(TraceEventKind::End, Name, 0);
+        }
+    };
+
+    /// Write the events recorded by every thread as a Chrome trace-event
+    /// JSON object.  Events whose scope began before the oldest retained
+    /// event are dropped.
+    ///
+    /// No thread may be recording events: tracing must be disabled, and
+    /// every TraceScope opened while it was enabled must have ended.
+    void writeChromeTrace(llvm::raw_ostream &os, bool prettyPrint = false);
+
+    /// Discard all recorded events, and the buffers of threads that have
+    /// exited.  As with writeChromeTrace, no thread may be recording events.
+    void clearTraceBuffers();
+
+} // end namespace swift
+
+/// Trace the rest of the enclosing scope under the given name, which must
+/// be a string literal.
+#define SWIFT_TRACE_SCOPE(NAME)                                         \
+  ::swift::TraceScope DEFER_MACRO_CONCAT(SwiftTraceScope, __LINE__)(NAME)
+
+#endif //SWIFT_TRACE_H
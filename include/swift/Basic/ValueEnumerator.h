@@ -14,12 +14,21 @@
 #define SWIFT_VALUEENUMERATOR_H
 
 
+#include "swift/Basic/LLVM.h"
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/Support/raw_ostream.h"
 
 namespace swift {
 
 /// / This class maps values to unique indices.
+///
+/// Indices start at 1.  The enumerator also keeps the inverse mapping, so
+/// getValue() is a vector lookup.  By default, the index of an invalidated
+/// value is never handed out again; an enumerator constructed with
+/// \p RecycleIndices reuses such indices for new values instead, which keeps
+/// the index space (and anything the client indexes by it) dense.
     template<class ValueTy, class IndexTy = size_t>
     class ValueEnumerator {
         /// A running counter to enumerate values.
@@ -28,28 +37,81 @@ namespace swift {
         /// Maps values to unique integers.
         llvm::DenseMap<ValueTy, IndexTy> ValueToIndex;
 
+        /// Maps index - 1 back to its value, or None if it was invalidated.
+        llvm::SmallVector<Optional<ValueTy>, 0> IndexToValue;
+
+        /// Invalidated indices available for reuse, if recycling is enabled.
+        llvm::SmallVector<IndexTy, 0> FreeIndices;
+
+        bool RecycleIndices = false;
+
     public:
         /// Return the index of value \p v.
         IndexTy getIndex(const ValueTy &v) {
             // Return the index of this Key, if we've assigned one already.
-            auto It = ValueToIndex.find(v);
-            if (It != ValueToIndex.end()) {
-                return It->second;
+            auto Pair = ValueToIndex.try_emplace(v, IndexTy());
+            if (!Pair.second) {
+                return Pair.first->second;
             }
 
-            // Generate a new counter for the key.
-            ValueToIndex[v] = ++counter;
-            return counter;
+            // Reuse an invalidated index or generate a new counter for the key.
+            IndexTy Index;
+            if (!FreeIndices.empty()) {
+                Index = FreeIndices.pop_back_val();
+                IndexToValue[Index - 1] = v;
+            } else {
+                Index = ++counter;
+                IndexToValue.push_back(v);
+            }
+            Pair.first->second = Index;
+            return Index;
+        }
+
+        /// Return the index of value \p v, or None if it has none.
+        Optional<IndexTy> lookupIndex(const ValueTy &v) const {
+            auto It = ValueToIndex.find(v);
+            if (It == ValueToIndex.end())
+                return None;
+            return It->second;
+        }
+
+        /// Return the value with index \p Index, or None if that index was
+        /// never assigned or its value was invalidated.
+        Optional<ValueTy> getValue(IndexTy Index) const {
+            if (Index == 0 || Index > IndexToValue.size())
+                return None;
+            return IndexToValue[Index - 1];
         }
 
         ValueEnumerator() = default;
 
+        explicit ValueEnumerator(bool RecycleIndices)
+                : RecycleIndices(RecycleIndices) {}
+
         /// Forget about key \p v.
-        void invalidateValue(const ValueTy &v) { ValueToIndex.erase(v); }
+        void invalidateValue(const ValueTy &v) {
+            auto It = ValueToIndex.find(v);
+            if (It == ValueToIndex.end())
+                return;
+            IndexTy Index = It->second;
+            ValueToIndex.erase(It);
+            IndexToValue[Index - 1] = None;
+            if (RecycleIndices)
+                FreeIndices.push_back(Index);
+        }
+
+        /// Return the number of values that currently have an index.
+        size_t size() const { return ValueToIndex.size(); }
+
+        /// Return the largest index assigned so far.  Every index is in the
+        /// range [1, getMaxIndex()].
+        IndexTy getMaxIndex() const { return counter; }
 
         /// Clear the enumeration state of the
         void clear() {
             ValueToIndex.clear();
+            IndexToValue.clear();
+            FreeIndices.clear();
             counter = 0;
         }
     };
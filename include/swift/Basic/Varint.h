@@ -20,15 +20,38 @@
 #define SWIFT_VARINT_H
 
 
+#include <cstring>
 #include <numeric>
+#include <system_error>
 #include <type_traits>
 
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/ErrorOr.h"
+#include "llvm/Support/MathExtras.h"
 
 
 namespace swift {
     namespace Varint {
 
+        /// Map a signed integer onto an unsigned one so that values of small
+        /// magnitude have short encodings.  Negative numbers are encoded as
+        /// unsigned odd numbers in the unsigned type, positive numbers are
+        /// even.
+        template<typename T>
+        typename std::make_unsigned<T>::type zigZagEncode(T i) {
+            using UnsignedT = typename std::make_unsigned<T>::type;
+            return UnsignedT(UnsignedT(i) << 1) ^
+                   UnsignedT(i < 0 ? ~UnsignedT(0) : UnsignedT(0));
+        }
+
+        /// Invert zigZagEncode.
+        template<typename T>
+        T zigZagDecode(typename std::make_unsigned<T>::type z) {
+            return T((z >> 1) ^ (~(z & 1) + 1));
+        }
+
         /// Encode an unsigned integral type to a variable length 7-bit-encoded sequence
         /// of bytes.
         template<typename T>
@@ -71,7 +94,7 @@ namespace swift {
             //  1 -> 2
             //  2 -> 4
             //  3 -> 6
-            typename std::make_unsigned<T>::type z = i < 0 ? ~(i << 1) : (i << 1);
+            auto z = zigZagEncode(i);
             return encode<decltype(z)>(z);
         }
 
@@ -104,7 +127,195 @@ namespace swift {
         decode(const uint8_t *bytes) {
             auto decoded = decode<typename std::make_unsigned<T>::type>(bytes);
             // Zig-zag decode back into the signed integer type.
-            return decoded & 1 ? ~(decoded >> 1) : (decoded >> 1);
+            return zigZagDecode<T>(decoded);
+        }
+
+        /// Return the maximum number of bytes needed to encode a value of type
+        /// \p T.
+        template<typename T>
+        constexpr size_t getMaxEncodedSize() {
+            return (sizeof(T) * 8 + 6) / 7;
+        }
+
+        /// Return the number of bytes needed to encode the unsigned value \p i.
+        template<typename T>
+        typename std::enable_if<
+                std::is_integral<T>::value && std::is_unsigned<T>::value, size_t
+        >::type
+        getEncodedSize(T i) {
+            unsigned bits = sizeof(T) * 8 - llvm::countLeadingZeros(T(i | 1));
+            return (bits + 6) / 7;
+        }
+
+        /// Return the number of bytes needed to encode the signed value \p i.
+        template<typename T>
+        typename std::enable_if<
+                std::is_integral<T>::value && std::is_signed<T>::value, size_t
+        >::type
+        getEncodedSize(T i) {
+            return getEncodedSize(zigZagEncode(i));
+        }
+
+        /// Return the number of bytes needed to encode all of \p values.
+        template<typename T>
+        size_t getEncodedSize(llvm::ArrayRef<T> values) {
+            size_t size = 0;
+            for (T value : values)
+                size += getEncodedSize(value);
+            return size;
+        }
+
+        /// Encode the unsigned value \p i into the buffer at \p out, which must
+        /// have room for getEncodedSize(i) bytes.  Returns the end of the
+        /// encoding.
+        template<typename T>
+        typename std::enable_if<
+                std::is_integral<T>::value && std::is_unsigned<T>::value,
+                uint8_t *
+        >::type
+        encodeTo(uint8_t *out, T i) {
+            while (i >= 0x80) {
+                *out++ = uint8_t(i) | 0x80;
+                i >>= 7;
+            }
+            *out++ = uint8_t(i);
+            return out;
+        }
+
+        /// Encode the signed value \p i into the buffer at \p out, which must
+        /// have room for getEncodedSize(i) bytes.  Returns the end of the
+        /// encoding.
+        template<typename T>
+        typename std::enable_if<
+                std::is_integral<T>::value && std::is_signed<T>::value,
+                uint8_t *
+        >::type
+        encodeTo(uint8_t *out, T i) {
+            return encodeTo(out, zigZagEncode(i));
+        }
+
+        /// Encode every element of \p values into the buffer at \p out, which
+        /// must have room for getEncodedSize(values) bytes.  Signed values are
+        /// zig-zag encoded.  Returns the end of the encoding.
+        template<typename T>
+        uint8_t *encodeArray(llvm::ArrayRef<T> values, uint8_t *out) {
+            for (T value : values)
+                out = encodeTo(out, value);
+            return out;
+        }
+
+        /// Append the encoding of every element of \p values to \p out.
+        template<typename T>
+        void encodeArray(llvm::ArrayRef<T> values,
+                         llvm::SmallVectorImpl<uint8_t> &out) {
+            size_t oldSize = out.size();
+            out.resize(oldSize + values.size() * getMaxEncodedSize<T>());
+            uint8_t *end = encodeArray(values, out.data() + oldSize);
+            out.truncate(end - out.data());
+        }
+
+        namespace detail {
+            /// Decode a value from the eight bytes at \p bytes, all of which
+            /// must be readable.  Returns the length of the encoding, or 0 if
+            /// it is longer than eight bytes.
+            ///
+            /// This is the word-at-a-time analogue of the masked-VByte
+            /// decoder: the terminating byte is found from the continuation
+            /// bits, and the 7-bit groups are packed together in three
+            /// shift-and-mask steps, with no per-byte branches.
+            inline unsigned decodeWord(const uint8_t *bytes, uint64_t &value) {
+                uint64_t word = llvm::support::endian::read64le(bytes);
+                uint64_t stops = ~word & 0x8080808080808080ULL;
+                if (!stops)
+                    return 0;
+                unsigned length = llvm::countTrailingZeros(stops) / 8 + 1;
+
+                uint64_t w = word & 0x7F7F7F7F7F7F7F7FULL;
+                if (length < 8)
+                    w &= (uint64_t(1) << (length * 8)) - 1;
+                w = (w & 0x007F007F007F007FULL) |
+                    ((w & 0x7F007F007F007F00ULL) >> 1);
+                w = (w & 0x00003FFF00003FFFULL) |
+                    ((w & 0x3FFF00003FFF0000ULL) >> 2);
+                w = (w & 0x000000000FFFFFFFULL) |
+                    ((w & 0x0FFFFFFF00000000ULL) >> 4);
+                value = w;
+                return length;
+            }
+
+            /// Decode a value of type \p T from the bytes in [bytes, end),
+            /// one byte at a time.  Returns the end of the encoding, or null
+            /// if it is truncated or doesn't fit in \p T.
+            template<typename T>
+            const uint8_t *decodeChecked(const uint8_t *bytes,
+                                         const uint8_t *end, T &value) {
+                T decoded = 0;
+                for (unsigned shift = 0; bytes != end; shift += 7) {
+                    uint8_t b = *bytes++;
+                    T payload = T(b & 0x7F);
+                    if (shift >= sizeof(T) * 8 ||
+                        (shift && (payload >> (sizeof(T) * 8 - shift))))
+                        return nullptr;
+                    decoded |= payload << shift;
+                    if (!(b & 0x80)) {
+                        value = decoded;
+                        return bytes;
+                    }
+                }
+                return nullptr;
+            }
+
+            template<typename T, bool Checked>
+            const uint8_t *decodeArrayImpl(const uint8_t *bytes,
+                                           const uint8_t *end,
+                                           llvm::MutableArrayRef<T> out) {
+                using UnsignedT = typename std::make_unsigned<T>::type;
+                for (T &result : out) {
+                    UnsignedT decoded;
+                    uint64_t word;
+                    unsigned length;
+                    if (end - bytes >= 8 &&
+                        (length = decodeWord(bytes, word)) != 0 &&
+                        (!Checked || (length <= getMaxEncodedSize<T>() &&
+                                      !(word >> (sizeof(T) * 8 - 1) >> 1)))) {
+                        decoded = UnsignedT(word);
+                        bytes += length;
+                    } else {
+                        bytes = decodeChecked(bytes, end, decoded);
+                        if (!bytes) {
+                            assert(Checked && "malformed varint");
+                            return nullptr;
+                        }
+                    }
+                    if (std::is_signed<T>::value)
+                        result = zigZagDecode<T>(decoded);
+                    else
+                        result = T(decoded);
+                }
+                return bytes;
+            }
+        } // end namespace detail
+
+        /// Decode \p out.size() values from the trusted buffer [bytes, end).
+        /// Signed values are zig-zag decoded.  Returns the end of the last
+        /// encoding.
+        template<typename T>
+        const uint8_t *decodeArray(const uint8_t *bytes, const uint8_t *end,
+                                   llvm::MutableArrayRef<T> out) {
+            return detail::decodeArrayImpl<T, false>(bytes, end, out);
+        }
+
+        /// Decode \p out.size() values from the untrusted buffer [bytes, end),
+        /// never reading outside of it.  Returns the end of the last encoding,
+        /// or an error if the input is truncated or an encoded value doesn't
+        /// fit in \p T.
+        template<typename T>
+        llvm::ErrorOr<const uint8_t *>
+        decodeArrayChecked(const uint8_t *bytes, const uint8_t *end,
+                           llvm::MutableArrayRef<T> out) {
+            if (auto result = detail::decodeArrayImpl<T, true>(bytes, end, out))
+                return result;
+            return std::make_error_code(std::errc::illegal_byte_sequence);
         }
 
     } // end namespace Varint
@@ -0,0 +1,48 @@
+//===--- ArenaTreeScopedHashTable.cpp - Slabs for tree-scoped tables ------===//
+//
+// This source file is part of the Swift.org open source project
+//
+// Copyright (c) 2014 - 2017 Apple Inc. and the Swift project authors
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// See https://swift.org/LICENSE.txt for license information
+// See https://swift.org/CONTRIBUTORS.txt for the list of Swift project authors
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file implements the slab pool shared by the scopes of an
+//  ArenaTreeScopedHashTable.
+//
+//===----------------------------------------------------------------------===//
+
+#include "swift/Basic/ArenaTreeScopedHashTable.h"
+
+using namespace swift;
+
+ScopedHashTableSlabPool::Slab *
+ScopedHashTableSlabPool::allocateImpl(unsigned minSizeClass,
+                                      size_t minUsableBytes) {
+    unsigned sizeClass = minSizeClass;
+    while (getSlabSize(sizeClass) - sizeof(Slab) < minUsableBytes)
+        sizeClass++;
+    assert(sizeClass < NumSizeClasses && "slab request too large");
+
+    if (Slab *slab = FreeSlabs[sizeClass]) {
+        FreeSlabs[sizeClass] = slab->Prev;
+        return slab;
+    }
+
+    auto slab = static_cast<Slab *>(
+            Arena.Allocate(getSlabSize(sizeClass), alignof(std::max_align_t)));
+    slab->SizeClass = sizeClass;
+    return slab;
+}
+
+void ScopedHashTableSlabPool::deallocateChainImpl(Slab *last) {
+    while (last) {
+        Slab *prev = last->Prev;
+        last->Prev = FreeSlabs[last->SizeClass];
+        FreeSlabs[last->SizeClass] = last;
+        last = prev;
+    }
+}
@@ -11,6 +11,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "swift/Basic/Cache.h"
+#include "swift/Basic/Trace.h"
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/Support/Mutex.h"
 
@@ -69,6 +70,7 @@ CacheImpl::ImplTy CacheImpl::create(StringRef Name, const CallBacks &CBs) {
 }
 
 void CacheImpl::setAndRetain(void *Key, void *Value, size_t Cost) {
+    SWIFT_TRACE_SCOPE("Cache::setAndRetain");
     DefaultCache &DCache = *static_cast<DefaultCache *>(Impl);
     llvm::sys::ScopedLock L(DCache.Mux);
 
@@ -81,12 +83,14 @@ void CacheImpl::setAndRetain(void *Key, void *Value, size_t Cost) {
     }
 
     DCache.Entries[CKey] = Value;
+    traceCounter("Cache entries", DCache.Entries.size());
 
     // FIXME: Not thread-safe! It should avoid deleting the value until
     // 'releaseValue is called on it.
 }
 
 bool CacheImpl::getAndRetain(const void *Key, void **Value_out) {
+    SWIFT_TRACE_SCOPE("Cache::getAndRetain");
     DefaultCache &DCache = *static_cast<DefaultCache *>(Impl);
     llvm::sys::ScopedLock L(DCache.Mux);
 
@@ -106,6 +110,7 @@ void CacheImpl::releaseValue(void *Value) {
 }
 
 bool CacheImpl::remove(const void *Key) {
+    SWIFT_TRACE_SCOPE("Cache::remove");
     DefaultCache &DCache = *static_cast<DefaultCache *>(Impl);
     llvm::sys::ScopedLock L(DCache.Mux);
 
@@ -115,6 +120,7 @@ bool CacheImpl::remove(const void *Key) {
         DCache.CBs.keyDestroyCB(Entry->first.Key, nullptr);
         DCache.CBs.valueDestroyCB(Entry->second, nullptr);
         DCache.Entries.erase(Entry);
+        traceCounter("Cache entries", DCache.Entries.size());
         return true;
     }
     return false;
@@ -129,6 +135,7 @@ void CacheImpl::removeAll() {
         DCache.CBs.valueDestroyCB(Entry.second, nullptr);
     }
     DCache.Entries.clear();
+    traceCounter("Cache entries", 0);
 }
 
 void CacheImpl::destroy() {
@@ -37,6 +37,14 @@ ClusteredBitVector ClusteredBitVector::fromAPInt(const llvm::APInt &bits) {
 llvm::APInt ClusteredBitVector::asAPInt() const {
     if (isInlineAndAllClear()) {
         return llvm::APInt(size(), 0);
+    } else if (isRunLengthEncoded()) {
+        llvm::APInt result(size(), 0);
+        size_t begin = 0;
+        forEachRun([&](bool value, size_t numBits) {
+            if (value) result.setBits(begin, begin + numBits);
+            begin += numBits;
+        });
+        return result;
     } else {
         // This assumes that the chunk size is the same as APInt's.
         // TODO: it'd be nice to be able to do this without copying.
@@ -45,6 +53,8 @@ llvm::APInt ClusteredBitVector::asAPInt() const {
 }
 
 void ClusteredBitVector::reallocate(size_t newCapacityInChunks) {
+    assert(!isRunLengthEncoded());
+
     // If we already have out-of-line storage, the padding invariants
     // will still apply, and we just need to copy the old data into
     // the new allocation.
@@ -172,12 +182,258 @@ void ClusteredBitVector::appendReserved(size_t numBits,
     });
 }
 
+/// Build the normalized runs of a vector of the given length whose bits
+/// are set exactly in [begin, end).
+static void getRangeRuns(size_t begin, size_t end, size_t length,
+                         SmallVectorImpl<size_t> &runEnds) {
+    runEnds.clear();
+    runEnds.push_back(begin);
+    if (begin != end) runEnds.push_back(end);
+    if (end != length) runEnds.push_back(length);
+}
+
+void ClusteredBitVector::setRange(size_t begin, size_t end) {
+    assert(begin <= end && end <= size());
+    if (begin == end) return;
+    if (isInlineAndAllClear()) {
+        materialize();
+    }
+    if (isRunLengthEncoded()) {
+        SmallVector<size_t, 4> mask;
+        getRangeRuns(begin, end, size(), mask);
+        ClusteredBitVector maskVector;
+        maskVector.LengthInBits = size();
+        maskVector.setRuns(mask);
+        combineRunLength(maskVector, BitwiseOp::Or);
+        return;
+    }
+
+    forEachChunkInRange(getChunksPtr(), begin, end,
+                        [](ChunkType &chunk, ChunkType mask) { chunk |= mask; },
+                        [](ChunkType *chunks, size_t numChunks) {
+                            std::fill_n(chunks, numChunks, ~ChunkType(0));
+                        });
+}
+
+void ClusteredBitVector::clearRange(size_t begin, size_t end) {
+    assert(begin <= end && end <= size());
+    if (begin == end || isInlineAndAllClear()) return;
+    if (isRunLengthEncoded()) {
+        SmallVector<size_t, 4> mask;
+        getRangeRuns(begin, end, size(), mask);
+        ClusteredBitVector maskVector;
+        maskVector.LengthInBits = size();
+        maskVector.setRuns(mask);
+        combineRunLength(maskVector, BitwiseOp::AndNot);
+        return;
+    }
+
+    forEachChunkInRange(getChunksPtr(), begin, end,
+                        [](ChunkType &chunk, ChunkType mask) { chunk &= ~mask; },
+                        [](ChunkType *chunks, size_t numChunks) {
+                            std::fill_n(chunks, numChunks, ChunkType(0));
+                        });
+}
+
+void ClusteredBitVector::flipRange(size_t begin, size_t end) {
+    assert(begin <= end && end <= size());
+    if (begin == end) return;
+    if (isInlineAndAllClear()) {
+        materialize();
+    }
+    if (isRunLengthEncoded()) {
+        SmallVector<size_t, 4> mask;
+        getRangeRuns(begin, end, size(), mask);
+        ClusteredBitVector maskVector;
+        maskVector.LengthInBits = size();
+        maskVector.setRuns(mask);
+        combineRunLength(maskVector, BitwiseOp::Xor);
+        return;
+    }
+
+    forEachChunkInRange(getChunksPtr(), begin, end,
+                        [](ChunkType &chunk, ChunkType mask) { chunk ^= mask; },
+                        [](ChunkType *chunks, size_t numChunks) {
+                            for (size_t i = 0; i != numChunks; ++i)
+                                chunks[i] = ~chunks[i];
+                        });
+}
+
+/// Return the index of the run containing bit i.
+static size_t findRun(ArrayRef<size_t> runEnds, size_t i) {
+    return std::upper_bound(runEnds.begin(), runEnds.end(), i) - runEnds.begin();
+}
+
+bool ClusteredBitVector::anyInRange(size_t begin, size_t end) const {
+    assert(begin <= end && end <= size());
+    if (begin == end || isInlineAndAllClear()) return false;
+    if (isRunLengthEncoded()) {
+        // Either 'begin' is in a set run, or the next run is set and starts
+        // within the range.
+        auto runEnds = getRunEnds();
+        size_t run = findRun(runEnds, begin);
+        return (run & 1) || runEnds[run] < end;
+    }
+
+    // Accumulate without early exits so that the loop over whole chunks
+    // can be vectorized.
+    ChunkType result = 0;
+    forEachChunkInRange(getChunksPtr(), begin, end,
+                        [&](ChunkType chunk, ChunkType mask) {
+                            result |= chunk & mask;
+                        },
+                        [&](const ChunkType *chunks, size_t numChunks) {
+                            for (size_t i = 0; i != numChunks; ++i)
+                                result |= chunks[i];
+                        });
+    return result != 0;
+}
+
+bool ClusteredBitVector::allInRange(size_t begin, size_t end) const {
+    assert(begin <= end && end <= size());
+    if (begin == end) return true;
+    if (isInlineAndAllClear()) return false;
+    if (isRunLengthEncoded()) {
+        auto runEnds = getRunEnds();
+        size_t run = findRun(runEnds, begin);
+        return (run & 1) && runEnds[run] >= end;
+    }
+
+    ChunkType result = ~ChunkType(0);
+    forEachChunkInRange(getChunksPtr(), begin, end,
+                        [&](ChunkType chunk, ChunkType mask) {
+                            result &= chunk | ~mask;
+                        },
+                        [&](const ChunkType *chunks, size_t numChunks) {
+                            for (size_t i = 0; i != numChunks; ++i)
+                                result &= chunks[i];
+                        });
+    return result == ~ChunkType(0);
+}
+
+Optional<size_t> ClusteredBitVector::findFirstSet(size_t begin,
+                                                  size_t end) const {
+    assert(begin <= end && end <= size());
+    if (begin == end || isInlineAndAllClear()) return None;
+    if (isRunLengthEncoded()) {
+        auto runEnds = getRunEnds();
+        size_t run = findRun(runEnds, begin);
+        if (run & 1) return begin;
+        if (runEnds[run] < end) return runEnds[run];
+        return None;
+    }
+
+    const ChunkType *chunks = getChunksPtr();
+    size_t firstChunk = begin / ChunkSizeInBits;
+    size_t lastChunk = (end - 1) / ChunkSizeInBits;
+    ChunkType cur = chunks[firstChunk] & (~ChunkType(0) << (begin % ChunkSizeInBits));
+    size_t chunkIndex = firstChunk;
+    while (!cur) {
+        if (++chunkIndex > lastChunk) return None;
+        cur = chunks[chunkIndex];
+    }
+
+    size_t result = chunkIndex * ChunkSizeInBits +
+                    llvm::countTrailingZeros(cur, llvm::ZB_Undefined);
+    if (result >= end) return None;
+    return result;
+}
+
+Optional<size_t> ClusteredBitVector::findLastSet(size_t begin,
+                                                 size_t end) const {
+    assert(begin <= end && end <= size());
+    if (begin == end || isInlineAndAllClear()) return None;
+    if (isRunLengthEncoded()) {
+        // Either 'end - 1' is in a set run, or the previous run is set and
+        // ends within the range.
+        auto runEnds = getRunEnds();
+        size_t run = findRun(runEnds, end - 1);
+        if (run & 1) return end - 1;
+        if (run != 0 && runEnds[run - 1] > begin) return runEnds[run - 1] - 1;
+        return None;
+    }
+
+    const ChunkType *chunks = getChunksPtr();
+    size_t firstChunk = begin / ChunkSizeInBits;
+    size_t lastChunk = (end - 1) / ChunkSizeInBits;
+    ChunkType cur = chunks[lastChunk] &
+                    (~ChunkType(0) >> (ChunkSizeInBits - 1 - (end - 1) % ChunkSizeInBits));
+    size_t chunkIndex = lastChunk;
+    while (!cur) {
+        if (chunkIndex-- == firstChunk) return None;
+        cur = chunks[chunkIndex];
+    }
+
+    size_t result = chunkIndex * ChunkSizeInBits + ChunkSizeInBits - 1 -
+                    llvm::countLeadingZeros(cur, llvm::ZB_Undefined);
+    if (result < begin) return None;
+    return result;
+}
+
+ClusteredBitVector ClusteredBitVector::extract(size_t begin, size_t end) const {
+    assert(begin <= end && end <= size());
+    ClusteredBitVector result;
+    size_t numBits = end - begin;
+    if (numBits == 0) return result;
+
+    // Don't allocate space for zero bits.
+    if (noneInRange(begin, end)) {
+        result.appendClearBits(numBits);
+        return result;
+    }
+
+    // Copy the runs overlapping the range; the result picks its own
+    // representation as they're appended.
+    if (isRunLengthEncoded()) {
+        auto runEnds = getRunEnds();
+        size_t runBegin = begin;
+        for (size_t run = findRun(runEnds, begin); runBegin < end; ++run) {
+            size_t runEnd = std::min(runEnds[run], end);
+            if (run & 1)
+                result.appendSetBits(runEnd - runBegin);
+            else
+                result.appendClearBits(runEnd - runBegin);
+            runBegin = runEnd;
+        }
+        return result;
+    }
+
+    // Read the bits a chunk at a time, combining the two source chunks
+    // that straddle each result chunk.
+    const ChunkType *chunks = getChunksPtr();
+    size_t nextBit = begin;
+    result.reserve(numBits);
+    result.appendReserved(numBits, [&](size_t numBitsWanted) -> ChunkType {
+        size_t chunkIndex = nextBit / ChunkSizeInBits;
+        size_t offset = nextBit % ChunkSizeInBits;
+        ChunkType bits = chunks[chunkIndex] >> offset;
+        if (offset && offset + numBitsWanted > ChunkSizeInBits)
+            bits |= chunks[chunkIndex + 1] << (ChunkSizeInBits - offset);
+        if (numBitsWanted != ChunkSizeInBits)
+            bits &= (ChunkType(1) << numBitsWanted) - 1;
+        nextBit += numBitsWanted;
+        return bits;
+    });
+    return result;
+}
+
 bool ClusteredBitVector::equalsSlowCase(const ClusteredBitVector &lhs,
                                         const ClusteredBitVector &rhs) {
     assert(lhs.size() == rhs.size());
     assert(!lhs.empty() && !rhs.empty());
     assert(lhs.hasOutOfLineData() || rhs.hasOutOfLineData());
 
+    // Runs are normalized, so equal vectors have equal runs.
+    if (lhs.isRunLengthEncoded() || rhs.isRunLengthEncoded()) {
+        if (lhs.isRunLengthEncoded() && rhs.isRunLengthEncoded())
+            return lhs.getRunEnds() == rhs.getRunEnds();
+
+        SmallVector<size_t, 16> lhsRuns, rhsRuns;
+        lhs.getRuns(lhsRuns);
+        rhs.getRuns(rhsRuns);
+        return lhsRuns == rhsRuns;
+    }
+
     if (!lhs.hasOutOfLineData()) {
         assert(lhs.Data == 0 || lhs.getLengthInChunks() == 1);
         for (auto chunk : rhs.getOutOfLineChunks())
@@ -198,6 +454,262 @@ bool ClusteredBitVector::equalsSlowCase(const ClusteredBitVector &lhs,
     }
 }
 
+/// Add a run to a list of normalized run ends, merging it with the last run
+/// if they have the same value.
+static void addRun(SmallVectorImpl<size_t> &runEnds, bool value,
+                   size_t numBits) {
+    if (numBits == 0) return;
+    if (runEnds.empty()) {
+        if (value) runEnds.push_back(0);
+        runEnds.push_back(numBits);
+        return;
+    }
+    bool lastValue = (runEnds.size() - 1) & 1;
+    if (lastValue == value)
+        runEnds.back() += numBits;
+    else
+        runEnds.push_back(runEnds.back() + numBits);
+}
+
+void ClusteredBitVector::forEachRun(
+        llvm::function_ref<void(bool value, size_t numBits)> fn) const {
+    if (empty()) return;
+
+    if (isInlineAndAllClear()) {
+        fn(false, LengthInBits);
+        return;
+    }
+
+    if (isRunLengthEncoded()) {
+        size_t begin = 0;
+        auto runEnds = getRunEnds();
+        for (size_t run = 0, e = runEnds.size(); run != e; ++run) {
+            if (runEnds[run] != begin) fn(run & 1, runEnds[run] - begin);
+            begin = runEnds[run];
+        }
+        return;
+    }
+
+    // Find each boundary by searching for the first bit that differs from
+    // the current run, a chunk at a time.
+    const ChunkType *chunks = getChunksPtr();
+    size_t begin = 0;
+    bool value = chunks[0] & 1;
+    for (size_t i = 0; i != LengthInBits;) {
+        size_t chunkIndex = i / ChunkSizeInBits;
+        ChunkType differing = (value ? ~chunks[chunkIndex] : chunks[chunkIndex]) &
+                              (~ChunkType(0) << (i % ChunkSizeInBits));
+        if (!differing) {
+            i = std::min((chunkIndex + 1) * ChunkSizeInBits, size_t(LengthInBits));
+            continue;
+        }
+        i = std::min(chunkIndex * ChunkSizeInBits +
+                     llvm::countTrailingZeros(differing, llvm::ZB_Undefined),
+                     size_t(LengthInBits));
+        if (i == LengthInBits) break;
+        fn(value, i - begin);
+        begin = i;
+        value = !value;
+    }
+    fn(value, LengthInBits - begin);
+}
+
+void ClusteredBitVector::getRuns(SmallVectorImpl<size_t> &runEnds) const {
+    runEnds.clear();
+    if (isRunLengthEncoded()) {
+        auto ends = getRunEnds();
+        runEnds.append(ends.begin(), ends.end());
+        return;
+    }
+    forEachRun([&](bool value, size_t numBits) {
+        addRun(runEnds, value, numBits);
+    });
+}
+
+void ClusteredBitVector::setRuns(ArrayRef<size_t> runEnds) {
+    assert((runEnds.empty() ? 0 : runEnds.back()) == LengthInBits);
+
+    if (!isRunLengthEncoded() || getRunCapacity() < runEnds.size()) {
+        if (hasOutOfLineData()) destroy();
+        // Leave room to append a few runs.
+        allocateRuns(std::max<size_t>(runEnds.size() * 2, 4));
+    }
+    std::copy(runEnds.begin(), runEnds.end(), getRunEndsPtr());
+    getRunEndsPtr()[-1] = runEnds.size();
+}
+
+bool ClusteredBitVector::tryConvertToRunLength(size_t numBits) {
+    assert(!isRunLengthEncoded());
+
+    // Only switch if the runs take at most a quarter of the space of the
+    // dense chunks; maybeConvertToDense switches back at a half, so a
+    // vector doesn't flip-flop between representations.
+    SmallVector<size_t, 16> runEnds;
+    getRuns(runEnds);
+    if ((runEnds.size() + 1) * 4 > getNumChunksForBits(LengthInBits + numBits))
+        return false;
+
+    setRuns(runEnds);
+    return true;
+}
+
+void ClusteredBitVector::maybeConvertToDense() {
+    assert(isRunLengthEncoded());
+    if (getNumRuns() * 2 > getLengthInChunks())
+        convertToDense();
+}
+
+void ClusteredBitVector::convertToDense() {
+    assert(isRunLengthEncoded());
+    SmallVector<size_t, 16> runEnds;
+    getRuns(runEnds);
+    destroy();
+    HasOutOfLineData = false;
+    Data = 0;
+
+    // Stay in the inline-and-all-clear representation if possible.
+    if (runEnds.size() <= 1) return;
+
+    reserve(LengthInBits);
+    auto chunks = getChunks();
+    std::fill(chunks.begin(), chunks.end(), ChunkType(0));
+    for (size_t run = 1, e = runEnds.size(); run < e; run += 2)
+        setRange(runEnds[run - 1], runEnds[run]);
+}
+
+void ClusteredBitVector::appendRun(bool value, size_t numBits) {
+    assert(isRunLengthEncoded());
+    if (numBits == 0) return;
+
+    size_t *runEnds = getRunEndsPtr();
+    size_t numRuns = getNumRuns();
+
+    // Extend the last run if it has the same value.
+    if (numRuns != 0 && bool((numRuns - 1) & 1) == value) {
+        runEnds[numRuns - 1] += numBits;
+        LengthInBits += numBits;
+        return;
+    }
+
+    // Otherwise, add a new run, plus an empty clear run if this is a set
+    // run at the very start.
+    size_t newNumRuns = numRuns + ((numRuns == 0 && value) ? 2 : 1);
+    if (newNumRuns > getRunCapacity()) {
+        auto oldRunEnds = getRunEnds();
+        size_t *oldAllocation = runEnds - 2;
+        allocateRuns(newNumRuns * 2);
+        std::copy(oldRunEnds.begin(), oldRunEnds.end(), getRunEndsPtr());
+        delete[] oldAllocation;
+        runEnds = getRunEndsPtr();
+    }
+    if (numRuns == 0 && value) runEnds[numRuns++] = 0;
+    runEnds[numRuns] = LengthInBits + numBits;
+    runEnds[-1] = numRuns + 1;
+    LengthInBits += numBits;
+}
+
+void ClusteredBitVector::appendRunLength(const ClusteredBitVector &other) {
+    assert(isRunLengthEncoded() || other.isRunLengthEncoded());
+
+    // Appending runs to a dense vector is only worth switching this one to
+    // runs if the other vector is at least as long.
+    if (!isRunLengthEncoded() &&
+        !(other.size() >= size() && tryConvertToRunLength(other.size()))) {
+        other.forEachRun([&](bool value, size_t numBits) {
+            if (value)
+                appendSetBits(numBits);
+            else
+                appendClearBits(numBits);
+        });
+        return;
+    }
+
+    other.forEachRun([&](bool value, size_t numBits) {
+        appendRun(value, numBits);
+    });
+    maybeConvertToDense();
+}
+
+void ClusteredBitVector::addRunLength(size_t numBits, uint64_t value) {
+    assert(isRunLengthEncoded() && numBits <= 64);
+    for (size_t i = 0; i != numBits;) {
+        bool bit = (value >> i) & 1;
+        uint64_t differing = (bit ? ~value : value) >> i;
+        size_t runLength = differing
+                           ? llvm::countTrailingZeros(differing, llvm::ZB_Undefined)
+                           : 64 - i;
+        runLength = std::min(runLength, numBits - i);
+        appendRun(bit, runLength);
+        i += runLength;
+    }
+    maybeConvertToDense();
+}
+
+bool ClusteredBitVector::testRunLength(size_t i) const {
+    return findRun(getRunEnds(), i) & 1;
+}
+
+void ClusteredBitVector::flipAllRunLength() {
+    // Flipping every bit shifts the parity of every run: add or remove the
+    // empty clear run at the start.
+    SmallVector<size_t, 16> runEnds;
+    getRuns(runEnds);
+    if (runEnds.front() == 0)
+        runEnds.erase(runEnds.begin());
+    else
+        runEnds.insert(runEnds.begin(), 0);
+    setRuns(runEnds);
+}
+
+size_t ClusteredBitVector::countRunLength() const {
+    auto runEnds = getRunEnds();
+    size_t count = 0;
+    for (size_t run = 1, e = runEnds.size(); run < e; run += 2)
+        count += runEnds[run] - runEnds[run - 1];
+    return count;
+}
+
+ClusteredBitVector &
+ClusteredBitVector::combineRunLength(const ClusteredBitVector &other,
+                                     BitwiseOp op) {
+    assert(size() == other.size());
+
+    SmallVector<size_t, 16> lhsRuns, rhsRuns, resultRuns;
+    getRuns(lhsRuns);
+    other.getRuns(rhsRuns);
+
+    // Walk both run lists in step, emitting a run up to each boundary of
+    // either list.
+    size_t lhsRun = 0, rhsRun = 0, begin = 0;
+    while (begin != LengthInBits) {
+        size_t end = std::min(lhsRuns[lhsRun], rhsRuns[rhsRun]);
+        bool lhsValue = lhsRun & 1, rhsValue = rhsRun & 1;
+        bool value;
+        switch (op) {
+            case BitwiseOp::And:
+                value = lhsValue && rhsValue;
+                break;
+            case BitwiseOp::Or:
+                value = lhsValue || rhsValue;
+                break;
+            case BitwiseOp::Xor:
+                value = lhsValue != rhsValue;
+                break;
+            case BitwiseOp::AndNot:
+                value = lhsValue && !rhsValue;
+                break;
+        }
+        addRun(resultRuns, value, end - begin);
+        if (lhsRuns[lhsRun] == end) ++lhsRun;
+        if (rhsRuns[rhsRun] == end) ++rhsRun;
+        begin = end;
+    }
+
+    setRuns(resultRuns);
+    maybeConvertToDense();
+    return *this;
+}
+
 void ClusteredBitVector::dump() const {
     print(llvm::errs());
 }
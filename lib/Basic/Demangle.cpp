@@ -27,6 +27,7 @@
 #include "swift/Strings.h"
 #include "swift/Basic/LLVM.h"
 #include "swift/Basic/Punycode.h"
+#include "swift/Basic/Trace.h"
 #include "swift/Basic/UUID.h"
 #include "llvm/ADT/StringRef.h"
 #include <functional>
@@ -2368,6 +2369,7 @@ NodePointer
 swift::Demangle::demangleSymbolAsNode(const char *MangledName,
                                       size_t MangledNameLength,
                                       const DemangleOptions &Options) {
+    SWIFT_TRACE_SCOPE("Demangle::demangleSymbolAsNode");
     Demangler demangler(StringRef(MangledName, MangledNameLength));
     return demangler.demangleTopLevel();
 }
@@ -2376,6 +2378,7 @@ NodePointer
 swift::Demangle::demangleTypeAsNode(const char *MangledName,
                                     size_t MangledNameLength,
                                     const DemangleOptions &Options) {
+    SWIFT_TRACE_SCOPE("Demangle::demangleTypeAsNode");
     Demangler demangler(StringRef(MangledName, MangledNameLength));
     return demangler.demangleTypeName();
 }
@@ -20,6 +20,7 @@
 #include "swift/Basic/Punycode.h"
 #include "swift/Basic/Fallthrough.h"
 #include "swift/Basic/Range.h"
+#include "swift/Basic/Trace.h"
 #include "swift/Strings.h"
 #include "llvm/Support/ErrorHandling.h"
 
@@ -113,6 +114,7 @@ namespace swift {
     namespace NewMangling {
 
         NodePointer Demangler::demangleTopLevel() {
+            SWIFT_TRACE_SCOPE("NewMangling::Demangler::demangleTopLevel");
             if (!nextIf(MANGLING_PREFIX_STR))
                 return nullptr;
 
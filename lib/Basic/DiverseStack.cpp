@@ -69,3 +69,140 @@ char *DiverseListBase::addNewStorageSlow(std::size_t needed) {
 
     return Begin + oldSize;
 }
+
+DiverseStorageChunk *DiverseStorageChunk::allocate(std::size_t needed) {
+    std::size_t capacity = getStandardCapacity();
+    void *memory;
+    if (needed <= capacity) {
+        memory = PooledAlignedAlloc(StandardSize, alignof(DiverseStorageChunk));
+    } else {
+        capacity = (needed + 15) & ~std::size_t(15);
+        memory = AlignedAlloc(sizeof(DiverseStorageChunk) + capacity,
+                              alignof(DiverseStorageChunk));
+    }
+
+    auto chunk = static_cast<DiverseStorageChunk *>(memory);
+    chunk->Prev = chunk->Next = nullptr;
+    chunk->Capacity = capacity;
+    chunk->OffsetBefore = 0;
+    return chunk;
+}
+
+void DiverseStorageChunk::deallocate(DiverseStorageChunk *chunk) {
+    if (chunk->Capacity == getStandardCapacity())
+        PooledAlignedFree(chunk, StandardSize, alignof(DiverseStorageChunk));
+    else
+        AlignedFree(chunk);
+}
+
+void DiverseStorageChunk::deallocateChain(DiverseStorageChunk *chunk) {
+    while (chunk) {
+        DiverseStorageChunk *prev = chunk->Prev;
+        deallocate(chunk);
+        chunk = prev;
+    }
+}
+
+void ChunkedDiverseStackBase::pushNewChunk(std::size_t needed) {
+    // An empty chunk can only be the bottom one; rather than leave it empty
+    // underneath a new chunk, replace it.
+    if (Top && Begin == Top->dataEnd()) {
+        assert(!Top->Prev);
+        DiverseStorageChunk::deallocate(Top);
+        Top = nullptr;
+    }
+
+    DiverseStorageChunk *chunk;
+    if (Spare && Spare->Capacity >= needed) {
+        chunk = Spare;
+        Spare = nullptr;
+        chunk->Prev = chunk->Next = nullptr;
+    } else {
+        chunk = DiverseStorageChunk::allocate(needed);
+    }
+
+    if (Top) {
+        Top->Mark = Begin;
+        chunk->OffsetBefore = getDepth(Top, Begin);
+    } else {
+        chunk->OffsetBefore = 0;
+    }
+    chunk->Prev = Top;
+    Top = chunk;
+    Begin = chunk->dataEnd() - needed;
+}
+
+void ChunkedDiverseStackBase::popChunk() {
+    DiverseStorageChunk *chunk = Top;
+    Top = chunk->Prev;
+    Begin = Top->Mark;
+
+    if (Spare) DiverseStorageChunk::deallocate(Spare);
+    Spare = chunk;
+}
+
+void ChunkedDiverseStackBase::copyFrom(const ChunkedDiverseStackBase &other) {
+    assert(!Top && "copying into a non-empty stack");
+    if (other.empty()) return;
+
+    // Copy chunk by chunk so that every element keeps its depth.
+    DiverseStorageChunk **link = &Top;
+    for (DiverseStorageChunk *chunk = other.Top; chunk; chunk = chunk->Prev) {
+        const char *used = (chunk == other.Top ? other.Begin : chunk->Mark);
+        std::size_t size = std::size_t(chunk->dataEnd() - used);
+
+        DiverseStorageChunk *copy = DiverseStorageChunk::allocate(size);
+        copy->OffsetBefore = chunk->OffsetBefore;
+        copy->Mark = copy->dataEnd() - size;
+        std::memcpy(copy->Mark, used, size);
+
+        *link = copy;
+        link = &copy->Prev;
+    }
+    Begin = Top->Mark;
+}
+
+char *ChunkedDiverseListBase::addNewChunk(std::size_t needed) {
+    // An empty chunk can only be the first one; rather than leave it empty
+    // in front of a new chunk, replace it.
+    if (Last && Last->Mark == Last->data()) {
+        assert(First == Last);
+        DiverseStorageChunk::deallocate(Last);
+        First = Last = nullptr;
+    }
+
+    DiverseStorageChunk *chunk = DiverseStorageChunk::allocate(needed);
+    if (Last) {
+        chunk->OffsetBefore = getOffset(Last, Last->Mark);
+        Last->Next = chunk;
+    } else {
+        First = chunk;
+    }
+    chunk->Prev = Last;
+    Last = chunk;
+
+    chunk->Mark = chunk->data() + needed;
+    return chunk->data();
+}
+
+void ChunkedDiverseListBase::copyFrom(const ChunkedDiverseListBase &other) {
+    assert(!First && "copying into a non-empty list");
+    if (other.empty()) return;
+
+    // Copy chunk by chunk so that every element keeps its offset.
+    for (DiverseStorageChunk *chunk = other.First; chunk; chunk = chunk->Next) {
+        std::size_t size = std::size_t(chunk->Mark - chunk->data());
+
+        DiverseStorageChunk *copy = DiverseStorageChunk::allocate(size);
+        copy->OffsetBefore = chunk->OffsetBefore;
+        copy->Mark = copy->data() + size;
+        std::memcpy(copy->data(), chunk->data(), size);
+
+        copy->Prev = Last;
+        if (Last)
+            Last->Next = copy;
+        else
+            First = copy;
+        Last = copy;
+    }
+}
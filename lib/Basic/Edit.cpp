@@ -12,32 +12,184 @@
 
 #include "llvm/Support/raw_ostream.h"
 #include "swift/Basic/Edit.h"
+#include "swift/Basic/JSONSerialization.h"
 #include "swift/Basic/SourceManager.h"
+#include "swift/Basic/Varint.h"
+#include "llvm/ADT/DenseMap.h"
+#include <algorithm>
+#include <vector>
+
+using namespace swift;
+
+namespace {
+    /// A buffer containing edits, as found by EditBufferLocator.
+    struct EditBuffer {
+        const char *Start;
+        const char *End;
+        unsigned ID;
+        StringRef Path;
+    };
+
+    /// Finds the buffers containing a sequence of edits.
+    ///
+    /// SourceManager::findBufferContainingLoc scans every buffer.  Instead,
+    /// the buffers of each SourceManager are sorted by address once, and
+    /// consecutive edits in the same buffer, the common case, skip even the
+    /// binary search.
+    class EditBufferLocator {
+        struct SourceManagerIndex {
+            SourceManager *SM;
+            std::vector<EditBuffer> Buffers;
+
+            /// If any buffers overlap, the sorted index can't reproduce
+            /// findBufferContainingLoc's preference for later buffers.
+            bool HasOverlaps;
+        };
+
+        std::vector<SourceManagerIndex> Indices;
+        SourceManager *LastSM = nullptr;
+        EditBuffer Last = {nullptr, nullptr, 0, StringRef()};
+
+        static bool contains(const EditBuffer &Buffer, const char *Ptr) {
+            // Like findBufferContainingLoc, include the end of the buffer.
+            auto less_equal = std::less_equal<const char *>();
+            return less_equal(Buffer.Start, Ptr) && less_equal(Ptr, Buffer.End);
+        }
+
+        SourceManagerIndex &getIndex(SourceManager &SM) {
+            for (auto &Index : Indices)
+                if (Index.SM == &SM)
+                    return Index;
+
+            auto less = std::less<const char *>();
+            Indices.push_back({&SM, {}, false});
+            SourceManagerIndex &Index = Indices.back();
+            for (unsigned ID = 1, E = SM.getLLVMSourceMgr().getNumBuffers();
+                 ID <= E; ++ID) {
+                CharSourceRange Range = SM.getRangeForBuffer(ID);
+                auto Start = static_cast<const char *>(
+                        Range.getStart().getOpaquePointerValue());
+                Index.Buffers.push_back({Start, Start + Range.getByteLength(),
+                                         ID, StringRef()});
+            }
+            std::sort(Index.Buffers.begin(), Index.Buffers.end(),
+                      [&](const EditBuffer &LHS, const EditBuffer &RHS) {
+                          return less(LHS.Start, RHS.Start);
+                      });
+            for (size_t I = 1; I < Index.Buffers.size(); ++I)
+                if (!less(Index.Buffers[I - 1].End, Index.Buffers[I].Start))
+                    Index.HasOverlaps = true;
+            return Index;
+        }
+
+    public:
+        const EditBuffer &find(SourceManager &SM, SourceLoc Loc) {
+            auto Ptr = static_cast<const char *>(Loc.getOpaquePointerValue());
+            if (&SM == LastSM && contains(Last, Ptr))
+                return Last;
+
+            SourceManagerIndex &Index = getIndex(SM);
+            if (Index.HasOverlaps) {
+                unsigned ID = SM.findBufferContainingLoc(Loc);
+                CharSourceRange Range = SM.getRangeForBuffer(ID);
+                auto Start = static_cast<const char *>(
+                        Range.getStart().getOpaquePointerValue());
+                Last = {Start, Start + Range.getByteLength(), ID, StringRef()};
+            } else {
+                auto Found = std::upper_bound(
+                        Index.Buffers.begin(), Index.Buffers.end(), Ptr,
+                        [](const char *Ptr, const EditBuffer &Buffer) {
+                            return std::less<const char *>()(Ptr, Buffer.Start);
+                        });
+                assert(Found != Index.Buffers.begin() &&
+                       contains(*std::prev(Found), Ptr) &&
+                       "no buffer containing location found");
+                Last = *std::prev(Found);
+            }
+            Last.Path = SM.getIdentifierForBuffer(Last.ID);
+            LastSM = &SM;
+            return Last;
+        }
+    };
+
+    /// The JSON form of one edit.
+    struct EditRecord {
+        StringRef File;
+        unsigned Offset;
+        unsigned Remove;
+        StringRef Text;
+    };
+} // end anonymous namespace
+
+namespace swift {
+    namespace json {
+        template<>
+        struct ObjectTraits<EditRecord> {
+            static void mapping(Output &out, EditRecord &Record) {
+                out.mapRequired("file", Record.File);
+                out.mapRequired("offset", Record.Offset);
+                out.mapOptional("remove", Record.Remove, 0U);
+                out.mapOptional("text", Record.Text, StringRef());
+            }
+        };
+    } // end namespace json
+} // end namespace swift
 
 void swift::
 writeEditsInJson(ArrayRef<SingleEdit> AllEdits, llvm::raw_ostream &OS) {
-    OS << "[\n";
-    for (auto &Edit : AllEdits) {
-        SourceManager &SM = Edit.SM;
-        CharSourceRange Range = Edit.Range;
-        StringRef Text = Edit.Text;
-        SourceLoc Loc = Range.getStart();
-        unsigned BufID = SM.findBufferContainingLoc(Loc);
-        unsigned Offset = SM.getLocOffsetInBuffer(Loc, BufID);
-        unsigned Length = Range.getByteLength();
-        StringRef Path(SM.getIdentifierForBuffer(BufID));
-
-        OS << " {\n";
-        OS << "  \"file\": \"";
-        OS.write_escaped(Path) << "\",\n";
-        OS << "  \"offset\": " << Offset << ",\n";
-        if (Length != 0)
-            OS << "  \"remove\": " << Length << ",\n";
-        if (!Text.empty()) {
-            OS << "  \"text\": \"";
-            OS.write_escaped(Text) << "\",\n";
+    EditBufferLocator Locator;
+    json::Output Out(OS);
+
+    // Stream the elements rather than building an array to hand to Output.
+    Out.beginArray();
+    for (unsigned I = 0, E = AllEdits.size(); I != E; ++I) {
+        const SingleEdit &Edit = AllEdits[I];
+        SourceLoc Loc = Edit.Range.getStart();
+        const EditBuffer &Buffer = Locator.find(Edit.SM, Loc);
+        auto Ptr = static_cast<const char *>(Loc.getOpaquePointerValue());
+        EditRecord Record = {Buffer.Path, unsigned(Ptr - Buffer.Start),
+                             Edit.Range.getByteLength(), Edit.Text};
+
+        void *SaveInfo;
+        if (Out.preflightElement(I, SaveInfo)) {
+            json::jsonize(Out, Record, true);
+            Out.postflightElement(SaveInfo);
         }
-        OS << " },\n";
     }
-    OS << "]\n";
+    Out.endArray();
+    OS << '\n';
+}
+
+void swift::
+writeEditsInBinary(ArrayRef<SingleEdit> AllEdits, llvm::raw_ostream &OS) {
+    auto writeVarint = [&](uint64_t Value) {
+        uint8_t Bytes[Varint::getMaxEncodedSize<uint64_t>()];
+        uint8_t *End = Varint::encodeTo(Bytes, Value);
+        OS.write(reinterpret_cast<const char *>(Bytes), End - Bytes);
+    };
+    auto writeString = [&](StringRef String) {
+        writeVarint(String.size());
+        OS << String;
+    };
+
+    OS << "SWED";
+    writeVarint(1);
+    writeVarint(AllEdits.size());
+
+    EditBufferLocator Locator;
+    llvm::DenseMap<std::pair<SourceManager *, unsigned>, unsigned> FileIndices;
+    for (const SingleEdit &Edit : AllEdits) {
+        SourceLoc Loc = Edit.Range.getStart();
+        const EditBuffer &Buffer = Locator.find(Edit.SM, Loc);
+        auto Ptr = static_cast<const char *>(Loc.getOpaquePointerValue());
+
+        auto Inserted = FileIndices.insert({{&Edit.SM, Buffer.ID},
+                                            FileIndices.size()});
+        writeVarint(Inserted.first->second);
+        if (Inserted.second)
+            writeString(Buffer.Path);
+        writeVarint(Ptr - Buffer.Start);
+        writeVarint(Edit.Range.getByteLength());
+        writeString(Edit.Text);
+    }
 }
@@ -16,7 +16,10 @@
 //===----------------------------------------------------------------------===//
 
 #include "swift/Basic/EditorPlaceholder.h"
+#include "swift/Basic/PrimitiveParsing.h"
 #include "llvm/ADT/Optional.h"
+#include "llvm/ADT/SmallVector.h"
+#include <algorithm>
 
 using namespace swift;
 using namespace llvm;
@@ -78,3 +81,57 @@ swift::parseEditorPlaceholder(StringRef PlaceholderText) {
 
     return PHDataTyped;
 }
+
+/// Scans [Ptr, End), which must start at the beginning of a line, for
+/// placeholders.  Offsets are relative to \p BufferStart.
+static void
+scanForEditorPlaceholders(const char *BufferStart, const char *Ptr,
+                          const char *End,
+                          SmallVectorImpl<EditorPlaceholderOccurrence>
+                              &Results) {
+    // Both delimiters contain a '#', so only '#' and newlines need to be
+    // looked at.  Start is the '<' of the placeholder being scanned, if any.
+    const char *ScanStart = Ptr;
+    const char *Start = nullptr;
+    while ((Ptr = findFirstOf2(Ptr, End, '#', '\n')) != End) {
+        if (*Ptr == '\n') {
+            Start = nullptr;
+        } else if (Ptr != ScanStart && Ptr[-1] == '<') {
+            // Also abandons any placeholder already being scanned.
+            Start = Ptr - 1;
+        } else if (Start && Ptr + 1 != End && Ptr[1] == '>') {
+            StringRef Text(Start, Ptr + 2 - Start);
+            Results.push_back({size_t(Start - BufferStart), Text.size(),
+                               *parseEditorPlaceholder(Text)});
+            Start = nullptr;
+            ++Ptr;
+        }
+        ++Ptr;
+    }
+}
+
+void
+swift::findEditorPlaceholders(StringRef Buffer,
+                              SmallVectorImpl<EditorPlaceholderOccurrence>
+                                  &Results) {
+    scanForEditorPlaceholders(Buffer.begin(), Buffer.begin(), Buffer.end(),
+                              Results);
+}
+
+void
+swift::findEditorPlaceholders(StringRef Buffer, size_t Begin, size_t End,
+                              SmallVectorImpl<EditorPlaceholderOccurrence>
+                                  &Results) {
+    Begin = std::min(Begin, Buffer.size());
+    End = std::max(std::min(End, Buffer.size()), Begin);
+
+    // Widen the range to whole lines.  An empty range still covers the line
+    // it is on.
+    size_t LineStart = Buffer.rfind('\n', Begin);
+    LineStart = LineStart == StringRef::npos ? 0 : LineStart + 1;
+    size_t LineEnd = Buffer.find('\n', End > Begin ? End - 1 : Begin);
+    LineEnd = LineEnd == StringRef::npos ? Buffer.size() : LineEnd + 1;
+
+    scanForEditorPlaceholders(Buffer.begin(), Buffer.begin() + LineStart,
+                              Buffer.begin() + LineEnd, Results);
+}
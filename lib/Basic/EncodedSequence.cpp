@@ -0,0 +1,127 @@
+//===--- EncodedSequence.cpp - Out-of-line storage for sequences ----------===//
+//
+// This source file is part of the Swift.org open source project
+//
+// Copyright (c) 2014 - 2017 Apple Inc. and the Swift project authors
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// See https://swift.org/LICENSE.txt for license information
+// See https://swift.org/CONTRIBUTORS.txt for the list of Swift project authors
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file implements the management of the out-of-line storage of
+//  encoded sequences, and the arena it can be allocated from.
+//
+//===----------------------------------------------------------------------===//
+
+#include "swift/Basic/EncodedSequence.h"
+#include <limits>
+
+using namespace swift;
+
+EncodedSequenceArena::Block *
+EncodedSequenceArena::allocate(size_t minStorageBytes) {
+    unsigned sizeClass = 0;
+    while (getBlockSize(sizeClass) - sizeof(Block) < minStorageBytes)
+        sizeClass++;
+    assert(sizeClass < NumSizeClasses && "block request too large");
+
+    Block *block = FreeBlocks[sizeClass];
+    if (block) {
+        FreeBlocks[sizeClass] = block->NextFree;
+    } else {
+        block = static_cast<Block *>(
+                Allocator.Allocate(getBlockSize(sizeClass), alignof(Block)));
+        block->SizeClass = sizeClass;
+    }
+    block->Arena = this;
+    return block;
+}
+
+void EncodedSequenceArena::deallocate(Block *block) {
+    assert(block->Arena == this && "block belongs to a different arena");
+    block->NextFree = FreeBlocks[block->SizeClass];
+    FreeBlocks[block->SizeClass] = block;
+}
+
+template<class HeaderType>
+static uintptr_t initializeHeader(void *storage, size_t capacity) {
+    using SizeType = decltype(HeaderType::Capacity);
+    capacity = std::min<size_t>(capacity, std::numeric_limits<SizeType>::max());
+    auto header = ::new(storage) HeaderType();
+    header->Size = 0;
+    header->Capacity = capacity;
+    return reinterpret_cast<uintptr_t>(storage);
+}
+
+uintptr_t
+EncodedSequenceBase::allocateOutOfLineStorage(size_t minCapacity,
+                                              EncodedSequenceArena *arena) {
+    bool wide = minCapacity > std::numeric_limits<uint16_t>::max();
+    size_t headerSize = wide ? sizeof(WideHeader) : sizeof(NarrowHeader);
+    size_t minBytes = headerSize + minCapacity * sizeof(Chunk);
+
+    void *storage;
+    size_t storageBytes;
+    uintptr_t flags = wide ? uintptr_t(IsWide) : 0;
+    if (arena) {
+        auto block = arena->allocate(minBytes);
+        storage = block->getStorage();
+        storageBytes = EncodedSequenceArena::getBlockSize(block->SizeClass) -
+                       sizeof(EncodedSequenceArena::Block);
+        flags |= IsArenaAllocated;
+    } else {
+        storageBytes = 32;
+        while (minBytes > storageBytes)
+            storageBytes *= 2;
+        storage = operator new(storageBytes);
+    }
+    assert(!(reinterpret_cast<uintptr_t>(storage) & (OutOfLineFlags | IsInline))
+           && "out-of-line storage is insufficiently aligned");
+
+    size_t capacity = (storageBytes - headerSize) / sizeof(Chunk);
+    uintptr_t data = wide ? initializeHeader<WideHeader>(storage, capacity)
+                          : initializeHeader<NarrowHeader>(storage, capacity);
+    return data | flags;
+}
+
+void EncodedSequenceBase::destroyOutOfLineStorage() {
+    void *storage = getOutOfLineStorage();
+    if (Data & IsArenaAllocated) {
+        auto block = EncodedSequenceArena::Block::getFromStorage(storage);
+        block->Arena->deallocate(block);
+    } else {
+        operator delete(storage);
+    }
+}
+
+void EncodedSequenceBase::cloneOutOfLineStorage() {
+    ArrayRef<Chunk> oldChunks = chunks();
+    uintptr_t newData = allocateOutOfLineStorage(getOutOfLineCapacity(),
+                                                 getArena());
+    Data = newData;
+    memcpy(getOutOfLineChunks(), oldChunks.data(),
+           oldChunks.size() * sizeof(Chunk));
+    setOutOfLineSize(oldChunks.size());
+}
+
+MutableArrayRef<EncodedSequenceBase::Chunk>
+EncodedSequenceBase::claimStorageSlow(size_t oldSize, size_t newSize) {
+    // Allocate new storage in the same arena, at least doubling the
+    // capacity so that repeated appends take amortized constant time.
+    uintptr_t newData = allocateOutOfLineStorage(
+            std::max(newSize, 2 * chunkStorage().size()), getArena());
+
+    // Copy from the old storage, then destroy it.  Inline chunks live in
+    // Data itself, so read them before replacing it.
+    assert(chunks().size() == oldSize);
+    memcpy(getOutOfLineChunks(newData), chunks().data(),
+           oldSize * sizeof(Chunk));
+    if (hasOutOfLineStorage()) destroyOutOfLineStorage();
+
+    Data = newData;
+    setOutOfLineSize(newSize);
+
+    return {getOutOfLineChunks() + oldSize, newSize - oldSize};
+}
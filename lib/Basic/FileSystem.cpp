@@ -11,8 +11,32 @@
 //===----------------------------------------------------------------------===//
 
 #include "swift/Basic/FileSystem.h"
+#include "swift/Basic/LLVM.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Mutex.h"
+#include "llvm/Support/Parallel.h"
 #include "llvm/Support/Process.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cerrno>
+#include <chrono>
+#include <memory>
+
+#if LLVM_ON_UNIX
+#include <fcntl.h>
+#endif
+
+#if defined(__linux__) && defined(__GLIBC__) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+#include <unistd.h>
+#define SWIFT_HAVE_COPY_FILE_RANGE 1
+#else
+#define SWIFT_HAVE_COPY_FILE_RANGE 0
+#endif
 
 using namespace swift;
 
@@ -27,6 +51,122 @@ namespace {
                 llvm::sys::Process::SafelyCloseFileDescriptor(fd);
         }
     };
+
+    namespace fs = llvm::sys::fs;
+
+    /// Files are compared and hashed this many bytes at a time, so that
+    /// neither needs to be mapped or read in its entirety.
+    enum : size_t { ChunkSize = 256 * 1024 };
+
+    /// Tell the kernel that \p fd will be read front to back, so that it
+    /// reads ahead aggressively.
+    void adviseSequentialRead(int fd) {
+#if defined(POSIX_FADV_SEQUENTIAL)
+        (void) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    }
+
+    /// Fill \p buffer with the bytes of \p fd starting at \p offset.
+    std::error_code readChunk(int fd, MutableArrayRef<char> buffer,
+                              uint64_t offset) {
+        fs::file_t file = fs::convertFDToNativeFile(fd);
+        while (!buffer.empty()) {
+            auto bytesRead = fs::readNativeFileSlice(file, buffer, offset);
+            if (!bytesRead)
+                return llvm::errorToErrorCode(bytesRead.takeError());
+            // The file shrank underneath us.
+            if (*bytesRead == 0)
+                return std::make_error_code(std::errc::io_error);
+            buffer = buffer.drop_front(*bytesRead);
+            offset += *bytesRead;
+        }
+        return std::error_code();
+    }
+
+    /// Compare the first \p size bytes of two open files chunk by chunk,
+    /// stopping at the first difference.  Only errors reading the source
+    /// are reported; a destination that can't be read is just different.
+    std::error_code compareOpenFiles(int sourceFD, int destFD, uint64_t size,
+                                     bool &same) {
+        same = false;
+        size_t bufferSize = std::min<uint64_t>(size, ChunkSize);
+        std::unique_ptr<char[]> sourceBuffer(new char[bufferSize]);
+        std::unique_ptr<char[]> destBuffer(new char[bufferSize]);
+        adviseSequentialRead(sourceFD);
+        adviseSequentialRead(destFD);
+
+        for (uint64_t offset = 0; offset < size; offset += bufferSize) {
+            size_t chunk = std::min<uint64_t>(bufferSize, size - offset);
+            if (std::error_code error = readChunk(
+                    sourceFD, {sourceBuffer.get(), chunk}, offset))
+                return error;
+            if (readChunk(destFD, {destBuffer.get(), chunk}, offset))
+                return std::error_code();
+            if (memcmp(sourceBuffer.get(), destBuffer.get(), chunk) != 0)
+                return std::error_code();
+        }
+        same = true;
+        return std::error_code();
+    }
+
+    /// Copy everything from \p sourceFD, which was opened on \p source,
+    /// to \p destFD.  Both must be at offset zero.
+    std::error_code copyFileContents(const llvm::Twine &source, int sourceFD,
+                                     int destFD) {
+#if SWIFT_HAVE_COPY_FILE_RANGE
+        // Let the kernel copy, or even share, the data.  If it can't do that
+        // between these file systems, fall back to reading and writing.
+        bool copiedAny = false;
+        while (true) {
+            ssize_t copied = ::copy_file_range(sourceFD, nullptr, destFD,
+                                               nullptr, 1 << 30, 0);
+            if (copied == 0)
+                return std::error_code();
+            if (copied > 0) {
+                copiedAny = true;
+                continue;
+            }
+            if (errno == EINTR)
+                continue;
+            if (copiedAny)
+                return std::error_code(errno, std::generic_category());
+            break;
+        }
+#endif
+        return fs::copy_file(source, destFD);
+    }
+
+    /// Rename \p source to \p destination.  If they are on different file
+    /// systems, copy to a temporary file next to \p destination and rename
+    /// that instead, so that \p destination is still replaced atomically.
+    std::error_code moveFile(const llvm::Twine &source,
+                             const llvm::Twine &destination) {
+        std::error_code error = fs::rename(source, destination);
+        if (error != std::errc::cross_device_link)
+            return error;
+
+        OpenFileRAII sourceFile;
+        if ((error = fs::openFileForRead(source, sourceFile.fd)))
+            return error;
+
+        OpenFileRAII tempFile;
+        SmallString<128> tempPath;
+        if ((error = fs::createUniqueFile(destination + "-%%%%%%%%",
+                                          tempFile.fd, tempPath)))
+            return error;
+
+        error = copyFileContents(source, sourceFile.fd, tempFile.fd);
+        if (!error) {
+            if (auto perms = fs::getPermissions(source))
+                fs::setPermissions(tempFile.fd, *perms);
+            error = fs::rename(tempPath, destination);
+        }
+        if (error) {
+            fs::remove(tempPath);
+            return error;
+        }
+        return fs::remove(source);
+    }
 } // end anonymous namespace
 
 std::error_code swift::moveFileIfDifferent(const llvm::Twine &source,
@@ -57,28 +197,12 @@ std::error_code swift::moveFileIfDifferent(const llvm::Twine &source,
     // If we could read the destination file, and it matches the source file in
     // size, they may be the same. Do an actual comparison of the contents.
     if (couldReadDest && sourceStatus.getSize() == destStatus.getSize()) {
-        uint64_t size = sourceStatus.getSize();
-        bool same = false;
-        if (size == 0) {
-            same = true;
-        } else {
-            std::error_code sourceRegionErr;
-            fs::mapped_file_region sourceRegion(sourceFile.fd,
-                                                fs::mapped_file_region::readonly,
-                                                size, 0, sourceRegionErr);
-            if (sourceRegionErr)
-                return sourceRegionErr;
-
-            std::error_code destRegionErr;
-            fs::mapped_file_region destRegion(destFile.fd,
-                                              fs::mapped_file_region::readonly,
-                                              size, 0, destRegionErr);
-
-            if (!destRegionErr) {
-                same = (0 == memcmp(sourceRegion.const_data(), destRegion.const_data(),
-                                    size));
-            }
-        }
+        bool same;
+        if (std::error_code error = compareOpenFiles(sourceFile.fd,
+                                                     destFile.fd,
+                                                     sourceStatus.getSize(),
+                                                     same))
+            return error;
 
         // If the file contents are the same, we are done. Just delete the source.
         if (same)
@@ -86,5 +210,219 @@ std::error_code swift::moveFileIfDifferent(const llvm::Twine &source,
     }
 
     // If we get here, we weren't able to prove that the files are the same.
-    return fs::rename(source, destination);
+    return moveFile(source, destination);
+}
+
+namespace {
+    /// An MD5 digest, as its high and low words.
+    using ContentHash = std::pair<uint64_t, uint64_t>;
+
+    int64_t getModificationTime(const fs::file_status &status) {
+        using namespace std::chrono;
+        return duration_cast<nanoseconds>(
+                status.getLastModificationTime().time_since_epoch()).count();
+    }
+
+    std::error_code hashOpenFile(int fd, uint64_t size, ContentHash &hash) {
+        llvm::MD5 hasher;
+        size_t bufferSize = std::min<uint64_t>(size, ChunkSize);
+        std::unique_ptr<char[]> buffer(new char[bufferSize]);
+        adviseSequentialRead(fd);
+        for (uint64_t offset = 0; offset < size; offset += bufferSize) {
+            size_t chunk = std::min<uint64_t>(bufferSize, size - offset);
+            if (std::error_code error = readChunk(fd, {buffer.get(), chunk},
+                                                  offset))
+                return error;
+            hasher.update(StringRef(buffer.get(), chunk));
+        }
+        llvm::MD5::MD5Result result;
+        hasher.final(result);
+        hash = result.words();
+        return std::error_code();
+    }
+
+    /// The persistent record of destination hashes used by
+    /// moveFilesIfDifferent.  Each line after the header holds a hash, a
+    /// size, a modification time in nanoseconds, and a path.
+    class HashSidecar {
+        struct Entry {
+            ContentHash Hash;
+            uint64_t Size;
+            int64_t ModificationTime;
+        };
+
+        /// Entries are only trusted if the file was last modified at least
+        /// this long before the sidecar was written.  A file rewritten with
+        /// the same size within the timestamp granularity of its file
+        /// system would otherwise look unchanged.
+        static const int64_t RacyWindow = 2000000000;
+
+        llvm::sys::Mutex Lock;
+        llvm::StringMap<Entry> Entries;
+
+    public:
+        void load(StringRef path) {
+            auto buffer = llvm::MemoryBuffer::getFile(path);
+            if (!buffer)
+                return;
+
+            StringRef rest = (*buffer)->getBuffer();
+            StringRef header;
+            std::tie(header, rest) = rest.split('\n');
+            int64_t writeTime;
+            if (!header.consume_front("swift-move-hashes 1 ") ||
+                header.getAsInteger(10, writeTime))
+                return;
+
+            while (!rest.empty()) {
+                StringRef line;
+                std::tie(line, rest) = rest.split('\n');
+                StringRef hash, size, time;
+                std::tie(hash, line) = line.split(' ');
+                std::tie(size, line) = line.split(' ');
+                std::tie(time, line) = line.split(' ');
+                Entry entry;
+                if (hash.size() != 32 || line.empty() ||
+                    hash.substr(0, 16).getAsInteger(16, entry.Hash.first) ||
+                    hash.substr(16).getAsInteger(16, entry.Hash.second) ||
+                    size.getAsInteger(10, entry.Size) ||
+                    time.getAsInteger(10, entry.ModificationTime))
+                    continue;
+                if (entry.ModificationTime > writeTime - RacyWindow)
+                    continue;
+                Entries[line] = entry;
+            }
+        }
+
+        void save(StringRef path) {
+            int fd;
+            SmallString<128> tempPath;
+            if (fs::createUniqueFile(path + "-%%%%%%%%", fd, tempPath))
+                return;
+
+            {
+                using namespace std::chrono;
+                llvm::raw_fd_ostream out(fd, /*shouldClose=*/true);
+                out << "swift-move-hashes 1 "
+                    << duration_cast<nanoseconds>(
+                            system_clock::now().time_since_epoch()).count()
+                    << '\n';
+                for (auto &entry : Entries) {
+                    const Entry &value = entry.second;
+                    out << llvm::format_hex_no_prefix(value.Hash.first, 16)
+                        << llvm::format_hex_no_prefix(value.Hash.second, 16)
+                        << ' ' << value.Size
+                        << ' ' << value.ModificationTime
+                        << ' ' << entry.first() << '\n';
+                }
+                out.close();
+                if (out.has_error()) {
+                    out.clear_error();
+                    fs::remove(tempPath);
+                    return;
+                }
+            }
+            if (fs::rename(tempPath, path))
+                fs::remove(tempPath);
+        }
+
+        /// Look up the hash of the file at \p path, if it is still the file
+        /// that was recorded.
+        bool lookup(StringRef path, const fs::file_status &status,
+                    ContentHash &hash) {
+            llvm::sys::ScopedLock L(Lock);
+            auto found = Entries.find(path);
+            if (found == Entries.end() ||
+                found->second.Size != status.getSize() ||
+                found->second.ModificationTime != getModificationTime(status))
+                return false;
+            hash = found->second.Hash;
+            return true;
+        }
+
+        void update(StringRef path, const fs::file_status &status,
+                    const ContentHash &hash) {
+            llvm::sys::ScopedLock L(Lock);
+            Entries[path] = {hash, status.getSize(),
+                             getModificationTime(status)};
+        }
+    };
+
+    /// Like moveFileIfDifferent, but consulting and updating \p sidecar
+    /// instead of comparing contents directly.
+    std::error_code moveFileIfDifferentUsingHashes(StringRef source,
+                                                   StringRef destination,
+                                                   HashSidecar &sidecar) {
+        if (fs::equivalent(source, destination))
+            return std::error_code();
+
+        OpenFileRAII sourceFile;
+        fs::file_status sourceStatus;
+        if (std::error_code error = fs::openFileForRead(source, sourceFile.fd))
+            return error;
+        if (std::error_code error = fs::status(sourceFile.fd, sourceStatus))
+            return error;
+
+        // The source is usually freshly written, so hashing it is cheap, and
+        // recording its hash saves reading the destination next time.
+        ContentHash sourceHash;
+        if (std::error_code error = hashOpenFile(sourceFile.fd,
+                                                 sourceStatus.getSize(),
+                                                 sourceHash))
+            return error;
+
+        fs::file_status destStatus;
+        if (!fs::status(destination, destStatus) &&
+            destStatus.getSize() == sourceStatus.getSize()) {
+            ContentHash destHash;
+            bool known = sidecar.lookup(destination, destStatus, destHash);
+            if (!known) {
+                OpenFileRAII destFile;
+                known = !fs::openFileForRead(destination, destFile.fd) &&
+                        !fs::status(destFile.fd, destStatus) &&
+                        !hashOpenFile(destFile.fd, destStatus.getSize(),
+                                      destHash);
+                if (known)
+                    sidecar.update(destination, destStatus, destHash);
+            }
+
+            // The destination is left untouched, so its record stays valid.
+            if (known && destHash == sourceHash)
+                return fs::remove(source);
+        }
+
+        if (std::error_code error = moveFile(source, destination))
+            return error;
+        if (!fs::status(destination, destStatus))
+            sidecar.update(destination, destStatus, sourceHash);
+        return std::error_code();
+    }
+} // end anonymous namespace
+
+std::vector<std::error_code>
+swift::moveFilesIfDifferent(ArrayRef<FileMove> moves,
+                            const MoveFilesOptions &options) {
+    std::vector<std::error_code> results(moves.size());
+    if (moves.empty())
+        return results;
+
+    std::unique_ptr<HashSidecar> sidecar;
+    if (!options.HashSidecarPath.empty()) {
+        sidecar.reset(new HashSidecar());
+        sidecar->load(options.HashSidecarPath);
+    }
+
+    llvm::parallelForEachN(0, moves.size(), [&](size_t i) {
+        const FileMove &move = moves[i];
+        if (sidecar)
+            results[i] = moveFileIfDifferentUsingHashes(
+                    move.Source, move.Destination, *sidecar);
+        else
+            results[i] = swift::moveFileIfDifferent(move.Source,
+                                                    move.Destination);
+    });
+
+    if (sidecar)
+        sidecar->save(options.HashSidecarPath);
+    return results;
 }
@@ -0,0 +1,306 @@
+//===--- Malloc.cpp - Pooled aligned allocation ---------------------------===//
+//
+// This source file is part of the Swift.org open source project
+//
+// Copyright (c) 2014 - 2017 Apple Inc. and the Swift project authors
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// See https://swift.org/LICENSE.txt for license information
+// See https://swift.org/CONTRIBUTORS.txt for the list of Swift project authors
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file implements the pooled allocator declared in Malloc.h.
+//
+//  Blocks of each power-of-two size class are carved out of slabs.  Free
+//  blocks live either in a per-thread cache, which needs no locking, or in
+//  a global depot.  Threads move blocks to and from the depot in batches.
+//
+//===----------------------------------------------------------------------===//
+
+#include "swift/Basic/Malloc.h"
+#include "swift/Basic/ThreadLocalState.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/Mutex.h"
+#include <atomic>
+
+using namespace swift;
+
+namespace {
+
+    enum : size_t {
+        MinClassShift = 4,
+        MaxClassShift = 12,
+        NumSizeClasses = MaxClassShift - MinClassShift + 1,
+
+        /// Slabs are aligned to the largest block size, so that every block
+        /// is aligned to its own size.
+        SlabSize = 64 * 1024,
+        SlabAlignment = size_t(1) << MaxClassShift,
+
+        /// The number of bytes of blocks moved between a thread and the depot
+        /// at once.
+        BatchBytes = 16 * 1024,
+        MaxBatchSize = 64,
+    };
+
+    static_assert(size_t(MaxPooledAllocSize) == size_t(SlabAlignment),
+                  "pooled size limit doesn't match the size classes");
+
+    unsigned getSizeClass(size_t size, size_t align) {
+        size_t needed = std::max(std::max(size, align),
+                                 size_t(1) << MinClassShift);
+        return llvm::Log2_64_Ceil(needed) - MinClassShift;
+    }
+
+    size_t getBlockSize(unsigned sizeClass) {
+        return size_t(1) << (sizeClass + MinClassShift);
+    }
+
+    size_t getBatchSize(unsigned sizeClass) {
+        return std::min<size_t>(MaxBatchSize,
+                                BatchBytes / getBlockSize(sizeClass));
+    }
+
+    struct FreeBlock {
+        FreeBlock *Next;
+    };
+
+    /// A list of free blocks of one size class.
+    struct FreeList {
+        FreeBlock *Head = nullptr;
+        size_t Count = 0;
+
+        void push(void *p) {
+            auto block = static_cast<FreeBlock *>(p);
+            block->Next = Head;
+            Head = block;
+            Count++;
+        }
+
+        void *pop() {
+            FreeBlock *block = Head;
+            Head = block->Next;
+            Count--;
+            return block;
+        }
+
+        /// Move up to \p n blocks from this list to \p other.
+        void moveTo(FreeList &other, size_t n) {
+            while (n-- && Head)
+                other.push(pop());
+        }
+    };
+
+    /// The global counters behind PooledAllocStatistics.
+    struct SharedStatistics {
+        std::atomic<size_t> ReservedBytes{0};
+        std::atomic<size_t> AllocatedBytes{0};
+        std::atomic<size_t> FreedBytes{0};
+        std::atomic<size_t> NumAllocations{0};
+        std::atomic<size_t> NumDeallocations{0};
+        std::atomic<size_t> NumLargeAllocations{0};
+        std::atomic<size_t> NumRefills{0};
+        std::atomic<size_t> NumReturns{0};
+    };
+
+    /// A thread's counts that haven't been published yet.
+    struct LocalStatistics {
+        size_t AllocatedBytes = 0;
+        size_t FreedBytes = 0;
+        size_t NumAllocations = 0;
+        size_t NumDeallocations = 0;
+        size_t NumLargeAllocations = 0;
+
+        void publish(SharedStatistics &shared) {
+            auto add = [](std::atomic<size_t> &counter, size_t &local) {
+                if (local) counter.fetch_add(local, std::memory_order_relaxed);
+                local = 0;
+            };
+            add(shared.AllocatedBytes, AllocatedBytes);
+            add(shared.FreedBytes, FreedBytes);
+            add(shared.NumAllocations, NumAllocations);
+            add(shared.NumDeallocations, NumDeallocations);
+            add(shared.NumLargeAllocations, NumLargeAllocations);
+        }
+    };
+
+    /// The global pool of free blocks.  Only blocks carved out of slabs
+    /// may ever be put into it.
+    class Depot {
+        llvm::sys::Mutex Mux;
+        FreeList Lists[NumSizeClasses];
+
+        /// Return the free list of the given class, carving a new slab into
+        /// it if it is empty.  Mux must be held.
+        FreeList &getNonEmptyList(unsigned sizeClass) {
+            FreeList &depotList = Lists[sizeClass];
+            if (!depotList.Head) {
+                void *memory = AlignedAlloc(SlabSize, SlabAlignment);
+                auto slab = static_cast<char *>(memory);
+                size_t blockSize = getBlockSize(sizeClass);
+                for (size_t offset = SlabSize; offset != 0; offset -= blockSize)
+                    depotList.push(slab + offset - blockSize);
+                Stats.ReservedBytes.fetch_add(SlabSize,
+                                              std::memory_order_relaxed);
+            }
+            return depotList;
+        }
+
+    public:
+        SharedStatistics Stats;
+
+        /// Move a batch of free blocks of the given class to \p list.
+        void refill(unsigned sizeClass, FreeList &list) {
+            llvm::sys::ScopedLock L(Mux);
+            getNonEmptyList(sizeClass).moveTo(list, getBatchSize(sizeClass));
+            Stats.NumRefills.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /// Allocate a single block, for a thread without a cache.
+        void *allocate(unsigned sizeClass) {
+            void *p;
+            {
+                llvm::sys::ScopedLock L(Mux);
+                p = getNonEmptyList(sizeClass).pop();
+            }
+            Stats.NumAllocations.fetch_add(1, std::memory_order_relaxed);
+            Stats.AllocatedBytes.fetch_add(getBlockSize(sizeClass),
+                                           std::memory_order_relaxed);
+            return p;
+        }
+
+        /// Free a single block, for a thread without a cache.
+        void deallocate(unsigned sizeClass, void *p) {
+            {
+                llvm::sys::ScopedLock L(Mux);
+                Lists[sizeClass].push(p);
+            }
+            Stats.NumDeallocations.fetch_add(1, std::memory_order_relaxed);
+            Stats.FreedBytes.fetch_add(getBlockSize(sizeClass),
+                                       std::memory_order_relaxed);
+        }
+
+        /// Move up to \p n blocks from \p list back to the depot.
+        void takeBack(unsigned sizeClass, FreeList &list, size_t n) {
+            llvm::sys::ScopedLock L(Mux);
+            list.moveTo(Lists[sizeClass], n);
+            Stats.NumReturns.fetch_add(1, std::memory_order_relaxed);
+        }
+    };
+
+    Depot &getDepot() {
+        return getLeakedSingleton<Depot>();
+    }
+
+    /// A thread's cache of free blocks.  Once it has been destroyed,
+    /// pooled memory allocated or freed later during thread exit goes
+    /// straight to the depot.
+    struct ThreadCache {
+        FreeList Lists[NumSizeClasses];
+        LocalStatistics Stats;
+
+        static ThreadCache *get() {
+            return ThreadLocalState<ThreadCache>::get();
+        }
+
+        ~ThreadCache() {
+            Depot &depot = getDepot();
+            for (unsigned sizeClass = 0; sizeClass != NumSizeClasses;
+                 ++sizeClass) {
+                FreeList &list = Lists[sizeClass];
+                if (list.Count)
+                    depot.takeBack(sizeClass, list, list.Count);
+            }
+            Stats.publish(depot.Stats);
+        }
+    };
+
+} // end anonymous namespace
+
+void *swift::PooledAlignedAlloc(size_t size, size_t align) {
+    ThreadCache *cache = ThreadCache::get();
+    if (size > MaxPooledAllocSize || align > MaxPooledAllocSize) {
+        if (cache) {
+            cache->Stats.NumAllocations++;
+            cache->Stats.NumLargeAllocations++;
+        } else {
+            SharedStatistics &stats = getDepot().Stats;
+            stats.NumAllocations.fetch_add(1, std::memory_order_relaxed);
+            stats.NumLargeAllocations.fetch_add(1, std::memory_order_relaxed);
+        }
+        return AlignedAlloc(size, align);
+    }
+
+    unsigned sizeClass = getSizeClass(size, align);
+    if (!cache) {
+        // The thread is exiting.  The block must still come from a slab,
+        // since PooledAlignedFree will put it in the pool.
+        return getDepot().allocate(sizeClass);
+    }
+
+    FreeList &list = cache->Lists[sizeClass];
+    if (!list.Head) {
+        Depot &depot = getDepot();
+        depot.refill(sizeClass, list);
+        cache->Stats.publish(depot.Stats);
+    }
+
+    cache->Stats.NumAllocations++;
+    cache->Stats.AllocatedBytes += getBlockSize(sizeClass);
+    return list.pop();
+}
+
+void swift::PooledAlignedFree(void *p, size_t size, size_t align) {
+    ThreadCache *cache = ThreadCache::get();
+    if (size > MaxPooledAllocSize || align > MaxPooledAllocSize) {
+        if (cache)
+            cache->Stats.NumDeallocations++;
+        else
+            getDepot().Stats.NumDeallocations.fetch_add(
+                    1, std::memory_order_relaxed);
+        return AlignedFree(p);
+    }
+
+    unsigned sizeClass = getSizeClass(size, align);
+    if (!cache) {
+        // The thread is exiting; hand the block straight to the depot.
+        getDepot().deallocate(sizeClass, p);
+        return;
+    }
+
+    cache->Stats.NumDeallocations++;
+    cache->Stats.FreedBytes += getBlockSize(sizeClass);
+
+    // Keep up to two batches locally, so that a thread alternating between
+    // allocating and freeing doesn't bounce blocks off the depot.
+    FreeList &list = cache->Lists[sizeClass];
+    list.push(p);
+    size_t batchSize = getBatchSize(sizeClass);
+    if (list.Count > 2 * batchSize) {
+        Depot &depot = getDepot();
+        depot.takeBack(sizeClass, list, batchSize);
+        cache->Stats.publish(depot.Stats);
+    }
+}
+
+PooledAllocStatistics swift::getPooledAllocStatistics() {
+    SharedStatistics &shared = getDepot().Stats;
+    if (ThreadCache *cache = ThreadCache::get())
+        cache->Stats.publish(shared);
+
+    auto load = [](const std::atomic<size_t> &counter) {
+        return counter.load(std::memory_order_relaxed);
+    };
+    PooledAllocStatistics stats;
+    stats.ReservedBytes = load(shared.ReservedBytes);
+    size_t allocated = load(shared.AllocatedBytes);
+    size_t freed = load(shared.FreedBytes);
+    stats.InUseBytes = allocated > freed ? allocated - freed : 0;
+    stats.NumAllocations = load(shared.NumAllocations);
+    stats.NumDeallocations = load(shared.NumDeallocations);
+    stats.NumLargeAllocations = load(shared.NumLargeAllocations);
+    stats.NumRefills = load(shared.NumRefills);
+    stats.NumReturns = load(shared.NumReturns);
+    return stats;
+}
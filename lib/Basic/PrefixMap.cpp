@@ -11,8 +11,12 @@
 //===----------------------------------------------------------------------===//
 
 #include "swift/Basic/PrefixMap.h"
+#include "swift/Basic/FrozenPrefixMap.h"
 #include "swift/Basic/QuotedString.h"
 #include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/raw_ostream.h"
 
 using namespace swift;
 
@@ -134,3 +138,48 @@ void PrefixMapKeyPrinter<unsigned char>::print(raw_ostream &out,
     }
     out << '\'';
 }
+
+std::error_code swift::writeFrozenPrefixMapBuffer(StringRef path,
+                                                  StringRef buffer) {
+    std::error_code error;
+    llvm::raw_fd_ostream out(path, error, llvm::sys::fs::OF_None);
+    if (error)
+        return error;
+    out << buffer;
+    out.close();
+    return out.error();
+}
+
+llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>>
+swift::readFrozenPrefixMapBuffer(StringRef path) {
+    namespace fs = llvm::sys::fs;
+
+    int fd;
+    if (std::error_code error = fs::openFileForRead(path, fd))
+        return error;
+
+    fs::file_status status;
+    if (std::error_code error = fs::status(fd, status)) {
+        llvm::sys::Process::SafelyCloseFileDescriptor(fd);
+        return error;
+    }
+
+    // The mapping (if any) outlives the file descriptor.
+    auto buffer = llvm::MemoryBuffer::getOpenFile(
+            fd, path, status.getSize(), /*RequiresNullTerminator=*/false);
+    llvm::sys::Process::SafelyCloseFileDescriptor(fd);
+    if (!buffer)
+        return buffer.getError();
+
+    // Reject anything that isn't a frozen prefix map of a version we
+    // understand; the caller checks the rest of the header.
+    FrozenPrefixMapHeader header;
+    if ((*buffer)->getBufferSize() < sizeof(header))
+        return std::make_error_code(std::errc::invalid_argument);
+    memcpy(&header, (*buffer)->getBufferStart(), sizeof(header));
+    if (header.Magic != FrozenPrefixMapHeader::MagicNumber ||
+        header.Version != FrozenPrefixMapHeader::CurrentVersion)
+        return std::make_error_code(std::errc::invalid_argument);
+
+    return std::move(*buffer);
+}
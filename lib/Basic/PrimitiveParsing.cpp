@@ -29,47 +29,52 @@ unsigned swift::measureNewline(const char *BufferPtr, const char *BufferEnd) {
 
     assert(*BufferPtr == '\r');
     unsigned Bytes = 1;
+    ++BufferPtr;
     if (BufferPtr != BufferEnd && *BufferPtr == '\n')
         Bytes++;
     return Bytes;
 }
 
-void
-swift::trimLeadingWhitespaceFromLines(StringRef RawText,
-                                      unsigned WhitespaceToTrim,
-                                      SmallVectorImpl<StringRef> &OutLines) {
-    SmallVector<StringRef, 8> Lines;
-
+unsigned
+swift::splitIntoLinesMeasuringIndentation(StringRef Text,
+                                          SmallVectorImpl<StringRef> &Lines) {
+    unsigned Indentation = ~0U;
     bool IsFirstLine = true;
 
-    while (!RawText.empty()) {
-        size_t Pos = RawText.find_first_of("\n\r");
-        if (Pos == StringRef::npos)
-            Pos = RawText.size();
-
-        StringRef Line = RawText.substr(0, Pos);
-        Lines.push_back(Line);
+    const char *Ptr = Text.begin(), *End = Text.end();
+    while (Ptr != End) {
+        const char *LineEnd = findFirstOf2(Ptr, End, '\n', '\r');
+        Lines.push_back(StringRef(Ptr, LineEnd - Ptr));
         if (!IsFirstLine) {
-            size_t NonWhitespacePos = RawText.find_first_not_of(' ');
-            if (NonWhitespacePos != StringRef::npos)
-                WhitespaceToTrim =
-                        std::min(WhitespaceToTrim,
-                                 static_cast<unsigned>(NonWhitespacePos));
+            const char *NonSpace = Ptr;
+            while (NonSpace != LineEnd && *NonSpace == ' ')
+                ++NonSpace;
+            if (NonSpace != End)
+                Indentation = std::min(Indentation,
+                                       static_cast<unsigned>(NonSpace - Ptr));
         }
         IsFirstLine = false;
 
-        RawText = RawText.drop_front(Pos);
-        unsigned NewlineBytes = measureNewline(RawText);
-        RawText = RawText.drop_front(NewlineBytes);
+        Ptr = LineEnd + measureNewline(LineEnd, End);
     }
+    return Indentation;
+}
 
-    IsFirstLine = true;
-    for (auto &Line : Lines) {
-        if (!IsFirstLine) {
-            Line = Line.drop_front(WhitespaceToTrim);
-        }
-        IsFirstLine = false;
-    }
+void
+swift::trimLeadingWhitespaceFromLines(StringRef RawText,
+                                      unsigned WhitespaceToTrim,
+                                      SmallVectorImpl<StringRef> &OutLines) {
+    size_t FirstLine = OutLines.size();
+    WhitespaceToTrim = std::min(WhitespaceToTrim,
+                                splitIntoLinesMeasuringIndentation(RawText,
+                                                                   OutLines));
+    if (WhitespaceToTrim == 0)
+        return;
 
-    OutLines.append(Lines.begin(), Lines.end());
+    // The first line is never trimmed.  A final line of only spaces may be
+    // shorter than the indentation.
+    for (size_t I = FirstLine + 1, E = OutLines.size(); I < E; ++I) {
+        StringRef &Line = OutLines[I];
+        Line = Line.drop_front(std::min<size_t>(WhitespaceToTrim, Line.size()));
+    }
 }
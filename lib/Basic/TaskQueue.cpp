@@ -18,6 +18,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "swift/Basic/TaskQueue.h"
+#include "swift/Basic/Trace.h"
 
 using namespace swift;
 using namespace swift::sys;
@@ -56,6 +57,7 @@ void DummyTaskQueue::addTask(const char *ExecPath, ArrayRef<const char *> Args,
 bool DummyTaskQueue::execute(TaskQueue::TaskBeganCallback Began,
                              TaskQueue::TaskFinishedCallback Finished,
                              TaskQueue::TaskSignalledCallback Signalled) {
+    SWIFT_TRACE_SCOPE("DummyTaskQueue::execute");
     typedef std::pair<ProcessId, std::unique_ptr<DummyTask>> PidTaskPair;
     std::queue<PidTaskPair> ExecutingTasks;
 
@@ -11,7 +11,383 @@
 //===----------------------------------------------------------------------===//
 
 #include "swift/Basic/Timer.h"
+#include "swift/Basic/JSONSerialization.h"
+#include "swift/Basic/ThreadLocalState.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/Mutex.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <string>
 
 using namespace swift;
 
 SharedTimer::State SharedTimer::CompilationTimersEnabled = State::Initial;
+
+std::atomic<bool> swift::detail::TimerRegistryEnabled(false);
+
+//===----------------------------------------------------------------------===//
+// DurationHistogram
+//===----------------------------------------------------------------------===//
+
+unsigned DurationHistogram::getBucketIndex(uint64_t value) {
+    if (value < 2 * SubBucketCount)
+        return value;
+    unsigned shift = llvm::Log2_64(value) - SubBucketBits;
+    return (shift + 1) * SubBucketCount +
+           unsigned((value >> shift) - SubBucketCount);
+}
+
+uint64_t DurationHistogram::getBucketMidpoint(unsigned index) {
+    if (index < 2 * SubBucketCount)
+        return index;
+    unsigned shift = index / SubBucketCount - 1;
+    uint64_t lower = uint64_t(index % SubBucketCount + SubBucketCount) << shift;
+    return lower + ((uint64_t(1) << shift) - 1) / 2;
+}
+
+void DurationHistogram::record(uint64_t nanos) {
+    unsigned index = getBucketIndex(nanos);
+    if (index >= Counts.size())
+        Counts.resize(index + 1);
+    Counts[index]++;
+    Count++;
+    Total += nanos;
+    Min = std::min(Min, nanos);
+    Max = std::max(Max, nanos);
+}
+
+void DurationHistogram::merge(const DurationHistogram &other) {
+    if (other.Counts.size() > Counts.size())
+        Counts.resize(other.Counts.size());
+    for (size_t i = 0, e = other.Counts.size(); i != e; ++i)
+        Counts[i] += other.Counts[i];
+    Count += other.Count;
+    Total += other.Total;
+    Min = std::min(Min, other.Min);
+    Max = std::max(Max, other.Max);
+}
+
+uint64_t DurationHistogram::getQuantile(double quantile) const {
+    if (Count == 0)
+        return 0;
+
+    uint64_t rank = uint64_t(std::ceil(quantile * Count));
+    rank = std::min(std::max<uint64_t>(rank, 1), Count);
+    uint64_t seen = 0;
+    for (unsigned i = 0, e = Counts.size(); i != e; ++i) {
+        seen += Counts[i];
+        if (seen >= rank)
+            return std::min(std::max(getBucketMidpoint(i), Min), Max);
+    }
+    return Max;
+}
+
+//===----------------------------------------------------------------------===//
+// The timer registry
+//===----------------------------------------------------------------------===//
+
+namespace {
+
+    /// A position in a call tree of AggregateTimers.
+    struct TimerNode {
+        std::string Name;
+        TimerNode *Parent;
+        std::vector<std::unique_ptr<TimerNode>> Children;
+        DurationHistogram Durations;
+
+        TimerNode(StringRef name, TimerNode *parent)
+                : Name(name), Parent(parent) {}
+
+        TimerNode *getChild(StringRef name) {
+            // Nodes rarely have more than a handful of children.
+            for (auto &child : Children)
+                if (child->Name == name)
+                    return child.get();
+            Children.emplace_back(new TimerNode(name, this));
+            return Children.back().get();
+        }
+
+        void merge(const TimerNode &other) {
+            Durations.merge(other.Durations);
+            for (auto &child : other.Children)
+                getChild(child->Name)->merge(*child);
+        }
+    };
+
+    /// The call tree of one thread.
+    struct ThreadTimers {
+        /// Held by the owning thread while it updates the tree, and by
+        /// reports while they read it.
+        llvm::sys::Mutex Lock;
+
+        TimerNode Root;
+        TimerNode *Current;
+
+        ThreadTimers() : Root("", nullptr), Current(&Root) {}
+    };
+
+    struct Registry {
+        llvm::sys::Mutex Lock;
+        std::vector<ThreadTimers *> Threads;
+
+        /// The merged call trees of threads that have exited.
+        TimerNode Retired;
+
+        std::string ReportJSONPath;
+
+        Registry() : Retired("", nullptr) {}
+    };
+
+    Registry &getRegistry() {
+        return getLeakedSingleton<Registry>();
+    }
+
+    /// Retires the calling thread's call tree when the thread exits.
+    struct ThreadState {
+        ThreadTimers *Timers = nullptr;
+
+        ~ThreadState() {
+            if (!Timers) return;
+
+            Registry &registry = getRegistry();
+            llvm::sys::ScopedLock L(registry.Lock);
+            registry.Retired.merge(Timers->Root);
+            registry.Threads.erase(std::find(registry.Threads.begin(),
+                                             registry.Threads.end(), Timers));
+            delete Timers;
+        }
+    };
+
+    /// Return the calling thread's call tree, or null if the thread is
+    /// exiting.
+    ThreadTimers *getThreadTimers() {
+        ThreadState *state = ThreadLocalState<ThreadState>::get();
+        if (!state) return nullptr;
+        if (!state->Timers) {
+            state->Timers = new ThreadTimers();
+            Registry &registry = getRegistry();
+            llvm::sys::ScopedLock L(registry.Lock);
+            registry.Threads.push_back(state->Timers);
+        }
+        return state->Timers;
+    }
+
+    uint64_t getNanoseconds() {
+        using namespace std::chrono;
+        return duration_cast<nanoseconds>(
+                steady_clock::now().time_since_epoch()).count();
+    }
+
+    /// Merge the call trees of every thread, past and present.
+    std::unique_ptr<TimerNode> collectTimers() {
+        std::unique_ptr<TimerNode> root(new TimerNode("", nullptr));
+        Registry &registry = getRegistry();
+        llvm::sys::ScopedLock L(registry.Lock);
+        root->merge(registry.Retired);
+        for (ThreadTimers *timers : registry.Threads) {
+            llvm::sys::ScopedLock TL(timers->Lock);
+            root->merge(timers->Root);
+        }
+        return root;
+    }
+
+    /// Return the children of \p node, most expensive first.
+    std::vector<const TimerNode *> getSortedChildren(const TimerNode &node) {
+        std::vector<const TimerNode *> children;
+        for (auto &child : node.Children)
+            children.push_back(child.get());
+        std::stable_sort(children.begin(), children.end(),
+                         [](const TimerNode *lhs, const TimerNode *rhs) {
+                             return lhs->Durations.getTotal() >
+                                    rhs->Durations.getTotal();
+                         });
+        return children;
+    }
+
+    /// The JSON form of a TimerNode.
+    struct TimerReportNode {
+        std::string Name;
+        uint64_t Count;
+        uint64_t TotalNanos;
+        uint64_t MinNanos;
+        uint64_t MedianNanos;
+        uint64_t P90Nanos;
+        uint64_t P99Nanos;
+        uint64_t MaxNanos;
+        std::vector<TimerReportNode> Children;
+
+        explicit TimerReportNode(const TimerNode &node) : Name(node.Name) {
+            const DurationHistogram &durations = node.Durations;
+            Count = durations.getCount();
+            TotalNanos = durations.getTotal();
+            MinNanos = durations.getMin();
+            MedianNanos = durations.getQuantile(0.5);
+            P90Nanos = durations.getQuantile(0.9);
+            P99Nanos = durations.getQuantile(0.99);
+            MaxNanos = durations.getMax();
+            for (const TimerNode *child : getSortedChildren(node))
+                Children.emplace_back(*child);
+        }
+    };
+
+    struct TimerReport {
+        std::vector<TimerReportNode> Timers;
+    };
+
+    void writeTextRows(llvm::raw_ostream &os, const TimerNode &node,
+                       unsigned depth) {
+        auto micros = [](uint64_t nanos) { return nanos / 1000.0; };
+        for (const TimerNode *child : getSortedChildren(node)) {
+            const DurationHistogram &durations = child->Durations;
+            os << llvm::format("%10llu %12.3f %10.3f %10.3f %10.3f %10.3f "
+                               "%10.3f  ",
+                               (unsigned long long) durations.getCount(),
+                               durations.getTotal() / 1e6,
+                               micros(durations.getMin()),
+                               micros(durations.getQuantile(0.5)),
+                               micros(durations.getQuantile(0.9)),
+                               micros(durations.getQuantile(0.99)),
+                               micros(durations.getMax()));
+            os.indent(2 * depth) << child->Name << '\n';
+            writeTextRows(os, *child, depth + 1);
+        }
+    }
+
+    void reportTimersAtExit() {
+        writeTimerReportText(llvm::errs());
+
+        std::string path = getRegistry().ReportJSONPath;
+        if (path.empty())
+            return;
+        std::error_code error;
+        llvm::raw_fd_ostream out(path, error, llvm::sys::fs::OF_None);
+        if (error) {
+            llvm::errs() << "error: cannot write timer report to '" << path
+                         << "': " << error.message() << '\n';
+            return;
+        }
+        writeTimerReportJSON(out);
+    }
+
+} // end anonymous namespace
+
+namespace swift {
+    namespace json {
+
+        template<>
+        struct ObjectTraits<TimerReportNode> {
+            static void mapping(Output &out, TimerReportNode &node) {
+                out.mapRequired("name", node.Name);
+                out.mapRequired("count", node.Count);
+                out.mapRequired("total_ns", node.TotalNanos);
+                out.mapRequired("min_ns", node.MinNanos);
+                out.mapRequired("median_ns", node.MedianNanos);
+                out.mapRequired("p90_ns", node.P90Nanos);
+                out.mapRequired("p99_ns", node.P99Nanos);
+                out.mapRequired("max_ns", node.MaxNanos);
+                out.mapRequired("children", node.Children);
+            }
+        };
+
+        template<>
+        struct ArrayTraits<std::vector<TimerReportNode>> {
+            static size_t size(Output &,
+                               std::vector<TimerReportNode> &seq) {
+                return seq.size();
+            }
+
+            static TimerReportNode &element(Output &,
+                                            std::vector<TimerReportNode> &seq,
+                                            size_t index) {
+                return seq[index];
+            }
+        };
+
+        template<>
+        struct ObjectTraits<TimerReport> {
+            static void mapping(Output &out, TimerReport &report) {
+                out.mapRequired("timers", report.Timers);
+            }
+        };
+
+    } // end namespace json
+} // end namespace swift
+
+void swift::setTimerRegistryEnabled(bool enabled) {
+    detail::TimerRegistryEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+void AggregateTimer::start(StringRef name) {
+    ThreadTimers *timers = getThreadTimers();
+    if (!timers) return;
+
+    {
+        llvm::sys::ScopedLock L(timers->Lock);
+        TimerNode *node = timers->Current->getChild(name);
+        timers->Current = node;
+        Node = node;
+    }
+    Start = getNanoseconds();
+}
+
+void AggregateTimer::stop() {
+    uint64_t end = getNanoseconds();
+    auto node = static_cast<TimerNode *>(Node);
+    Node = nullptr;
+
+    // The thread's call tree is gone if it is already exiting.
+    ThreadTimers *timers = getThreadTimers();
+    if (!timers) return;
+
+    llvm::sys::ScopedLock L(timers->Lock);
+    node->Durations.record(end - Start);
+    timers->Current = node->Parent;
+}
+
+void swift::writeTimerReportText(llvm::raw_ostream &os) {
+    std::unique_ptr<TimerNode> root = collectTimers();
+
+    os << "===" << std::string(73, '-') << "===\n"
+       << "                          Aggregate timer report\n"
+       << "===" << std::string(73, '-') << "===\n"
+       << "     Count   Total (ms)   Min (us)   Med (us)   P90 (us)   "
+          "P99 (us)   Max (us)  Name\n";
+    writeTextRows(os, *root, 0);
+    os.flush();
+}
+
+void swift::writeTimerReportJSON(llvm::raw_ostream &os, bool prettyPrint) {
+    std::unique_ptr<TimerNode> root = collectTimers();
+
+    TimerReport report;
+    for (const TimerNode *child : getSortedChildren(*root))
+        report.Timers.emplace_back(*child);
+
+    json::Output out(os, prettyPrint);
+    out << report;
+    os << '\n';
+}
+
+void swift::enableTimerReportAtExit(StringRef jsonPath) {
+    Registry &registry = getRegistry();
+    {
+        llvm::sys::ScopedLock L(registry.Lock);
+        registry.ReportJSONPath = jsonPath.str();
+    }
+    setTimerRegistryEnabled(true);
+
+    static bool Registered = [] {
+        // Make sure stderr is constructed before the handler is registered,
+        // so that it is still alive when the handler runs.
+        (void) llvm::errs();
+        std::atexit(reportTimersAtExit);
+        return true;
+    }();
+    (void) Registered;
+}
@@ -0,0 +1,273 @@
+//===--- Trace.cpp - Scoped event tracing ---------------------------------===//
+//
+// This source file is part of the Swift.org open source project
+//
+// Copyright (c) 2014 - 2017 Apple Inc. and the Swift project authors
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// See https://swift.org/LICENSE.txt for license information
+// See https://swift.org/CONTRIBUTORS.txt for the list of Swift project authors
+//
+//===----------------------------------------------------------------------===//
+//
+//  This file implements the per-thread event buffers behind Trace.h and
+//  their export to the Chrome trace-event format.
+//
+//===----------------------------------------------------------------------===//
+
+#include "swift/Basic/Trace.h"
+#include "swift/Basic/JSONSerialization.h"
+#include "swift/Basic/ThreadLocalState.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/Mutex.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/raw_ostream.h"
+#include <chrono>
+#include <memory>
+#include <vector>
+
+using namespace swift;
+
+std::atomic<bool> swift::detail::TracingEnabled(false);
+
+namespace {
+
+    /// The ring buffer of events recorded by one thread.
+    struct ThreadBuffer {
+        std::unique_ptr<TraceEvent[]> Events;
+        uint64_t Mask;
+
+        /// The number of events recorded since the buffer was last
+        /// cleared; the event at index Head - 1 is the most recent.  The
+        /// owning thread advances it, and clearTraceBuffers() resets it.
+        /// Because the owner's update is not an atomic increment, the two
+        /// must never overlap, and neither may overlap writeChromeTrace().
+        std::atomic<uint64_t> Head;
+
+        uint64_t ThreadId;
+
+        /// Set when the owning thread exits; the buffer is kept until the
+        /// next clearTraceBuffers() so its events can still be exported.
+        std::atomic<bool> Exited;
+
+        ThreadBuffer(size_t capacity, uint64_t threadId)
+                : Events(new TraceEvent[capacity]), Mask(capacity - 1),
+                  Head(0), ThreadId(threadId), Exited(false) {}
+
+        size_t getCapacity() const { return Mask + 1; }
+    };
+
+    struct Registry {
+        llvm::sys::Mutex Lock;
+        std::vector<ThreadBuffer *> Buffers;
+        size_t Capacity = 32 * 1024;
+
+        ThreadBuffer *createBuffer() {
+            llvm::sys::ScopedLock L(Lock);
+            auto buffer = new ThreadBuffer(Capacity, llvm::get_threadid());
+            Buffers.push_back(buffer);
+            return buffer;
+        }
+    };
+
+    Registry &getRegistry() {
+        return getLeakedSingleton<Registry>();
+    }
+
+    /// Marks the calling thread's buffer as exited when the thread exits.
+    struct ThreadState {
+        ThreadBuffer *Buffer = nullptr;
+
+        ~ThreadState() {
+            if (Buffer)
+                Buffer->Exited.store(true, std::memory_order_release);
+        }
+    };
+
+    /// Return the calling thread's buffer, or null if the thread is exiting.
+    ThreadBuffer *getThreadBuffer() {
+        ThreadState *state = ThreadLocalState<ThreadState>::get();
+        if (!state) return nullptr;
+        if (!state->Buffer)
+            state->Buffer = getRegistry().createBuffer();
+        return state->Buffer;
+    }
+
+    /// A timestamp in nanoseconds, written as fractional microseconds.
+    struct ChromeTimestamp {
+        uint64_t Nanos;
+    };
+
+    struct ChromeCounterArgs {
+        int64_t Value;
+    };
+
+    struct ChromeEvent {
+        StringRef Name;
+        StringRef Phase;
+        ChromeTimestamp Timestamp;
+        uint64_t ProcessId;
+        uint64_t ThreadId;
+        Optional<ChromeCounterArgs> Args;
+    };
+
+    struct ChromeTrace {
+        std::vector<ChromeEvent> Events;
+        StringRef DisplayTimeUnit = "ns";
+    };
+
+} // end anonymous namespace
+
+namespace swift {
+    namespace json {
+
+        template<>
+        struct ScalarTraits<ChromeTimestamp> {
+            static void output(const ChromeTimestamp &value,
+                               llvm::raw_ostream &os) {
+                os << value.Nanos / 1000 << '.';
+                unsigned fraction = value.Nanos % 1000;
+                if (fraction < 100) os << '0';
+                if (fraction < 10) os << '0';
+                os << fraction;
+            }
+
+            static bool mustQuote(StringRef) { return false; }
+        };
+
+        template<>
+        struct ObjectTraits<ChromeCounterArgs> {
+            static void mapping(Output &out, ChromeCounterArgs &args) {
+                out.mapRequired("value", args.Value);
+            }
+        };
+
+        template<>
+        struct ObjectTraits<ChromeEvent> {
+            static void mapping(Output &out, ChromeEvent &event) {
+                out.mapRequired("name", event.Name);
+                out.mapRequired("ph", event.Phase);
+                out.mapRequired("ts", event.Timestamp);
+                out.mapRequired("pid", event.ProcessId);
+                out.mapRequired("tid", event.ThreadId);
+                out.mapOptional("args", event.Args);
+            }
+        };
+
+        template<>
+        struct ArrayTraits<std::vector<ChromeEvent>> {
+            static size_t size(Output &, std::vector<ChromeEvent> &seq) {
+                return seq.size();
+            }
+
+            static ChromeEvent &element(Output &,
+                                        std::vector<ChromeEvent> &seq,
+                                        size_t index) {
+                return seq[index];
+            }
+        };
+
+        template<>
+        struct ObjectTraits<ChromeTrace> {
+            static void mapping(Output &out, ChromeTrace &trace) {
+                out.mapRequired("traceEvents", trace.Events);
+                out.mapRequired("displayTimeUnit", trace.DisplayTimeUnit);
+            }
+        };
+
+    } // end namespace json
+} // end namespace swift
+
+void swift::detail::recordTraceEvent(TraceEventKind kind, const char *name,
+                                     int64_t value) {
+    ThreadBuffer *buffer = getThreadBuffer();
+    if (!buffer) return;
+
+    uint64_t head = buffer->Head.load(std::memory_order_relaxed);
+    TraceEvent &event = buffer->Events[head & buffer->Mask];
+    event.Timestamp = getTraceTimestamp();
+    event.Name = name;
+    event.Value = value;
+    event.Kind = kind;
+    buffer->Head.store(head + 1, std::memory_order_release);
+}
+
+void swift::setTracingEnabled(bool enabled) {
+    detail::TracingEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+void swift::setTraceBufferCapacity(size_t numEvents) {
+    Registry &registry = getRegistry();
+    llvm::sys::ScopedLock L(registry.Lock);
+    registry.Capacity = llvm::PowerOf2Ceil(std::max<size_t>(numEvents, 2));
+}
+
+uint64_t swift::getTraceTimestamp() {
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(
+            steady_clock::now().time_since_epoch()).count();
+}
+
+void swift::writeChromeTrace(llvm::raw_ostream &os, bool prettyPrint) {
+    assert(!isTracingEnabled() && "exporting events while recording them");
+    ChromeTrace trace;
+    uint64_t processId = llvm::sys::Process::getProcessId();
+
+    {
+        Registry &registry = getRegistry();
+        llvm::sys::ScopedLock L(registry.Lock);
+        for (ThreadBuffer *buffer : registry.Buffers) {
+            uint64_t head = buffer->Head.load(std::memory_order_acquire);
+            uint64_t first = head > buffer->getCapacity()
+                             ? head - buffer->getCapacity() : 0;
+
+            // Ends whose beginning has been overwritten would unbalance the
+            // thread's stack of scopes.
+            unsigned depth = 0;
+            for (uint64_t i = first; i != head; ++i) {
+                const TraceEvent &event = buffer->Events[i & buffer->Mask];
+                ChromeEvent chromeEvent;
+                chromeEvent.Name = event.Name;
+                chromeEvent.Timestamp = {event.Timestamp};
+                chromeEvent.ProcessId = processId;
+                chromeEvent.ThreadId = buffer->ThreadId;
+                switch (event.Kind) {
+                    case TraceEventKind::Begin:
+                        ++depth;
+                        chromeEvent.Phase = "B";
+                        break;
+                    case TraceEventKind::End:
+                        if (depth == 0) continue;
+                        --depth;
+                        chromeEvent.Phase = "E";
+                        break;
+                    case TraceEventKind::Counter:
+                        chromeEvent.Phase = "C";
+                        chromeEvent.Args = ChromeCounterArgs{event.Value};
+                        break;
+                }
+                trace.Events.push_back(chromeEvent);
+            }
+        }
+    }
+
+    json::Output out(os, prettyPrint);
+    out << trace;
+}
+
+void swift::clearTraceBuffers() {
+    assert(!isTracingEnabled() && "clearing events while recording them");
+    Registry &registry = getRegistry();
+    llvm::sys::ScopedLock L(registry.Lock);
+    auto live = registry.Buffers.begin();
+    for (ThreadBuffer *buffer : registry.Buffers) {
+        if (buffer->Exited.load(std::memory_order_acquire)) {
+            delete buffer;
+            continue;
+        }
+        buffer->Head.store(0, std::memory_order_relaxed);
+        *live++ = buffer;
+    }
+    registry.Buffers.erase(live, registry.Buffers.end());
+}
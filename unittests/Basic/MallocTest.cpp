@@ -0,0 +1,77 @@
+//===--- MallocTest.cpp - Tests for the pooled allocator ------------------===//
+//
+// This source file is part of the Swift.org open source project
+//
+// Copyright (c) 2014 - 2017 Apple Inc. and the Swift project authors
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// See https://swift.org/LICENSE.txt for license information
+// See https://swift.org/CONTRIBUTORS.txt for the list of Swift project authors
+//
+//===----------------------------------------------------------------------===//
+
+#include "swift/Basic/Malloc.h"
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+using namespace swift;
+
+namespace {
+
+    /// Allocates and frees pooled memory when it is destroyed at thread
+    /// exit.
+    struct AllocateOnExit {
+        bool Armed = false;
+
+        ~AllocateOnExit() {
+            if (!Armed) return;
+            void *p = PooledAlignedAlloc(40, 8);
+            memset(p, 0xAB, 40);
+            PooledAlignedFree(p, 40, 8);
+        }
+    };
+
+    thread_local AllocateOnExit ExitAllocator;
+
+} // end anonymous namespace
+
+TEST(PooledAlignedAlloc, AllocateDuringThreadExit) {
+    std::thread worker([] {
+        // Construct the thread_local before the thread's cache, so that it
+        // is destroyed after the cache.
+        ExitAllocator.Armed = true;
+        PooledAlignedFree(PooledAlignedAlloc(40, 8), 40, 8);
+    });
+    worker.join();
+
+    // Every block of the size class must still be a full, aligned block.
+    std::vector<void *> blocks;
+    for (unsigned i = 0; i != 4096; ++i) {
+        void *p = PooledAlignedAlloc(64, 64);
+        EXPECT_EQ(0U, reinterpret_cast<uintptr_t>(p) % 64);
+        memset(p, 0xCD, 64);
+        blocks.push_back(p);
+    }
+    for (void *p : blocks)
+        PooledAlignedFree(p, 64, 64);
+}
+
+TEST(PooledAlignedAlloc, StatisticsCountLargeRequests) {
+    PooledAllocStatistics before = getPooledAllocStatistics();
+    void *small = PooledAlignedAlloc(32, 8);
+    void *large = PooledAlignedAlloc(2 * MaxPooledAllocSize, 8);
+
+    PooledAllocStatistics during = getPooledAllocStatistics();
+    EXPECT_EQ(before.NumAllocations + 2, during.NumAllocations);
+    EXPECT_EQ(before.NumLargeAllocations + 1, during.NumLargeAllocations);
+    EXPECT_EQ(before.NumDeallocations, during.NumDeallocations);
+
+    PooledAlignedFree(large, 2 * MaxPooledAllocSize, 8);
+    PooledAlignedFree(small, 32, 8);
+    PooledAllocStatistics after = getPooledAllocStatistics();
+    EXPECT_EQ(after.NumAllocations - before.NumAllocations,
+              after.NumDeallocations - before.NumDeallocations);
+}
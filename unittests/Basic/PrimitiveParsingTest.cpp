@@ -0,0 +1,138 @@
+//===--- PrimitiveParsingTest.cpp - Tests for primitive parsing -----------===//
+//
+// This source file is part of the Swift.org open source project
+//
+// Copyright (c) 2014 - 2017 Apple Inc. and the Swift project authors
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// See https://swift.org/LICENSE.txt for license information
+// See https://swift.org/CONTRIBUTORS.txt for the list of Swift project authors
+//
+//===----------------------------------------------------------------------===//
+
+#include "swift/Basic/PrimitiveParsing.h"
+#include "llvm/ADT/SmallVector.h"
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using namespace swift;
+
+namespace {
+
+    /// A byte-at-a-time version of splitIntoLinesMeasuringIndentation.
+    unsigned splitSlowly(StringRef text, std::vector<std::string> &lines) {
+        unsigned indentation = ~0U;
+        size_t i = 0;
+        while (i != text.size()) {
+            size_t lineStart = i;
+            while (i != text.size() && text[i] != '\n' && text[i] != '\r')
+                ++i;
+            lines.push_back(text.slice(lineStart, i).str());
+            if (lineStart != 0) {
+                size_t nonSpace = lineStart;
+                while (nonSpace != i && text[nonSpace] == ' ')
+                    ++nonSpace;
+                if (nonSpace != text.size())
+                    indentation = std::min(indentation,
+                                           unsigned(nonSpace - lineStart));
+            }
+
+            // Consume the terminator: CRLF, CR or LF.
+            if (i != text.size()) {
+                if (text[i] == '\r' && i + 1 != text.size() &&
+                    text[i + 1] == '\n')
+                    i += 2;
+                else
+                    i += 1;
+            }
+        }
+        return indentation;
+    }
+
+    void checkSplit(StringRef text) {
+        std::vector<std::string> expected;
+        unsigned expectedIndentation = splitSlowly(text, expected);
+
+        SmallVector<StringRef, 4> lines;
+        unsigned indentation = splitIntoLinesMeasuringIndentation(text, lines);
+        std::vector<std::string> actual;
+        for (StringRef line : lines)
+            actual.push_back(line.str());
+        EXPECT_EQ(expected, actual) << '"' << text.str() << '"';
+        EXPECT_EQ(expectedIndentation, indentation)
+                << '"' << text.str() << '"';
+    }
+
+} // end anonymous namespace
+
+TEST(PrimitiveParsing, MeasureNewline) {
+    EXPECT_EQ(0U, measureNewline(""));
+    EXPECT_EQ(1U, measureNewline("\n"));
+    EXPECT_EQ(1U, measureNewline("\nx"));
+    EXPECT_EQ(1U, measureNewline("\n\r"));
+    EXPECT_EQ(2U, measureNewline("\r\n"));
+    EXPECT_EQ(2U, measureNewline("\r\nx"));
+    EXPECT_EQ(1U, measureNewline("\r"));
+    EXPECT_EQ(1U, measureNewline("\rx"));
+    EXPECT_EQ(1U, measureNewline("\r\r\n"));
+}
+
+TEST(PrimitiveParsing, SplitTerminators) {
+    SmallVector<StringRef, 4> lines;
+    EXPECT_EQ(1U, splitIntoLinesMeasuringIndentation("a\n b\r\n  c\r   d\n",
+                                                     lines));
+    ASSERT_EQ(4U, lines.size());
+    EXPECT_EQ("a", lines[0]);
+    EXPECT_EQ(" b", lines[1]);
+    EXPECT_EQ("  c", lines[2]);
+    EXPECT_EQ("   d", lines[3]);
+
+    lines.clear();
+    EXPECT_EQ(~0U, splitIntoLinesMeasuringIndentation("", lines));
+    EXPECT_TRUE(lines.empty());
+
+    lines.clear();
+    EXPECT_EQ(~0U, splitIntoLinesMeasuringIndentation("only\r\n", lines));
+    ASSERT_EQ(1U, lines.size());
+    EXPECT_EQ("only", lines[0]);
+
+    // A final line of only spaces doesn't count towards the indentation.
+    lines.clear();
+    EXPECT_EQ(2U, splitIntoLinesMeasuringIndentation("a\n  b\n ", lines));
+    EXPECT_EQ(3U, lines.size());
+}
+
+TEST(PrimitiveParsing, SplitAcrossWordBoundaries) {
+    // Put each kind of terminator, and bytes that a word-at-a-time scan
+    // could confuse with one, at every position across several words, and
+    // start the text at every alignment.
+    const char *terminators[] = {"\n", "\r", "\r\n", "\n\r", "\r\r"};
+    const char fillers[] = {' ', 'x', '\t', '\x0C', '\x0E', '\x8D', '\x8A'};
+    for (const char *terminator : terminators) {
+        for (char filler : fillers) {
+            for (size_t position = 0; position != 26; ++position) {
+                std::string text(26, filler);
+                text.insert(position, terminator);
+                text.insert(position / 2, "\n   ");
+                for (size_t offset = 0; offset != 8; ++offset) {
+                    std::string buffer = std::string(offset, '#') + text;
+                    StringRef shifted = StringRef(buffer).drop_front(offset);
+                    checkSplit(shifted);
+                    checkSplit(shifted.drop_back(position % 3));
+                }
+            }
+        }
+    }
+}
+
+TEST(PrimitiveParsing, TrimLeadingWhitespace) {
+    SmallVector<StringRef, 4> lines;
+    trimLeadingWhitespaceFromLines("first\r\n    a\r      b\n   ", 4, lines);
+    ASSERT_EQ(4U, lines.size());
+    EXPECT_EQ("first", lines[0]);
+    EXPECT_EQ("a", lines[1]);
+    EXPECT_EQ("  b", lines[2]);
+    EXPECT_EQ("", lines[3]);
+}
@@ -0,0 +1,85 @@
+//===--- TopCollectionTest.cpp - Tests for TopCollection ------------------===//
+//
+// This source file is part of the Swift.org open source project
+//
+// Copyright (c) 2014 - 2017 Apple Inc. and the Swift project authors
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// See https://swift.org/LICENSE.txt for license information
+// See https://swift.org/CONTRIBUTORS.txt for the list of Swift project authors
+//
+//===----------------------------------------------------------------------===//
+
+#include "swift/Basic/TopCollection.h"
+#include "gtest/gtest.h"
+#include <random>
+#include <utility>
+#include <vector>
+
+using namespace swift;
+
+namespace {
+
+    using Collection = TopCollection<int, unsigned>;
+
+    std::vector<std::pair<int, unsigned>> contents(const Collection &c) {
+        std::vector<std::pair<int, unsigned>> result;
+        for (const auto &entry : c)
+            result.push_back({entry.Score, entry.Value});
+        return result;
+    }
+
+    /// Apply the same random operations to a sorted and a heap collection,
+    /// checking after each one that they agree.
+    void checkSameBehavior(unsigned maxSize, unsigned seed) {
+        std::mt19937 rng(seed);
+        Collection sorted(maxSize, Collection::Representation::Sorted);
+        Collection heap(maxSize, Collection::Representation::Heap);
+        unsigned nextValue = 0;
+
+        for (unsigned step = 0; step != 2000; ++step) {
+            unsigned op = rng() % 100;
+            if (op < 90) {
+                // Few distinct scores, so that ties are common.
+                int score = rng() % (maxSize + 8);
+                unsigned value = nextValue++;
+                EXPECT_EQ(sorted.insert(score, unsigned(value)),
+                          heap.insert(score, unsigned(value)));
+            } else if (op < 95) {
+                int range = rng() % 16;
+                sorted.filterMaxScoreRange(range);
+                heap.filterMaxScoreRange(range);
+            } else {
+                Collection other(maxSize);
+                for (unsigned i = 0, e = rng() % (2 * maxSize); i != e; ++i)
+                    other.insert(rng() % (maxSize + 8), nextValue++);
+                sorted.merge(other);
+                heap.merge(other);
+            }
+
+            ASSERT_EQ(contents(sorted), contents(heap)) << "step " << step;
+            EXPECT_EQ(sorted.getMinUninterestingScore(1000),
+                      heap.getMinUninterestingScore(1000));
+        }
+    }
+
+} // end anonymous namespace
+
+TEST(TopCollection, HeapMatchesSorted) {
+    for (unsigned maxSize : {1u, 2u, 5u, 16u, 64u, 100u})
+        for (unsigned seed = 0; seed != 20; ++seed)
+            checkSameBehavior(maxSize, seed);
+}
+
+TEST(TopCollection, DefaultRepresentation) {
+    Collection small(Collection::MinHeapMaxSize - 1);
+    Collection large(Collection::MinHeapMaxSize);
+    for (unsigned i = 0; i != 200; ++i) {
+        small.insert(int(i * 7919 % 200), unsigned(i));
+        large.insert(int(i * 7919 % 200), unsigned(i));
+    }
+    auto smallContents = contents(small);
+    auto largeContents = contents(large);
+    largeContents.pop_back();
+    EXPECT_EQ(smallContents, largeContents);
+}
@@ -0,0 +1,169 @@
+//===--- VarintTest.cpp - Tests for variable length integers --------------===//
+//
+// This source file is part of the Swift.org open source project
+//
+// Copyright (c) 2014 - 2017 Apple Inc. and the Swift project authors
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// See https://swift.org/LICENSE.txt for license information
+// See https://swift.org/CONTRIBUTORS.txt for the list of Swift project authors
+//
+//===----------------------------------------------------------------------===//
+
+#include "swift/Basic/Varint.h"
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+using namespace swift;
+
+namespace {
+
+    /// Values on either side of each boundary between encoding lengths.
+    std::vector<uint64_t> getBoundaryValues() {
+        std::vector<uint64_t> values = {0, 1, UINT64_MAX};
+        for (unsigned bits : {7, 14, 21, 28, 35, 42, 49, 56, 63}) {
+            uint64_t limit = uint64_t(1) << bits;
+            values.push_back(limit - 1);
+            values.push_back(limit);
+            values.push_back(limit + 1);
+        }
+        return values;
+    }
+
+    /// Decode \p encoded with both decoders, with and without slack after
+    /// the last encoding, so that both the word-at-a-time and the bytewise
+    /// paths are taken.
+    template<typename T>
+    void checkDecodes(const std::vector<uint8_t> &encoded,
+                      const std::vector<T> &expected) {
+        for (size_t slack : {0, 8}) {
+            std::vector<uint8_t> buffer(encoded);
+            buffer.resize(encoded.size() + slack, 0xFF);
+            const uint8_t *begin = buffer.data();
+            const uint8_t *end = begin + encoded.size();
+
+            std::vector<T> decoded(expected.size());
+            EXPECT_EQ(end, Varint::decodeArray<T>(begin, end, decoded));
+            EXPECT_EQ(expected, decoded);
+
+            std::vector<T> checked(expected.size());
+            auto result = Varint::decodeArrayChecked<T>(begin, end, checked);
+            ASSERT_TRUE(bool(result));
+            EXPECT_EQ(end, *result);
+            EXPECT_EQ(expected, checked);
+        }
+    }
+
+    template<typename T>
+    bool rejects(std::vector<uint8_t> bytes, size_t count = 1) {
+        // Slack after the input must not be read.
+        size_t size = bytes.size();
+        bytes.resize(size + 8, 0x00);
+        std::vector<T> out(count);
+        return !Varint::decodeArrayChecked<T>(bytes.data(),
+                                              bytes.data() + size, out);
+    }
+
+} // end anonymous namespace
+
+TEST(Varint, EncodedSizeAtBoundaries) {
+    for (unsigned bits = 1; bits != 64; ++bits) {
+        uint64_t value = uint64_t(1) << bits;
+        EXPECT_EQ(size_t(bits / 7 + 1), Varint::getEncodedSize(value));
+        EXPECT_EQ(size_t((bits + 6) / 7), Varint::getEncodedSize(value - 1));
+    }
+    EXPECT_EQ(size_t(1), Varint::getEncodedSize(uint64_t(0)));
+    EXPECT_EQ(Varint::getMaxEncodedSize<uint64_t>(),
+              Varint::getEncodedSize(UINT64_MAX));
+}
+
+TEST(Varint, RoundTripUnsigned) {
+    std::vector<uint64_t> values = getBoundaryValues();
+    for (uint64_t value : values) {
+        auto bytes = Varint::encode<uint64_t>(value);
+        EXPECT_EQ(Varint::getEncodedSize(value), bytes.size());
+        EXPECT_EQ(value, Varint::decode<uint64_t>(bytes.data()));
+        std::vector<uint8_t> encoded(bytes.begin(), bytes.end());
+        checkDecodes(encoded, std::vector<uint64_t>{value});
+    }
+
+    llvm::SmallVector<uint8_t, 64> encoded;
+    Varint::encodeArray(llvm::makeArrayRef(values), encoded);
+    EXPECT_EQ(Varint::getEncodedSize(llvm::makeArrayRef(values)),
+              encoded.size());
+    checkDecodes(std::vector<uint8_t>(encoded.begin(), encoded.end()),
+                 values);
+}
+
+TEST(Varint, RoundTripSigned) {
+    std::vector<int64_t> values = {0, 1, -1, INT64_MAX, INT64_MIN};
+    for (uint64_t boundary : getBoundaryValues()) {
+        if (boundary > uint64_t(INT64_MAX)) continue;
+        values.push_back(int64_t(boundary));
+        values.push_back(-int64_t(boundary));
+    }
+    for (int64_t value : values)
+        EXPECT_EQ(value, Varint::decode<int64_t>(
+                Varint::encode<int64_t>(value).data()));
+
+    llvm::SmallVector<uint8_t, 64> encoded;
+    Varint::encodeArray(llvm::makeArrayRef(values), encoded);
+    checkDecodes(std::vector<uint8_t>(encoded.begin(), encoded.end()),
+                 values);
+}
+
+TEST(Varint, RoundTripNarrowTypes) {
+    std::vector<uint32_t> values = {0, 127, 128, 16383, 16384, UINT32_MAX};
+    llvm::SmallVector<uint8_t, 32> encoded;
+    Varint::encodeArray(llvm::makeArrayRef(values), encoded);
+    checkDecodes(std::vector<uint8_t>(encoded.begin(), encoded.end()),
+                 values);
+
+    std::vector<int8_t> small = {0, -1, 63, -64, 64, INT8_MAX, INT8_MIN};
+    llvm::SmallVector<uint8_t, 16> smallEncoded;
+    Varint::encodeArray(llvm::makeArrayRef(small), smallEncoded);
+    checkDecodes(std::vector<uint8_t>(smallEncoded.begin(),
+                                      smallEncoded.end()),
+                 small);
+}
+
+TEST(Varint, RejectsTruncatedInput) {
+    for (uint64_t value : getBoundaryValues()) {
+        auto bytes = Varint::encode<uint64_t>(value);
+        for (size_t size = 0; size != bytes.size(); ++size)
+            EXPECT_TRUE(rejects<uint64_t>(
+                    std::vector<uint8_t>(bytes.begin(), bytes.begin() + size)))
+                    << value << " truncated to " << size;
+    }
+
+    // More values requested than are present.
+    EXPECT_TRUE(rejects<uint64_t>({0x01, 0x02}, 3));
+
+    // Only continuation bytes, longer than a word.
+    EXPECT_TRUE(rejects<uint64_t>(std::vector<uint8_t>(12, 0x80)));
+}
+
+TEST(Varint, RejectsOverlongInput) {
+    // Values one past the largest of each type.
+    auto encodeWide = [](uint64_t value) {
+        auto bytes = Varint::encode<uint64_t>(value);
+        return std::vector<uint8_t>(bytes.begin(), bytes.end());
+    };
+    EXPECT_TRUE(rejects<uint8_t>(encodeWide(uint64_t(UINT8_MAX) + 1)));
+    EXPECT_TRUE(rejects<uint16_t>(encodeWide(uint64_t(UINT16_MAX) + 1)));
+    EXPECT_TRUE(rejects<uint32_t>(encodeWide(uint64_t(UINT32_MAX) + 1)));
+    EXPECT_FALSE(rejects<uint32_t>(encodeWide(UINT32_MAX)));
+
+    // More bytes than the type can need, even if the value would fit.
+    EXPECT_TRUE(rejects<uint32_t>({0x80, 0x80, 0x80, 0x80, 0x80, 0x00}));
+    EXPECT_TRUE(rejects<uint64_t>({0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+                                   0x80, 0x80, 0x80, 0x80, 0x00}));
+
+    // A tenth byte carrying more than the 64th bit.
+    EXPECT_TRUE(rejects<uint64_t>({0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+                                   0xFF, 0xFF, 0xFF, 0x02}));
+    EXPECT_FALSE(rejects<uint64_t>({0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+                                    0xFF, 0xFF, 0xFF, 0x01}));
+}